@@ -0,0 +1,819 @@
+// accel.h
+// Devon McKee, 2025
+// Acceleration structure helpers, expects utils.h to be included first.
+
+#pragma once
+
+struct AccelerationStructure {
+    VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
+    Buffer buffer;
+    VkDeviceAddress address = 0;
+    VkDeviceSize size = 0;
+    void create(Device device, VkAccelerationStructureTypeKHR type, VkDeviceSize size, bool hostVisible = false);
+    void destroy(Device device);
+};
+
+// hostVisible places the AS in host memory, as host (vkBuildAccelerationStructuresKHR) builds need
+void AccelerationStructure::create(Device device, VkAccelerationStructureTypeKHR type, VkDeviceSize size, bool hostVisible) {
+    this->size = size;
+    createBuffer(device, size, buffer, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, !hostVisible);
+
+    VkAccelerationStructureCreateInfoKHR accelerationStructureCI {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .buffer = buffer.buffer,
+        .size = size,
+        .type = type
+    };
+    vkCheck(vkCreateAccelerationStructureKHR(device.device, &accelerationStructureCI, nullptr, &handle));
+
+    VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+        .accelerationStructure = handle
+    };
+    address = vkGetAccelerationStructureDeviceAddressKHR(device.device, &accelerationStructureDeviceAddressInfo);
+}
+
+void AccelerationStructure::destroy(Device device) {
+    if (handle == VK_NULL_HANDLE) return;
+    vkDestroyAccelerationStructureKHR(device.device, handle, nullptr);
+    destroyBuffer(device, buffer);
+    handle = VK_NULL_HANDLE;
+}
+
+VkPhysicalDeviceAccelerationStructurePropertiesKHR getAccelerationStructureProperties(Device device) {
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR };
+    VkPhysicalDeviceProperties2 devProp2 { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &asProperties };
+    vkGetPhysicalDeviceProperties2(device.physicalDevice, &devProp2);
+    return asProperties;
+}
+
+const VkDeviceSize SCRATCH_ARENA_LIMIT = 256 << 20; // default size an arena may grow to for batching
+
+// Persistent scratch memory for AS builds, kept between builds and only
+// reallocated when a build needs more. The buffer is padded so address can be
+// rounded up to minAccelerationStructureScratchOffsetAlignment, and regions
+// handed to concurrent builds are multiples of that alignment.
+struct ScratchArena {
+    Buffer buffer;
+    VkDeviceAddress address = 0;
+    VkDeviceSize size = 0;
+    VkDeviceSize alignment = 0;
+    VkDeviceSize limit = SCRATCH_ARENA_LIMIT; // wantSize is capped here, minSize never is
+    void reserve(Device device, VkDeviceSize minSize, VkDeviceSize wantSize);
+    VkDeviceSize regionSize(VkDeviceSize scratchSize) const { return alignedSize(scratchSize, alignment); }
+    void destroy(Device device);
+};
+
+// Grows the arena to hold at least minSize bytes and up to wantSize, the
+// queue must be idle when it does
+void ScratchArena::reserve(Device device, VkDeviceSize minSize, VkDeviceSize wantSize) {
+    if (alignment == 0) alignment = getAccelerationStructureProperties(device).minAccelerationStructureScratchOffsetAlignment;
+    VkDeviceSize newSize = regionSize(std::max(minSize, std::min(wantSize, limit)));
+    if (newSize <= size) return;
+    destroy(device);
+    size = newSize;
+    createBuffer(device, size + alignment, buffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    address = alignedSize(getBufferDeviceAddress(device, buffer), alignment);
+}
+
+void ScratchArena::destroy(Device device) {
+    if (size == 0) return;
+    destroyBuffer(device, buffer);
+    buffer = Buffer();
+    address = 0;
+    size = 0;
+}
+
+// Makes AS builds recorded before the barrier visible to builds (and scratch
+// reuse) recorded after it
+void accelerationStructureBuildBarrier(VkCommandBuffer commandBuffer) {
+    VkMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// One triangle geometry of a BLAS, addresses point at the first vertex/index.
+// For host builds they are host pointers instead.
+struct TriangleGeometry {
+    VkFormat vertexFormat;
+    VkDeviceAddress vertexAddress;
+    VkDeviceSize vertexStride;
+    uint32_t maxVertex;
+    VkIndexType indexType; // VK_INDEX_TYPE_NONE_KHR for non-indexed triangles
+    VkDeviceAddress indexAddress;
+    VkDeviceAddress transformAddress; // 0 for none
+    uint32_t primitiveOffset; // bytes into the index (or vertex) data
+    uint32_t primitiveCount;
+};
+
+VkAccelerationStructureGeometryKHR accelerationStructureGeometry(const TriangleGeometry& mesh, bool host = false) {
+    VkAccelerationStructureGeometryKHR geometry {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+        .geometry = {
+            .triangles = {
+                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                .vertexFormat = mesh.vertexFormat,
+                .vertexData = { .deviceAddress = mesh.vertexAddress },
+                .vertexStride = mesh.vertexStride,
+                .maxVertex = mesh.maxVertex,
+                .indexType = mesh.indexType,
+                .indexData = { .deviceAddress = mesh.indexAddress },
+                .transformData = { .deviceAddress = mesh.transformAddress }
+            }
+        },
+        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
+    };
+    if (host) {
+        VkAccelerationStructureGeometryTrianglesDataKHR& triangles = geometry.geometry.triangles;
+        triangles.vertexData.hostAddress = (const void*)(uintptr_t)mesh.vertexAddress;
+        triangles.indexData.hostAddress = (const void*)(uintptr_t)mesh.indexAddress;
+        triangles.transformData.hostAddress = (const void*)(uintptr_t)mesh.transformAddress;
+    }
+    return geometry;
+}
+
+// Procedural primitives of a BLAS as axis aligned boxes (VkAabbPositionsKHR),
+// hit when the intersection shader reports a hit inside one
+struct AabbGeometry {
+    VkDeviceAddress aabbAddress;
+    VkDeviceSize stride;
+    uint32_t primitiveOffset; // bytes into the AABB data
+    uint32_t primitiveCount;
+};
+
+VkAccelerationStructureGeometryKHR accelerationStructureGeometry(const AabbGeometry& aabbs) {
+    return {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_AABBS_KHR,
+        .geometry = {
+            .aabbs = {
+                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR,
+                .data = { .deviceAddress = aabbs.aabbAddress },
+                .stride = aabbs.stride
+            }
+        },
+        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
+    };
+}
+
+struct BuildStats {
+    VkDeviceSize accelerationSize = 0;
+    VkDeviceSize scratchSize = 0;
+    size_t primitiveCount = 0;
+    size_t buildCalls = 0; // vkCmdBuildAccelerationStructuresKHR calls recorded
+    double buildMs = 0.0;
+    double transferMs = 0.0; // host builds: serializing and deserializing onto the device
+};
+
+// Collects BLAS builds and records them in as few build calls as the scratch
+// arena allows: consecutive builds are packed into one call while their scratch
+// regions fit side by side, and a barrier is only recorded between calls, where
+// the arena is reused.
+struct BlasBuildScheduler {
+    struct Request {
+        std::vector<VkAccelerationStructureGeometryKHR> geometries;
+        std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges;
+        VkAccelerationStructureBuildGeometryInfoKHR buildInfo;
+        VkDeviceSize scratchSize;
+    };
+    Device device;
+    std::vector<Request> requests;
+    BuildStats stats;
+    void add(const std::vector<TriangleGeometry>& mesh, VkBuildAccelerationStructureFlagsKHR flags, AccelerationStructure& blas,
+        VkBuildAccelerationStructureModeKHR mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+    void add(const AabbGeometry& aabbs, VkBuildAccelerationStructureFlagsKHR flags, AccelerationStructure& blas,
+        VkBuildAccelerationStructureModeKHR mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+    void queue(Request& request, const std::vector<uint32_t>& primitiveCounts, VkBuildAccelerationStructureFlagsKHR flags, AccelerationStructure& blas,
+        VkBuildAccelerationStructureModeKHR mode);
+    void reserve(ScratchArena& scratch) const;
+    void record(VkCommandBuffer commandBuffer, const ScratchArena& scratch);
+};
+
+// Queues a build of blas, creating it at its build size unless it already
+// exists. An existing blas must have been created for the same counts and
+// flags (and not compacted); MODE_UPDATE refits it in place and needs
+// ALLOW_UPDATE in flags, as it was built with.
+void BlasBuildScheduler::add(const std::vector<TriangleGeometry>& mesh, VkBuildAccelerationStructureFlagsKHR flags, AccelerationStructure& blas, VkBuildAccelerationStructureModeKHR mode) {
+    Request& request = requests.emplace_back();
+    std::vector<uint32_t> primitiveCounts;
+    for (const TriangleGeometry& geometry : mesh) {
+        request.geometries.push_back(accelerationStructureGeometry(geometry));
+        request.ranges.push_back({ .primitiveCount = geometry.primitiveCount, .primitiveOffset = geometry.primitiveOffset });
+        primitiveCounts.push_back(geometry.primitiveCount);
+        stats.primitiveCount += geometry.primitiveCount;
+    }
+    queue(request, primitiveCounts, flags, blas, mode);
+}
+
+void BlasBuildScheduler::add(const AabbGeometry& aabbs, VkBuildAccelerationStructureFlagsKHR flags, AccelerationStructure& blas, VkBuildAccelerationStructureModeKHR mode) {
+    Request& request = requests.emplace_back();
+    request.geometries.push_back(accelerationStructureGeometry(aabbs));
+    request.ranges.push_back({ .primitiveCount = aabbs.primitiveCount, .primitiveOffset = aabbs.primitiveOffset });
+    stats.primitiveCount += aabbs.primitiveCount;
+    queue(request, { aabbs.primitiveCount }, flags, blas, mode);
+}
+
+// Sizes the request queued by add and points it at blas
+void BlasBuildScheduler::queue(Request& request, const std::vector<uint32_t>& primitiveCounts, VkBuildAccelerationStructureFlagsKHR flags, AccelerationStructure& blas,
+    VkBuildAccelerationStructureModeKHR mode) {
+    request.buildInfo = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .flags = flags,
+        .mode = mode,
+        .geometryCount = (uint32_t)request.geometries.size(),
+        .pGeometries = request.geometries.data()
+    };
+    VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+    vkGetAccelerationStructureBuildSizesKHR(device.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &request.buildInfo, primitiveCounts.data(), &accelerationStructureBuildSizesInfo);
+    if (blas.handle == VK_NULL_HANDLE) {
+        blas.create(device, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, accelerationStructureBuildSizesInfo.accelerationStructureSize);
+    }
+    request.buildInfo.dstAccelerationStructure = blas.handle;
+    if (mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR) {
+        request.buildInfo.srcAccelerationStructure = blas.handle;
+        request.scratchSize = accelerationStructureBuildSizesInfo.updateScratchSize;
+    } else {
+        request.scratchSize = accelerationStructureBuildSizesInfo.buildScratchSize;
+    }
+    stats.accelerationSize += blas.size;
+}
+
+// Enough for the largest build, more (up to the arena's limit) when the
+// builds could otherwise share fewer calls
+void BlasBuildScheduler::reserve(ScratchArena& scratch) const {
+    if (scratch.alignment == 0) scratch.alignment = getAccelerationStructureProperties(device).minAccelerationStructureScratchOffsetAlignment;
+    VkDeviceSize largest = 0, total = 0;
+    for (const Request& request : requests) {
+        largest = std::max(largest, scratch.regionSize(request.scratchSize));
+        total += scratch.regionSize(request.scratchSize);
+    }
+    scratch.reserve(device, largest, total);
+}
+
+void BlasBuildScheduler::record(VkCommandBuffer commandBuffer, const ScratchArena& scratch) {
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos;
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> ranges;
+    VkDeviceSize offset = 0;
+    auto flush = [&]() {
+        if (buildInfos.empty()) return;
+        if (stats.buildCalls > 0) accelerationStructureBuildBarrier(commandBuffer); // scratch is reused
+        vkCmdBuildAccelerationStructuresKHR(commandBuffer, (uint32_t)buildInfos.size(), buildInfos.data(), ranges.data());
+        stats.buildCalls++;
+        buildInfos.clear();
+        ranges.clear();
+        offset = 0;
+    };
+    for (Request& request : requests) {
+        VkDeviceSize region = scratch.regionSize(request.scratchSize);
+        if (offset + region > scratch.size) flush();
+        request.buildInfo.pGeometries = request.geometries.data();
+        request.buildInfo.scratchData = { .deviceAddress = scratch.address + offset };
+        buildInfos.push_back(request.buildInfo);
+        ranges.push_back(request.ranges.data());
+        offset += region;
+    }
+    flush();
+    stats.scratchSize = std::max(stats.scratchSize, scratch.size);
+    requests.clear();
+}
+
+// Builds one BLAS per entry of meshes with the matching entry of meshFlags,
+// batched by BlasBuildScheduler into one command buffer using scratch from the
+// arena. Pass VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR for
+// BLASes that will go through compactAccelerationStructures.
+BuildStats buildBottomLevelAccelerationStructures(Device device, VkCommandPool commandPool, ScratchArena& scratch, const std::vector<std::vector<TriangleGeometry>>& meshes,
+    std::vector<AccelerationStructure>& blases, const std::vector<VkBuildAccelerationStructureFlagsKHR>& meshFlags) {
+    BlasBuildScheduler scheduler = { device };
+    blases.resize(meshes.size());
+    for (size_t m = 0; m < meshes.size(); m++) {
+        scheduler.add(meshes[m], meshFlags[m], blases[m]);
+    }
+    scheduler.reserve(scratch);
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    scheduler.record(commandBuffer, scratch);
+    auto buildStart = std::chrono::steady_clock::now();
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    scheduler.stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+    return scheduler.stats;
+}
+
+// The same flags for every BLAS
+BuildStats buildBottomLevelAccelerationStructures(Device device, VkCommandPool commandPool, ScratchArena& scratch, const std::vector<std::vector<TriangleGeometry>>& meshes,
+    std::vector<AccelerationStructure>& blases, VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR) {
+    return buildBottomLevelAccelerationStructures(device, commandPool, scratch, meshes, blases, std::vector<VkBuildAccelerationStructureFlagsKHR>(meshes.size(), flags));
+}
+
+// Builds a BLAS of procedural primitives, traced through the intersection
+// shader of the hit group its instance selects
+BuildStats buildProceduralAccelerationStructure(Device device, VkCommandPool commandPool, ScratchArena& scratch, const AabbGeometry& aabbs, AccelerationStructure& blas,
+    VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR) {
+    BlasBuildScheduler scheduler = { device };
+    scheduler.add(aabbs, flags, blas);
+    scheduler.reserve(scratch);
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    scheduler.record(commandBuffer, scratch);
+    auto buildStart = std::chrono::steady_clock::now();
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    scheduler.stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+    return scheduler.stats;
+}
+
+// When a dynamic BLAS is rebuilt instead of refit: refits keep the tree built
+// for the original vertex positions and only grow its boxes, so trace speed
+// degrades with the number of refits and with how far the geometry moved
+struct RefitPolicy {
+    uint32_t maxRefits = 64;
+    float maxAreaGrowth = 1.5f; // bounds surface area relative to the last build
+};
+
+// A BLAS whose vertices change after it was built, built with ALLOW_UPDATE and
+// never compacted so that a rebuild fits in place
+struct DynamicBlas {
+    uint32_t mesh; // index into the BLAS array
+    float buildLo[3] = { 0.0f, 0.0f, 0.0f }; // bounds of the last full build
+    float buildHi[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t refits = 0; // since the last full build
+    bool needsRebuild(const float lo[3], const float hi[3], const RefitPolicy& policy) const;
+};
+
+inline float boxSurfaceArea(const float lo[3], const float hi[3]) {
+    float d[3];
+    for (int k = 0; k < 3; k++) d[k] = std::max(hi[k] - lo[k], 0.0f);
+    return 2.0f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+bool DynamicBlas::needsRebuild(const float lo[3], const float hi[3], const RefitPolicy& policy) const {
+    return refits >= policy.maxRefits || boxSurfaceArea(lo, hi) > policy.maxAreaGrowth * boxSurfaceArea(buildLo, buildHi);
+}
+
+const VkBuildAccelerationStructureFlagsKHR DYNAMIC_BLAS_FLAGS = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+
+struct RefitStats {
+    size_t refits = 0;
+    size_t rebuilds = 0;
+    double buildMs = 0.0;
+};
+
+// Refits each dynamic BLAS to its current vertices (bounds lo/hi, 3 floats per
+// entry of dynamicBlases) or rebuilds it in place when policy says so, then
+// calls recordTopLevel(commandBuffer) to record the TLAS over them, all in one
+// submit. Both keep the BLAS addresses, so the TLAS instances stay valid and an
+// update of the TLAS is enough; topLevelScratch is the arena that needs.
+template <typename F>
+RefitStats updateDynamicBlases(Device device, VkCommandPool commandPool, ScratchArena& scratch, const std::vector<std::vector<TriangleGeometry>>& meshes,
+    std::vector<AccelerationStructure>& blases, std::vector<DynamicBlas>& dynamicBlases, const float* lo, const float* hi, const RefitPolicy& policy,
+    VkDeviceSize topLevelScratch, F recordTopLevel) {
+    RefitStats stats;
+    BlasBuildScheduler scheduler = { device };
+    for (size_t i = 0; i < dynamicBlases.size(); i++) {
+        DynamicBlas& dynamic = dynamicBlases[i];
+        if (dynamic.needsRebuild(&lo[3 * i], &hi[3 * i], policy)) {
+            scheduler.add(meshes[dynamic.mesh], DYNAMIC_BLAS_FLAGS, blases[dynamic.mesh]);
+            memcpy(dynamic.buildLo, &lo[3 * i], sizeof(dynamic.buildLo));
+            memcpy(dynamic.buildHi, &hi[3 * i], sizeof(dynamic.buildHi));
+            dynamic.refits = 0;
+            stats.rebuilds++;
+        } else {
+            scheduler.add(meshes[dynamic.mesh], DYNAMIC_BLAS_FLAGS, blases[dynamic.mesh], VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR);
+            dynamic.refits++;
+            stats.refits++;
+        }
+    }
+    scratch.reserve(device, topLevelScratch, topLevelScratch);
+    scheduler.reserve(scratch);
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    scheduler.record(commandBuffer, scratch);
+    recordTopLevel(commandBuffer);
+    auto buildStart = std::chrono::steady_clock::now();
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+    return stats;
+}
+
+// Joins a deferred operation from up to numThreads threads (0 = all cores,
+// capped at what the operation can use) and returns its result
+VkResult joinDeferredOperation(Device device, VkDeferredOperationKHR operation, unsigned numThreads = 0) {
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::max(1u, std::min(numThreads, vkGetDeferredOperationMaxConcurrencyKHR(device.device, operation)));
+    auto join = [&]() {
+        for (;;) {
+            VkResult result = vkDeferredOperationJoinKHR(device.device, operation);
+            if (result != VK_THREAD_IDLE_KHR) return; // VK_SUCCESS or VK_THREAD_DONE_KHR, or an error reported below
+            std::this_thread::yield();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < numThreads; t++) threads.emplace_back(join);
+    join();
+    for (std::thread& thread : threads) thread.join();
+    return vkGetDeferredOperationResultKHR(device.device, operation);
+}
+
+// A serialized AS starts with the driver and compatibility UUIDs, then its
+// serialized size, the size it deserializes into and its handle count
+const VkDeviceSize AS_SERIALIZED_HEADER_SIZE = 2 * VK_UUID_SIZE + 3 * sizeof(uint64_t);
+
+// Size of the AS serialized deserializes into, read from its header
+inline uint64_t deserializedAccelerationStructureSize(const uint8_t* serialized) {
+    uint64_t size;
+    memcpy(&size, serialized + 2 * VK_UUID_SIZE + sizeof(uint64_t), sizeof(size));
+    return size;
+}
+
+// Builds one BLAS per entry of meshes on the host (meshes hold host pointers)
+// with vkBuildAccelerationStructuresKHR, deferred and joined from numThreads
+// threads, so the queue stays free. Host built AS live in host memory; each is
+// serialized there and deserialized into a device-local BLAS, which is what
+// blases holds afterwards. A serialized BLAS the device reports as incompatible
+// is not deserialized and its entry of blases is left empty, for the caller to
+// build on the device. Needs the accelerationStructureHostCommands feature.
+BuildStats buildBottomLevelAccelerationStructuresOnHost(Device device, VkCommandPool commandPool, const std::vector<std::vector<TriangleGeometry>>& meshes,
+    std::vector<AccelerationStructure>& blases, const std::vector<VkBuildAccelerationStructureFlagsKHR>& meshFlags, unsigned numThreads = 0) {
+    BuildStats stats;
+    size_t count = meshes.size();
+    std::vector<std::vector<VkAccelerationStructureGeometryKHR>> geometries(count);
+    std::vector<std::vector<VkAccelerationStructureBuildRangeInfoKHR>> ranges(count);
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> pRanges(count);
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(count);
+    std::vector<AccelerationStructure> hostBlases(count);
+    std::vector<std::vector<uint8_t>> scratch(count);
+    const VkDeviceSize scratchAlignment = 256;
+    for (size_t m = 0; m < count; m++) {
+        std::vector<uint32_t> primitiveCounts;
+        for (const TriangleGeometry& mesh : meshes[m]) {
+            geometries[m].push_back(accelerationStructureGeometry(mesh, true));
+            ranges[m].push_back({ .primitiveCount = mesh.primitiveCount, .primitiveOffset = mesh.primitiveOffset });
+            primitiveCounts.push_back(mesh.primitiveCount);
+            stats.primitiveCount += mesh.primitiveCount;
+        }
+        pRanges[m] = ranges[m].data();
+        buildInfos[m] = {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            .flags = meshFlags[m],
+            .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+            .geometryCount = (uint32_t)geometries[m].size(),
+            .pGeometries = geometries[m].data()
+        };
+        VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+        vkGetAccelerationStructureBuildSizesKHR(device.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR, &buildInfos[m], primitiveCounts.data(), &accelerationStructureBuildSizesInfo);
+        hostBlases[m].create(device, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, accelerationStructureBuildSizesInfo.accelerationStructureSize, true);
+        scratch[m].resize(accelerationStructureBuildSizesInfo.buildScratchSize + scratchAlignment);
+        buildInfos[m].dstAccelerationStructure = hostBlases[m].handle;
+        buildInfos[m].scratchData.hostAddress = (void*)alignedSize((VkDeviceSize)(uintptr_t)scratch[m].data(), scratchAlignment);
+        stats.scratchSize += accelerationStructureBuildSizesInfo.buildScratchSize;
+        stats.accelerationSize += accelerationStructureBuildSizesInfo.accelerationStructureSize;
+    }
+
+    auto buildStart = std::chrono::steady_clock::now();
+    VkDeferredOperationKHR operation;
+    vkCheck(vkCreateDeferredOperationKHR(device.device, nullptr, &operation));
+    VkResult result = vkBuildAccelerationStructuresKHR(device.device, operation, (uint32_t)count, buildInfos.data(), pRanges.data());
+    if (result == VK_OPERATION_DEFERRED_KHR) {
+        result = joinDeferredOperation(device, operation, numThreads);
+    } else if (result == VK_OPERATION_NOT_DEFERRED_KHR) {
+        result = VK_SUCCESS; // built on this thread
+    }
+    vkCheck(result);
+    vkDestroyDeferredOperationKHR(device.device, operation, nullptr);
+    stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+    scratch.clear();
+
+    // serialize every BLAS into one host visible buffer, 256-byte aligned as deserializing requires
+    auto transferStart = std::chrono::steady_clock::now();
+    std::vector<VkAccelerationStructureKHR> handles(count);
+    for (size_t m = 0; m < count; m++) handles[m] = hostBlases[m].handle;
+    std::vector<VkDeviceSize> serializedSizes(count);
+    vkCheck(vkWriteAccelerationStructuresPropertiesKHR(device.device, (uint32_t)count, handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+        count * sizeof(VkDeviceSize), serializedSizes.data(), sizeof(VkDeviceSize)));
+    std::vector<VkDeviceSize> offsets(count);
+    VkDeviceSize stagingSize = 0;
+    for (size_t m = 0; m < count; m++) {
+        offsets[m] = stagingSize;
+        stagingSize = alignedSize(stagingSize + serializedSizes[m], 256);
+    }
+    Buffer staging;
+    createBuffer(device, std::max<VkDeviceSize>(stagingSize, 1), staging, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, false);
+    uint8_t* mapped;
+    vkCheck(vkMapMemory(device.device, staging.memory, 0, VK_WHOLE_SIZE, 0, (void**)&mapped));
+    std::vector<VkDeviceSize> deserializedSizes(count, 0);
+    for (size_t m = 0; m < count; m++) {
+        VkCopyAccelerationStructureToMemoryInfoKHR copyInfo {
+            .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR,
+            .src = hostBlases[m].handle,
+            .dst = { .hostAddress = mapped + offsets[m] },
+            .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR
+        };
+        vkCheck(vkCopyAccelerationStructureToMemoryKHR(device.device, VK_NULL_HANDLE, &copyInfo));
+        VkAccelerationStructureVersionInfoKHR versionInfo {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR,
+            .pVersionData = mapped + offsets[m]
+        };
+        VkAccelerationStructureCompatibilityKHR compatibility;
+        vkGetDeviceAccelerationStructureCompatibilityKHR(device.device, &versionInfo, &compatibility);
+        if (compatibility == VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+            deserializedSizes[m] = deserializedAccelerationStructureSize(mapped + offsets[m]);
+        }
+    }
+    vkUnmapMemory(device.device, staging.memory);
+
+    VkDeviceAddress stagingAddress = getBufferDeviceAddress(device, staging);
+    blases.assign(count, AccelerationStructure());
+    stats.accelerationSize = 0;
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    for (size_t m = 0; m < count; m++) {
+        if (deserializedSizes[m] == 0) continue;
+        blases[m].create(device, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, deserializedSizes[m]);
+        stats.accelerationSize += deserializedSizes[m];
+        VkCopyMemoryToAccelerationStructureInfoKHR copyInfo {
+            .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR,
+            .src = { .deviceAddress = stagingAddress + offsets[m] },
+            .dst = blases[m].handle,
+            .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR
+        };
+        vkCmdCopyMemoryToAccelerationStructureKHR(commandBuffer, &copyInfo);
+    }
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    destroyBuffer(device, staging);
+    for (AccelerationStructure& blas : hostBlases) blas.destroy(device);
+    stats.transferMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - transferStart).count();
+    return stats;
+}
+
+// Sizes of each AS before and after compactAccelerationStructures
+struct CompactionStats {
+    std::vector<VkDeviceSize> buildSizes;
+    std::vector<VkDeviceSize> compactedSizes;
+    VkDeviceSize buildSize = 0;
+    VkDeviceSize compactedSize = 0;
+    double compactMs = 0.0;
+};
+
+// Queries the compacted size of each AS (built with ALLOW_COMPACTION), copies
+// it into a right-sized one in COMPACT mode and frees the original. References
+// to the old addresses, e.g. TLAS instances, have to be rebuilt afterwards.
+CompactionStats compactAccelerationStructures(Device device, VkCommandPool commandPool, std::vector<AccelerationStructure>& accelerationStructures) {
+    CompactionStats stats;
+    if (accelerationStructures.empty()) return stats;
+    auto compactStart = std::chrono::steady_clock::now();
+    uint32_t count = (uint32_t)accelerationStructures.size();
+    std::vector<VkAccelerationStructureKHR> handles(count);
+    for (uint32_t i = 0; i < count; i++) handles[i] = accelerationStructures[i].handle;
+
+    VkQueryPoolCreateInfo queryPoolCI {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+        .queryCount = count
+    };
+    VkQueryPool queryPool;
+    vkCheck(vkCreateQueryPool(device.device, &queryPoolCI, nullptr, &queryPool));
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    vkCmdResetQueryPool(commandBuffer, queryPool, 0, count);
+    accelerationStructureBuildBarrier(commandBuffer);
+    vkCmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, count, handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    stats.compactedSizes.resize(count);
+    vkCheck(vkGetQueryPoolResults(device.device, queryPool, 0, count, count * sizeof(VkDeviceSize), stats.compactedSizes.data(), sizeof(VkDeviceSize),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    vkDestroyQueryPool(device.device, queryPool, nullptr);
+
+    std::vector<AccelerationStructure> compacted(count);
+    commandBuffer = beginSingleTimeCommands(device, commandPool);
+    for (uint32_t i = 0; i < count; i++) {
+        AccelerationStructure& source = accelerationStructures[i];
+        stats.buildSizes.push_back(source.size);
+        stats.buildSize += source.size;
+        stats.compactedSize += stats.compactedSizes[i];
+        compacted[i].create(device, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, stats.compactedSizes[i]);
+        VkCopyAccelerationStructureInfoKHR copyInfo {
+            .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+            .src = source.handle,
+            .dst = compacted[i].handle,
+            .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR
+        };
+        vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+    }
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    for (uint32_t i = 0; i < count; i++) {
+        accelerationStructures[i].destroy(device);
+        accelerationStructures[i] = compacted[i];
+    }
+    stats.compactMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - compactStart).count();
+    return stats;
+}
+
+// Compacts only the entries whose flags include ALLOW_COMPACTION, the rest are left as built
+CompactionStats compactAccelerationStructures(Device device, VkCommandPool commandPool, std::vector<AccelerationStructure>& accelerationStructures,
+    const std::vector<VkBuildAccelerationStructureFlagsKHR>& flags) {
+    std::vector<uint32_t> indices;
+    std::vector<AccelerationStructure> compactable;
+    for (uint32_t i = 0; i < accelerationStructures.size(); i++) {
+        if (!(flags[i] & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR)) continue;
+        indices.push_back(i);
+        compactable.push_back(accelerationStructures[i]);
+    }
+    CompactionStats stats = compactAccelerationStructures(device, commandPool, compactable);
+    for (size_t j = 0; j < indices.size(); j++) accelerationStructures[indices[j]] = compactable[j];
+    return stats;
+}
+
+const size_t MAX_COMPACTION_LINES = 32; // per-BLAS lines printed before summarizing the rest
+
+void printCompactionStats(const CompactionStats& stats) {
+    for (size_t i = 0; i < stats.buildSizes.size() && i < MAX_COMPACTION_LINES; i++) {
+        VkDeviceSize saved = stats.buildSizes[i] - std::min(stats.buildSizes[i], stats.compactedSizes[i]);
+        printf("  BLAS %zu: %llu -> %llu bytes, saved %llu bytes (%.1f%%)\n", i, (unsigned long long)stats.buildSizes[i], (unsigned long long)stats.compactedSizes[i],
+            (unsigned long long)saved, 100.0 * saved / std::max<VkDeviceSize>(stats.buildSizes[i], 1));
+    }
+    if (stats.buildSizes.size() > MAX_COMPACTION_LINES) {
+        printf("  ... and %zu more BLAS\n", stats.buildSizes.size() - MAX_COMPACTION_LINES);
+    }
+    VkDeviceSize saved = stats.buildSize - std::min(stats.buildSize, stats.compactedSize);
+    printf("Compacted %zu BLAS from %.2f MB to %.2f MB in %.2f ms, saved %.2f MB (%.1f%%)\n", stats.buildSizes.size(), stats.buildSize / (1024.0 * 1024.0),
+        stats.compactedSize / (1024.0 * 1024.0), stats.compactMs, saved / (1024.0 * 1024.0), 100.0 * saved / std::max<VkDeviceSize>(stats.buildSize, 1));
+}
+
+// Device memory a BLAS build may hold besides the finished BLASes: the scratch
+// arena, the BLASes of the batch in flight and, while that batch is compacted,
+// their compacted copies. Either limit may be 0 for none.
+struct BuildBudget {
+    VkDeviceSize scratch = 0; // scratch arena size
+    VkDeviceSize peak = 0; // scratch plus the batch's BLASes
+    bool enabled() const { return scratch > 0 || peak > 0; }
+};
+
+// Build sizes of one BLAS over mesh
+VkAccelerationStructureBuildSizesInfoKHR blasBuildSizes(Device device, const std::vector<TriangleGeometry>& mesh, VkBuildAccelerationStructureFlagsKHR flags) {
+    std::vector<VkAccelerationStructureGeometryKHR> geometries;
+    std::vector<uint32_t> primitiveCounts;
+    for (const TriangleGeometry& geometry : mesh) {
+        geometries.push_back(accelerationStructureGeometry(geometry));
+        primitiveCounts.push_back(geometry.primitiveCount);
+    }
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .flags = flags,
+        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+        .geometryCount = (uint32_t)geometries.size(),
+        .pGeometries = geometries.data()
+    };
+    VkAccelerationStructureBuildSizesInfoKHR sizes { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+    vkGetAccelerationStructureBuildSizesKHR(device.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, primitiveCounts.data(), &sizes);
+    return sizes;
+}
+
+// Transient memory of building one BLAS alone, the compacted copy counts when it will be compacted
+inline VkDeviceSize blasBuildFootprint(const VkAccelerationStructureBuildSizesInfoKHR& sizes, VkBuildAccelerationStructureFlagsKHR flags, VkDeviceSize alignment) {
+    VkDeviceSize copies = (flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) ? 2 : 1;
+    return alignedSize(sizes.buildScratchSize, alignment) + copies * sizes.accelerationStructureSize;
+}
+
+// Largest triangle count of geometry whose BLAS builds within budget with any
+// of flags. Build sizes are close to linear in the count, so this is a binary
+// search over size queries; at least 1 even if that doesn't fit.
+uint32_t maxTrianglesWithinBudget(Device device, const TriangleGeometry& geometry, const std::vector<VkBuildAccelerationStructureFlagsKHR>& flags, const BuildBudget& budget) {
+    VkDeviceSize alignment = getAccelerationStructureProperties(device).minAccelerationStructureScratchOffsetAlignment;
+    auto fits = [&](uint32_t count) {
+        TriangleGeometry piece = geometry;
+        piece.primitiveCount = count;
+        for (VkBuildAccelerationStructureFlagsKHR f : flags) {
+            VkAccelerationStructureBuildSizesInfoKHR sizes = blasBuildSizes(device, { piece }, f);
+            if (budget.scratch > 0 && alignedSize(sizes.buildScratchSize, alignment) > budget.scratch) return false;
+            if (budget.peak > 0 && blasBuildFootprint(sizes, f, alignment) > budget.peak) return false;
+        }
+        return true;
+    };
+    if (fits(geometry.primitiveCount)) return geometry.primitiveCount;
+    uint32_t lo = 1, hi = geometry.primitiveCount; // fits(lo) is assumed, fits(hi) is false
+    while (hi - lo > 1) {
+        uint32_t middle = lo + (hi - lo) / 2;
+        if (fits(middle)) lo = middle;
+        else hi = middle;
+    }
+    return lo;
+}
+
+struct BudgetedBuildStats {
+    size_t blases = 0;
+    BuildStats build;
+    CompactionStats compaction;
+    size_t batches = 0;
+    size_t overBudget = 0; // meshes that don't fit the budget even alone
+    VkDeviceSize peakTransient = 0; // largest scratch + batch footprint
+};
+
+// Builds one BLAS per mesh like buildBottomLevelAccelerationStructures, but in
+// batches whose scratch and BLASes fit budget, submitted one after another
+// through the same scratch arena. Each batch is compacted (where its flags
+// allow) as soon as it completes, so only one batch's uncompacted BLASes exist
+// at a time. A mesh that doesn't fit on its own is built alone, over budget and
+// with a warning; split it with maxTrianglesWithinBudget beforehand.
+BudgetedBuildStats buildBottomLevelAccelerationStructuresWithinBudget(Device device, VkCommandPool commandPool, ScratchArena& scratch,
+    const std::vector<std::vector<TriangleGeometry>>& meshes, std::vector<AccelerationStructure>& blases, const std::vector<VkBuildAccelerationStructureFlagsKHR>& meshFlags,
+    const BuildBudget& budget) {
+    BudgetedBuildStats stats;
+    if (scratch.alignment == 0) scratch.alignment = getAccelerationStructureProperties(device).minAccelerationStructureScratchOffsetAlignment;
+    VkDeviceSize scratchLimit = budget.scratch > 0 ? budget.scratch : budget.peak > 0 ? budget.peak / 2 : SCRATCH_ARENA_LIMIT;
+    if (scratch.size > scratchLimit) scratch.destroy(device); // left over from an earlier, larger build
+    VkDeviceSize savedLimit = scratch.limit;
+    scratch.limit = std::min(scratch.limit, scratchLimit);
+
+    std::vector<VkAccelerationStructureBuildSizesInfoKHR> sizes(meshes.size());
+    VkDeviceSize largestScratch = 0;
+    for (size_t m = 0; m < meshes.size(); m++) {
+        sizes[m] = blasBuildSizes(device, meshes[m], meshFlags[m]);
+        VkDeviceSize region = scratch.regionSize(sizes[m].buildScratchSize);
+        VkDeviceSize footprint = blasBuildFootprint(sizes[m], meshFlags[m], scratch.alignment);
+        largestScratch = std::max(largestScratch, region);
+        if ((budget.scratch > 0 && region > budget.scratch) || (budget.peak > 0 && footprint > budget.peak)) {
+            fprintf(stderr, "BLAS %zu needs %.2f MB scratch and %.2f MB transient on its own, over the build budget; building it over budget\n", m,
+                region / (1024.0 * 1024.0), footprint / (1024.0 * 1024.0));
+            stats.overBudget++;
+        }
+    }
+    scratch.reserve(device, largestScratch, scratchLimit);
+
+    stats.blases = meshes.size();
+    blases.resize(meshes.size());
+    size_t first = 0;
+    while (first < meshes.size()) {
+        // grow the batch while its scratch regions fit the arena and its footprint the budget
+        VkDeviceSize scratchUsed = 0, blasBytes = 0;
+        size_t end = first;
+        while (end < meshes.size()) {
+            VkDeviceSize region = scratch.regionSize(sizes[end].buildScratchSize);
+            VkDeviceSize footprint = blasBuildFootprint(sizes[end], meshFlags[end], scratch.alignment) - region;
+            bool fits = scratchUsed + region <= scratch.size && (budget.peak == 0 || scratch.size + blasBytes + footprint <= budget.peak);
+            if (end > first && !fits) break;
+            scratchUsed += region;
+            blasBytes += footprint;
+            end++;
+        }
+        stats.peakTransient = std::max(stats.peakTransient, scratch.size + blasBytes);
+
+        BlasBuildScheduler scheduler = { device };
+        std::vector<AccelerationStructure> batch(end - first);
+        std::vector<VkBuildAccelerationStructureFlagsKHR> batchFlags(meshFlags.begin() + first, meshFlags.begin() + end);
+        for (size_t m = first; m < end; m++) scheduler.add(meshes[m], meshFlags[m], batch[m - first]);
+        scheduler.reserve(scratch);
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+        scheduler.record(commandBuffer, scratch);
+        auto buildStart = std::chrono::steady_clock::now();
+        endSingleTimeCommands(device, commandPool, commandBuffer);
+        stats.build.buildMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+        stats.build.accelerationSize += scheduler.stats.accelerationSize;
+        stats.build.primitiveCount += scheduler.stats.primitiveCount;
+        stats.build.buildCalls += scheduler.stats.buildCalls;
+        stats.build.scratchSize = std::max(stats.build.scratchSize, scheduler.stats.scratchSize);
+
+        CompactionStats compaction = compactAccelerationStructures(device, commandPool, batch, batchFlags);
+        stats.compaction.buildSizes.insert(stats.compaction.buildSizes.end(), compaction.buildSizes.begin(), compaction.buildSizes.end());
+        stats.compaction.compactedSizes.insert(stats.compaction.compactedSizes.end(), compaction.compactedSizes.begin(), compaction.compactedSizes.end());
+        stats.compaction.buildSize += compaction.buildSize;
+        stats.compaction.compactedSize += compaction.compactedSize;
+        stats.compaction.compactMs += compaction.compactMs;
+        for (size_t m = first; m < end; m++) blases[m] = batch[m - first];
+        stats.batches++;
+        first = end;
+    }
+    scratch.limit = savedLimit;
+    return stats;
+}
+
+void printBudgetedBuildStats(const BudgetedBuildStats& stats, const BuildBudget& budget) {
+    printf("Built %zu BLAS with %zu triangles in %zu budgeted batches in %.2f ms (+%.2f ms compacting), %.2f MB after compaction, peak %.2f MB transient",
+        stats.blases, stats.build.primitiveCount, stats.batches, stats.build.buildMs,
+        stats.compaction.compactMs, (stats.build.accelerationSize - stats.compaction.buildSize + stats.compaction.compactedSize) / (1024.0 * 1024.0),
+        stats.peakTransient / (1024.0 * 1024.0));
+    if (budget.peak > 0) printf(" %s a %.2f MB budget", stats.peakTransient > budget.peak ? "OVER" : "of", budget.peak / (1024.0 * 1024.0));
+    printf(" (%.2f MB scratch", stats.build.scratchSize / (1024.0 * 1024.0));
+    if (budget.scratch > 0 && stats.build.scratchSize > budget.scratch) printf(", OVER the %.2f MB scratch budget", budget.scratch / (1024.0 * 1024.0));
+    printf(")\n");
+    if (stats.overBudget > 0) fprintf(stderr, "%zu BLAS didn't fit the build budget on their own and were built over it\n", stats.overBudget);
+}
+
+// Row major 3x4 object to world transform. customIndex and sbtOffset are 24-bit
+// fields, the rest of the instance is shared with every other user of blas.
+VkAccelerationStructureInstanceKHR makeInstance(const AccelerationStructure& blas, const float transform[3][4], uint32_t customIndex, uint8_t mask = 0xFF, uint32_t sbtOffset = 0) {
+    VkAccelerationStructureInstanceKHR instance {
+        .instanceCustomIndex = customIndex & 0xFFFFFF,
+        .mask = mask,
+        .instanceShaderBindingTableRecordOffset = sbtOffset & 0xFFFFFF,
+        .flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
+        .accelerationStructureReference = blas.address
+    };
+    memcpy(instance.transform.matrix, transform, sizeof(instance.transform.matrix));
+    return instance;
+}
+
+const float IDENTITY_TRANSFORM[3][4] = { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } };
@@ -0,0 +1,237 @@
+// ascache.h
+// Devon McKee, 2025
+// On-disk cache of built BLASes. Each entry is one serialized acceleration
+// structure (vkCmdCopyAccelerationStructureToMemoryKHR), named by a key over
+// the mesh's content hash, its build flags and the device's UUID, and checked
+// with vkGetDeviceAccelerationStructureCompatibilityKHR before it is
+// deserialized. Expects utils.h and accel.h to be included first.
+
+#pragma once
+
+#include "scene.h"
+
+const char AS_CACHE_MAGIC[8] = { 'R', 'T', 'A', 'S', 'C', 'A', 'C', 0 };
+const uint32_t AS_CACHE_VERSION = 2;
+const VkDeviceSize AS_SERIALIZED_ALIGNMENT = 256; // of deserialization sources
+
+struct AccelerationStructureCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize; // the serialized AS follows, at this offset
+    uint64_t contentHash;
+    uint64_t buildFlags;
+    uint8_t deviceUUID[VK_UUID_SIZE];
+    uint64_t serializedSize; // the AS to deserialize into is sized by the serialized header
+};
+
+struct AccelerationStructureCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t stored = 0;
+    VkDeviceSize bytesRead = 0;
+    VkDeviceSize bytesWritten = 0;
+    double loadMs = 0.0;
+    double storeMs = 0.0;
+};
+
+// Content hash of a BLAS's inputs: what the geometry bytes hash to (as the
+// caller computed them) together with how they are read
+uint64_t accelerationStructureContentHash(uint64_t bytesHash, const std::vector<TriangleGeometry>& mesh) {
+    uint64_t h = bytesHash;
+    for (const TriangleGeometry& geometry : mesh) {
+        uint64_t layout[] = { (uint64_t)geometry.vertexFormat, geometry.vertexStride, geometry.maxVertex, (uint64_t)geometry.indexType,
+            geometry.transformAddress != 0, geometry.primitiveOffset, geometry.primitiveCount };
+        h = hashBytes(layout, sizeof(layout), h);
+    }
+    return h;
+}
+
+struct AccelerationStructureCache {
+    Device device;
+    VkCommandPool commandPool;
+    std::string directory;
+    uint8_t deviceUUID[VK_UUID_SIZE];
+    AccelerationStructureCacheStats stats;
+    void create(Device device, VkCommandPool commandPool, const char* directory);
+    std::string entryPath(uint64_t contentHash, VkBuildAccelerationStructureFlagsKHR flags) const;
+    void load(const std::vector<uint64_t>& contentHashes, const std::vector<VkBuildAccelerationStructureFlagsKHR>& flags, std::vector<AccelerationStructure>& blases, std::vector<bool>& cached);
+    void store(const std::vector<uint64_t>& contentHashes, const std::vector<VkBuildAccelerationStructureFlagsKHR>& flags, const std::vector<AccelerationStructure>& blases);
+};
+
+void AccelerationStructureCache::create(Device device, VkCommandPool commandPool, const char* directory) {
+    this->device = device;
+    this->commandPool = commandPool;
+    this->directory = directory;
+    VkPhysicalDeviceIDProperties idProperties { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+    VkPhysicalDeviceProperties2 properties { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &idProperties };
+    vkGetPhysicalDeviceProperties2(device.physicalDevice, &properties);
+    memcpy(deviceUUID, idProperties.deviceUUID, sizeof(deviceUUID));
+}
+
+// <directory>/<key>.rtas
+std::string AccelerationStructureCache::entryPath(uint64_t contentHash, VkBuildAccelerationStructureFlagsKHR flags) const {
+    uint64_t key = hashBytes(deviceUUID, sizeof(deviceUUID), hashMix(contentHash ^ hashMix(flags)));
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.rtas", (unsigned long long)key);
+    return (std::filesystem::path(directory) / name).string();
+}
+
+// Deserializes every valid, compatible entry into blases[i] (which must be
+// empty) and sets cached[i]; the rest are left for the caller to build
+void AccelerationStructureCache::load(const std::vector<uint64_t>& contentHashes, const std::vector<VkBuildAccelerationStructureFlagsKHR>& flags, std::vector<AccelerationStructure>& blases, std::vector<bool>& cached) {
+    auto loadStart = std::chrono::steady_clock::now();
+    blases.resize(contentHashes.size());
+    cached.assign(contentHashes.size(), false);
+    std::vector<MappedFile> files(contentHashes.size());
+    std::vector<uint32_t> hits;
+    std::vector<VkDeviceSize> offsets;
+    VkDeviceSize stagingSize = 0;
+    for (uint32_t i = 0; i < contentHashes.size(); i++) {
+        if (!files[i].open(entryPath(contentHashes[i], flags[i]).c_str())) continue;
+        const AccelerationStructureCacheHeader* header = (const AccelerationStructureCacheHeader*)files[i].data;
+        bool valid = files[i].size >= sizeof(AccelerationStructureCacheHeader)
+            && memcmp(header->magic, AS_CACHE_MAGIC, sizeof(header->magic)) == 0
+            && header->version == AS_CACHE_VERSION
+            && header->headerSize >= sizeof(AccelerationStructureCacheHeader)
+            && header->contentHash == contentHashes[i]
+            && header->buildFlags == flags[i]
+            && memcmp(header->deviceUUID, deviceUUID, sizeof(deviceUUID)) == 0
+            && header->serializedSize >= AS_SERIALIZED_HEADER_SIZE
+            && header->headerSize + header->serializedSize == files[i].size;
+        const uint8_t* serialized = valid ? (const uint8_t*)files[i].data + header->headerSize : nullptr;
+        // the deserialized size comes from the blob itself, as for host builds, and can't exceed it
+        uint64_t deserializedSize = valid ? deserializedAccelerationStructureSize(serialized) : 0;
+        valid = valid && deserializedSize > 0 && deserializedSize <= header->serializedSize;
+        if (valid) {
+            // the serialized AS starts with the driver and compatibility UUIDs it was written with
+            VkAccelerationStructureVersionInfoKHR versionInfo {
+                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR,
+                .pVersionData = serialized
+            };
+            VkAccelerationStructureCompatibilityKHR compatibility;
+            vkGetDeviceAccelerationStructureCompatibilityKHR(device.device, &versionInfo, &compatibility);
+            valid = compatibility == VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR;
+        }
+        if (!valid) {
+            files[i].close();
+            continue;
+        }
+        hits.push_back(i);
+        offsets.push_back(stagingSize);
+        stagingSize = alignedSize(stagingSize + header->serializedSize, AS_SERIALIZED_ALIGNMENT);
+    }
+    stats.misses += contentHashes.size() - hits.size();
+    if (hits.empty()) return;
+
+    Buffer staging;
+    createBuffer(device, stagingSize, staging, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, false);
+    uint8_t* mapped;
+    vkCheck(vkMapMemory(device.device, staging.memory, 0, VK_WHOLE_SIZE, 0, (void**)&mapped));
+    for (size_t h = 0; h < hits.size(); h++) {
+        const AccelerationStructureCacheHeader* header = (const AccelerationStructureCacheHeader*)files[hits[h]].data;
+        memcpy(mapped + offsets[h], files[hits[h]].data + header->headerSize, header->serializedSize);
+        stats.bytesRead += header->serializedSize;
+    }
+    vkUnmapMemory(device.device, staging.memory);
+
+    VkDeviceAddress stagingAddress = getBufferDeviceAddress(device, staging);
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    for (size_t h = 0; h < hits.size(); h++) {
+        uint32_t i = hits[h];
+        const AccelerationStructureCacheHeader* header = (const AccelerationStructureCacheHeader*)files[i].data;
+        uint64_t deserializedSize = deserializedAccelerationStructureSize((const uint8_t*)files[i].data + header->headerSize);
+        blases[i].create(device, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, deserializedSize);
+        VkCopyMemoryToAccelerationStructureInfoKHR copyInfo {
+            .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR,
+            .src = { .deviceAddress = stagingAddress + offsets[h] },
+            .dst = blases[i].handle,
+            .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR
+        };
+        vkCmdCopyMemoryToAccelerationStructureKHR(commandBuffer, &copyInfo);
+        cached[i] = true;
+        files[i].close();
+    }
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    destroyBuffer(device, staging);
+    stats.hits += hits.size();
+    stats.loadMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+}
+
+// Serializes blases and writes one entry each, failures only cost the next run a rebuild
+void AccelerationStructureCache::store(const std::vector<uint64_t>& contentHashes, const std::vector<VkBuildAccelerationStructureFlagsKHR>& flags, const std::vector<AccelerationStructure>& blases) {
+    if (blases.empty()) return;
+    auto storeStart = std::chrono::steady_clock::now();
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    uint32_t count = (uint32_t)blases.size();
+    std::vector<VkAccelerationStructureKHR> handles(count);
+    for (uint32_t i = 0; i < count; i++) handles[i] = blases[i].handle;
+
+    VkQueryPoolCreateInfo queryPoolCI {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+        .queryCount = count
+    };
+    VkQueryPool queryPool;
+    vkCheck(vkCreateQueryPool(device.device, &queryPoolCI, nullptr, &queryPool));
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    vkCmdResetQueryPool(commandBuffer, queryPool, 0, count);
+    accelerationStructureBuildBarrier(commandBuffer);
+    vkCmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, count, handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, queryPool, 0);
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    std::vector<VkDeviceSize> serializedSizes(count);
+    vkCheck(vkGetQueryPoolResults(device.device, queryPool, 0, count, count * sizeof(VkDeviceSize), serializedSizes.data(), sizeof(VkDeviceSize),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    vkDestroyQueryPool(device.device, queryPool, nullptr);
+
+    std::vector<VkDeviceSize> offsets(count);
+    VkDeviceSize stagingSize = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        offsets[i] = stagingSize;
+        stagingSize = alignedSize(stagingSize + serializedSizes[i], AS_SERIALIZED_ALIGNMENT);
+    }
+    Buffer staging;
+    createBuffer(device, stagingSize, staging, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, false);
+    VkDeviceAddress stagingAddress = getBufferDeviceAddress(device, staging);
+    commandBuffer = beginSingleTimeCommands(device, commandPool);
+    for (uint32_t i = 0; i < count; i++) {
+        VkCopyAccelerationStructureToMemoryInfoKHR copyInfo {
+            .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR,
+            .src = blases[i].handle,
+            .dst = { .deviceAddress = stagingAddress + offsets[i] },
+            .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR
+        };
+        vkCmdCopyAccelerationStructureToMemoryKHR(commandBuffer, &copyInfo);
+    }
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+
+    const uint8_t* mapped;
+    vkCheck(vkMapMemory(device.device, staging.memory, 0, VK_WHOLE_SIZE, 0, (void**)&mapped));
+    for (uint32_t i = 0; i < count; i++) {
+        AccelerationStructureCacheHeader header {};
+        memcpy(header.magic, AS_CACHE_MAGIC, sizeof(header.magic));
+        header.version = AS_CACHE_VERSION;
+        header.headerSize = sizeof(AccelerationStructureCacheHeader);
+        header.contentHash = contentHashes[i];
+        header.buildFlags = flags[i];
+        memcpy(header.deviceUUID, deviceUUID, sizeof(deviceUUID));
+        header.serializedSize = serializedSizes[i];
+
+        std::string path = entryPath(contentHashes[i], flags[i]);
+        std::string tmpPath = path + ".tmp";
+        FILE* f = fopen(tmpPath.c_str(), "wb");
+        if (!f) continue;
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(mapped + offsets[i], 1, serializedSizes[i], f) == serializedSizes[i];
+        ok &= fclose(f) == 0;
+        if (ok) std::filesystem::rename(tmpPath, path, ec);
+        if (!ok || ec) {
+            std::filesystem::remove(tmpPath, ec);
+            continue;
+        }
+        stats.stored++;
+        stats.bytesWritten += sizeof(header) + serializedSizes[i];
+    }
+    vkUnmapMemory(device.device, staging.memory);
+    destroyBuffer(device, staging);
+    stats.storeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - storeStart).count();
+}
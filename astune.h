@@ -0,0 +1,142 @@
+// astune.h
+// Devon McKee, 2025
+// Per mesh class BLAS build flags, as picked by the --autotune run and
+// persisted for normal runs. Expects utils.h and accel.h to be included first.
+
+#pragma once
+
+#include "scene.h"
+
+// Meshes are classed by triangle count, the trade-offs between trace speed,
+// build time and memory shift with size
+enum MeshClass {
+    MESH_CLASS_SMALL, // < 64K triangles
+    MESH_CLASS_MEDIUM, // < 1M triangles
+    MESH_CLASS_LARGE,
+    MESH_CLASS_COUNT
+};
+
+const char* MESH_CLASS_NAMES[MESH_CLASS_COUNT] = { "small", "medium", "large" };
+const uint32_t MESH_CLASS_LIMITS[MESH_CLASS_COUNT - 1] = { 1 << 16, 1 << 20 };
+
+MeshClass meshClass(const std::vector<TriangleGeometry>& mesh) {
+    size_t triangles = 0;
+    for (const TriangleGeometry& geometry : mesh) triangles += geometry.primitiveCount;
+    int c = 0;
+    while (c < MESH_CLASS_COUNT - 1 && triangles >= MESH_CLASS_LIMITS[c]) c++;
+    return (MeshClass)c;
+}
+
+// The configurations the autotuner tries; ALLOW_COMPACTION means the BLAS is
+// compacted after the build
+const VkBuildAccelerationStructureFlagsKHR BUILD_FLAG_CANDIDATES[] = {
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR,
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR,
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR,
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR
+};
+// Camera origins the trace time is measured from, relative to the center of the
+// scene's -z face in units of its largest extent; gen.rgen looks down +z
+const float TUNE_CAMERA_OFFSETS[][3] = {
+    { 0.0f, 0.0f, -1.0f },
+    { 0.25f, 0.0f, -0.5f },
+    { -0.25f, 0.25f, -0.5f },
+    { 0.0f, -0.25f, -2.0f }
+};
+const uint32_t TUNE_TRACE_REPEATS = 4; // passes over TUNE_CAMERA_OFFSETS per measurement
+const double TUNE_TRACE_TOLERANCE = 0.05; // trace times within this fraction of the best count as a tie
+
+std::string buildFlagsString(VkBuildAccelerationStructureFlagsKHR flags) {
+    std::string s;
+    auto add = [&](VkBuildAccelerationStructureFlagsKHR bit, const char* name) {
+        if (!(flags & bit)) return;
+        if (!s.empty()) s += "+";
+        s += name;
+    };
+    add(VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR, "fast-trace");
+    add(VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR, "fast-build");
+    add(VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR, "low-memory");
+    add(VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR, "compact");
+    add(VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR, "update");
+    return s.empty() ? "none" : s;
+}
+
+// What one candidate cost for the meshes of one class
+struct TuneResult {
+    VkBuildAccelerationStructureFlagsKHR flags;
+    double buildMs;
+    VkDeviceSize memory; // after compaction
+    double traceMs;
+};
+
+// Fastest trace within TUNE_TRACE_TOLERANCE, then least memory, then fastest build
+size_t pickTuneResult(const std::vector<TuneResult>& results) {
+    double bestTrace = results[0].traceMs;
+    for (const TuneResult& result : results) bestTrace = std::min(bestTrace, result.traceMs);
+    size_t best = SIZE_MAX;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].traceMs > bestTrace * (1.0 + TUNE_TRACE_TOLERANCE)) continue;
+        if (best == SIZE_MAX || results[i].memory < results[best].memory
+            || (results[i].memory == results[best].memory && results[i].buildMs < results[best].buildMs)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Build flags per mesh class. Saved as text with the device UUID it was tuned
+// on, a policy from another device is ignored.
+struct BuildPolicy {
+    VkBuildAccelerationStructureFlagsKHR flags[MESH_CLASS_COUNT];
+    bool tuned[MESH_CLASS_COUNT] = {};
+    BuildPolicy(VkBuildAccelerationStructureFlagsKHR defaultFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    bool load(Device device, const char* filename);
+    bool save(Device device, const char* filename) const;
+};
+
+BuildPolicy::BuildPolicy(VkBuildAccelerationStructureFlagsKHR defaultFlags) {
+    for (int c = 0; c < MESH_CLASS_COUNT; c++) flags[c] = defaultFlags;
+}
+
+std::string deviceUUIDString(Device device) {
+    VkPhysicalDeviceIDProperties idProperties { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+    VkPhysicalDeviceProperties2 properties { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &idProperties };
+    vkGetPhysicalDeviceProperties2(device.physicalDevice, &properties);
+    char s[2 * VK_UUID_SIZE + 1];
+    for (int i = 0; i < VK_UUID_SIZE; i++) snprintf(&s[2 * i], 3, "%02x", idProperties.deviceUUID[i]);
+    return s;
+}
+
+// Lines of "device <uuid>" and "<class> <flags>", classes not listed keep their flags
+bool BuildPolicy::load(Device device, const char* filename) {
+    std::ifstream file(filename);
+    if (!file) return false;
+    std::string key, value;
+    bool sameDevice = false;
+    BuildPolicy loaded = *this;
+    while (file >> key >> value) {
+        if (key == "device") {
+            sameDevice = value == deviceUUIDString(device);
+            continue;
+        }
+        for (int c = 0; c < MESH_CLASS_COUNT; c++) {
+            if (key != MESH_CLASS_NAMES[c]) continue;
+            loaded.flags[c] = (VkBuildAccelerationStructureFlagsKHR)strtoul(value.c_str(), nullptr, 0);
+            loaded.tuned[c] = true;
+        }
+    }
+    if (!sameDevice) return false;
+    *this = loaded;
+    return true;
+}
+
+bool BuildPolicy::save(Device device, const char* filename) const {
+    FILE* f = fopen(filename, "w");
+    if (!f) return false;
+    fprintf(f, "device %s\n", deviceUUIDString(device).c_str());
+    for (int c = 0; c < MESH_CLASS_COUNT; c++) {
+        if (tuned[c]) fprintf(f, "%s 0x%x\n", MESH_CLASS_NAMES[c], (unsigned)flags[c]);
+    }
+    return fclose(f) == 0;
+}
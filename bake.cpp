@@ -0,0 +1,57 @@
+// bake.cpp
+// Devon McKee, 2025
+// Offline converter from OBJ to the binary .rtscene format read by rt.
+
+#include <chrono>
+
+#include "scene.h"
+#include "mesh.h"
+
+int main(int argc, char** argv) {
+    const char* objFile = nullptr;
+    const char* outFile = nullptr;
+    bool dedup = true;
+    bool weld = true;
+    bool reorder = false;
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-dedup") == 0) dedup = false;
+        else if (strcmp(argv[i], "--no-weld") == 0) weld = false;
+        else if (strcmp(argv[i], "--reorder") == 0) reorder = true;
+        else if (argv[i][0] == '-') usage = true;
+        else if (!objFile) objFile = argv[i];
+        else if (!outFile) outFile = argv[i];
+        else usage = true;
+    }
+    if (!objFile || usage) {
+        fprintf(stderr, "Usage: bake [--no-dedup] [--no-weld] [--reorder] <file.obj> [file.rtscene]\n");
+        return 1;
+    }
+    std::string cacheFile = outFile ? outFile : sceneCachePath(objFile);
+
+    auto start = std::chrono::steady_clock::now();
+    Scene scene;
+    if (!loadObjParallel(objFile, scene)) return 1;
+    uint64_t processFlags = 0;
+    if (dedup) {
+        printDedupStats(dedupShapes(scene));
+        processFlags |= MESH_PROCESS_DEDUP;
+    } else {
+        scene.shapes.clear();
+    }
+    if (weld) {
+        printWeldStats(weldScene(scene));
+        processFlags |= MESH_PROCESS_WELD;
+    }
+    if (reorder) {
+        printReorderStats(reorderScene(scene));
+        processFlags |= MESH_PROCESS_REORDER;
+    }
+    if (!writeSceneCache(cacheFile.c_str(), scene, objFile, processFlags)) {
+        fprintf(stderr, "Failed to write '%s'!\n", cacheFile.c_str());
+        return 1;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Baked '%s' -> '%s', %zu vertices and %zu triangles in %.2f ms\n", objFile, cacheFile.c_str(), scene.vertices.size() / 3, scene.indices.size() / 3, ms);
+    return 0;
+}
@@ -0,0 +1,462 @@
+// bench.cpp
+// Devon McKee, 2025
+// CPU-side benchmarks for scene loading, no Vulkan device required.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <obj/tiny_obj_loader.h>
+
+#include "scene.h"
+#include "mesh.h"
+#include "gltf.h"
+
+const char* SYNTHETIC_OBJ = "bench_synthetic.obj";
+const char* SYNTHETIC_GLB = "bench_synthetic.glb";
+
+// Writes a grid of quads with positions, normals and texcoords, about 60 bytes per vertex line
+void writeSyntheticObj(const char* filename, uint32_t gridSize) {
+    FILE* f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create '%s'!\n", filename);
+        exit(1);
+    }
+    for (uint32_t y = 0; y < gridSize; y++) {
+        for (uint32_t x = 0; x < gridSize; x++) {
+            float u = (float)x / (gridSize - 1), v = (float)y / (gridSize - 1);
+            fprintf(f, "v %f %f %f\n", u * 2.0f - 1.0f, 0.1f * sinf(u * 20.0f) * cosf(v * 20.0f), v * 2.0f - 1.0f);
+            fprintf(f, "vn %f %f %f\n", 0.0f, 1.0f, 0.0f);
+            fprintf(f, "vt %f %f\n", u, v);
+        }
+    }
+    for (uint32_t y = 0; y + 1 < gridSize; y++) {
+        for (uint32_t x = 0; x + 1 < gridSize; x++) {
+            uint32_t i0 = y * gridSize + x + 1, i1 = i0 + 1, i2 = i1 + gridSize, i3 = i0 + gridSize;
+            fprintf(f, "f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u\n", i0, i0, i0, i1, i1, i1, i2, i2, i2, i3, i3, i3);
+        }
+    }
+    fclose(f);
+}
+
+// Writes one gridSize x gridSize float position grid with 32-bit indices as a .glb,
+// placed by instanceCount nodes
+void writeSyntheticGlb(const char* filename, uint32_t gridSize, uint32_t instanceCount) {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    for (uint32_t y = 0; y < gridSize; y++) {
+        for (uint32_t x = 0; x < gridSize; x++) {
+            float u = (float)x / (gridSize - 1), v = (float)y / (gridSize - 1);
+            positions.insert(positions.end(), { u * 2.0f - 1.0f, 0.1f * sinf(u * 20.0f) * cosf(v * 20.0f), v * 2.0f - 1.0f });
+        }
+    }
+    for (uint32_t y = 0; y + 1 < gridSize; y++) {
+        for (uint32_t x = 0; x + 1 < gridSize; x++) {
+            uint32_t i0 = y * gridSize + x, i1 = i0 + 1, i2 = i1 + gridSize, i3 = i0 + gridSize;
+            indices.insert(indices.end(), { i0, i1, i2, i0, i2, i3 });
+        }
+    }
+    size_t positionBytes = positions.size() * sizeof(float), indexBytes = indices.size() * sizeof(uint32_t);
+    std::string json = "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,\"scenes\":[{\"nodes\":[";
+    for (uint32_t i = 0; i < instanceCount; i++) json += (i > 0 ? "," : "") + std::to_string(i);
+    json += "]}],\"nodes\":[";
+    for (uint32_t i = 0; i < instanceCount; i++) json += std::string(i > 0 ? "," : "") + "{\"mesh\":0,\"translation\":[" + std::to_string(2.5 * i) + ",0,0]}";
+    json += "],\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0},\"indices\":1}]}],";
+    json += "\"buffers\":[{\"byteLength\":" + std::to_string(positionBytes + indexBytes) + "}],";
+    json += "\"bufferViews\":[{\"buffer\":0,\"byteLength\":" + std::to_string(positionBytes) + "},{\"buffer\":0,\"byteOffset\":" + std::to_string(positionBytes)
+        + ",\"byteLength\":" + std::to_string(indexBytes) + "}],";
+    json += "\"accessors\":[{\"bufferView\":0,\"componentType\":5126,\"count\":" + std::to_string(positions.size() / 3) + ",\"type\":\"VEC3\"},"
+        "{\"bufferView\":1,\"componentType\":5125,\"count\":" + std::to_string(indices.size()) + ",\"type\":\"SCALAR\"}]}";
+    while (json.size() % 4 != 0) json += ' ';
+
+    FILE* f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create '%s'!\n", filename);
+        exit(1);
+    }
+    uint32_t header[5] = { GLB_MAGIC, 2, (uint32_t)(28 + json.size() + positionBytes + indexBytes), (uint32_t)json.size(), GLB_CHUNK_JSON };
+    uint32_t binHeader[2] = { (uint32_t)(positionBytes + indexBytes), GLB_CHUNK_BIN };
+    fwrite(header, sizeof(header), 1, f);
+    fwrite(json.data(), 1, json.size(), f);
+    fwrite(binHeader, sizeof(binHeader), 1, f);
+    fwrite(positions.data(), 1, positionBytes, f);
+    fwrite(indices.data(), 1, indexBytes, f);
+    fclose(f);
+}
+
+template <typename F>
+double bestOf(int runs, F f) {
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+// Reads a "Key:   123 kB" line of /proc/self/status (Linux only, 0 elsewhere)
+size_t procStatusBytes(const char* key) {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return 0;
+    char line[256];
+    size_t kb = 0, keyLength = strlen(key);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, key, keyLength) == 0 && line[keyLength] == ':') kb = strtoull(line + keyLength + 1, nullptr, 10);
+    }
+    fclose(f);
+    return kb * 1024;
+}
+
+// Peak RSS of the process while running f, relative to its RSS before. Linux
+// resets the high water mark through /proc/self/clear_refs, elsewhere this is
+// the peak of the whole process.
+template <typename F>
+size_t peakResidentDuring(F f) {
+    FILE* clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs) {
+        fputs("5", clearRefs);
+        fclose(clearRefs);
+    }
+    size_t before = procStatusBytes("VmRSS");
+    f();
+    size_t peak = clearRefs ? procStatusBytes("VmHWM") : peakResidentBytes();
+    return peak > before ? peak - before : 0;
+}
+
+void benchObj(const char* filename, int runs) {
+    Scene reference, parallel;
+    double tinyobjMs = bestOf(runs, [&]() { reference = Scene(); loadObjTinyObj(filename, reference); });
+    double parallelMs = bestOf(runs, [&]() { parallel = Scene(); loadObjParallel(filename, parallel); });
+
+    float maxDiff = 0.0f;
+    bool match = reference.vertices.size() == parallel.vertices.size() && reference.indices == parallel.indices
+        && reference.normalIndices == parallel.normalIndices && reference.texcoordIndices == parallel.texcoordIndices;
+    for (size_t i = 0; match && i < reference.vertices.size(); i++) {
+        maxDiff = std::max(maxDiff, std::fabs(reference.vertices[i] - parallel.vertices[i]));
+    }
+
+    size_t fileSize = 0;
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    if (file.is_open()) fileSize = (size_t)file.tellg();
+    double mb = fileSize / (1024.0 * 1024.0);
+    printf("%s (%.1f MB, %zu vertices, %zu triangles)\n", filename, mb, parallel.vertices.size() / 3, parallel.indices.size() / 3);
+    printf("  tinyobj:  %9.2f ms (%7.1f MB/s)\n", tinyobjMs, mb / (tinyobjMs / 1000.0));
+    printf("  parallel: %9.2f ms (%7.1f MB/s), %.2fx, %u threads\n", parallelMs, mb / (parallelMs / 1000.0), tinyobjMs / parallelMs, std::max(1u, std::thread::hardware_concurrency()));
+    printf("  results %s (max vertex difference %g)\n", match ? "match" : "DIFFER", maxDiff);
+
+    // loads again one at a time so only the scene being loaded is resident
+    reference = Scene();
+    size_t geometryBytes = sceneBytes(parallel);
+    parallel = Scene();
+    size_t tinyobjPeak = peakResidentDuring([&]() { Scene scene; loadObjTinyObj(filename, scene); });
+    size_t parallelPeak = peakResidentDuring([&]() { Scene scene; loadObjParallel(filename, scene); });
+    loadObjParallel(filename, parallel);
+    printf("  peak RSS: tinyobj %.1f MB, parallel %.1f MB for %.1f MB of geometry (%.2fx)\n", tinyobjPeak / (1024.0 * 1024.0),
+        parallelPeak / (1024.0 * 1024.0), geometryBytes / (1024.0 * 1024.0), (double)parallelPeak / std::max<size_t>(geometryBytes, 1));
+
+    std::string cacheFile = sceneCachePath(filename);
+    writeSceneCache(cacheFile.c_str(), parallel, filename);
+    Scene cached;
+    double cacheMs = bestOf(runs, [&]() {
+        cached = Scene();
+        SceneCache cache;
+        if (cache.open(cacheFile.c_str(), filename)) {
+            cache.copyTo(cached);
+            cache.close();
+        }
+    });
+    size_t cacheSize = (size_t)std::filesystem::file_size(cacheFile);
+    double cacheMb = cacheSize / (1024.0 * 1024.0);
+    printf("  cache:    %9.2f ms (%7.1f MB/s of %.1f MB .rtscene), %.2fx, %s\n", cacheMs, cacheMb / (cacheMs / 1000.0), cacheMb, tinyobjMs / cacheMs,
+        cached.vertices == parallel.vertices && cached.indices == parallel.indices ? "matches" : "DIFFERS");
+    // a cached scene no pass has to touch is bounded and uploaded from the mapping,
+    // instead of copied into a Scene, bounded and copied again by encodeGeometry
+    std::vector<ScenePartition> copiedPartitions, mappedPartitions;
+    double copiedMs = bestOf(runs, [&]() {
+        Scene scene;
+        SceneCache cache;
+        if (cache.open(cacheFile.c_str(), filename)) {
+            cache.copyTo(scene);
+            cache.close();
+        }
+        copiedPartitions = partitionScene(scene, 1);
+        encodeGeometry(scene, 0.0, false, false, false);
+    });
+    double mappedMs = bestOf(runs, [&]() {
+        SceneCache cache;
+        if (cache.open(cacheFile.c_str(), filename)) {
+            mappedPartitions = partitionSceneCache(cache);
+            cache.close();
+        }
+    });
+    bool boundsMatch = mappedPartitions.size() == 1 && copiedPartitions.size() == 1
+        && memcmp(&mappedPartitions[0], &copiedPartitions[0], sizeof(ScenePartition)) == 0;
+    printf("  mapped:   %9.2f ms to bound it for upload, %.2f ms copied and encoded, %.2fx, bounds %s\n", mappedMs, copiedMs, copiedMs / mappedMs,
+        boundsMatch ? "match" : "DIFFER");
+    remove(cacheFile.c_str());
+
+    Scene welded = parallel;
+    auto weldStart = std::chrono::steady_clock::now();
+    WeldStats weldStats = weldScene(welded);
+    double weldMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - weldStart).count();
+    printf("  weld:     %9.2f ms, ", weldMs);
+    printWeldStats(weldStats);
+
+    auto reorderStart = std::chrono::steady_clock::now();
+    ReorderStats reorderStats = reorderScene(welded);
+    double reorderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - reorderStart).count();
+    printf("  reorder:  %9.2f ms, ", reorderMs);
+    printReorderStats(reorderStats);
+
+    for (uint32_t numPartitions : { 16u, 256u }) {
+        Scene partitioned = welded;
+        auto partitionStart = std::chrono::steady_clock::now();
+        std::vector<ScenePartition> partitions = partitionScene(partitioned, numPartitions);
+        double partitionMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - partitionStart).count();
+        printf("  partition:%9.2f ms, ", partitionMs);
+        printScenePartitions(partitions);
+    }
+
+    for (double tolerance : { 0.0, 1e-4 }) {
+        auto encodeStart = std::chrono::steady_clock::now();
+        CompactGeometry geometry = encodeGeometry(welded, tolerance, true, true, true);
+        double encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+        printf("  encode:   %9.2f ms, tolerance %g, ", encodeMs, tolerance);
+        printCompactGeometry(geometry);
+    }
+}
+
+// Compares opening a .glb and reading every byte that would be uploaded against
+// reading the whole file, the upload itself is a single copy into staging
+void benchGlb(const char* filename, int runs) {
+    size_t fileSize = (size_t)std::filesystem::file_size(filename);
+    double mb = fileSize / (1024.0 * 1024.0);
+    double readMs = bestOf(runs, [&]() { hashFile(filename); });
+    GlbScene glb;
+    double openMs = bestOf(runs, [&]() {
+        glb = GlbScene();
+        if (!glb.open(filename)) return;
+        for (const GlbUploadRange& range : glb.uploadRanges) hashBytesParallel(glb.bin + range.binOffset, range.size);
+        glb.close();
+    });
+    printf("%s (%.1f MB, %zu meshes, %zu instances, %zu triangles)\n", filename, mb, glb.meshes.size(), glb.instances.size(), glb.triangleCount());
+    printf("  read file:%9.2f ms (%7.1f MB/s)\n", readMs, mb / (readMs / 1000.0));
+    printf("  glb open: %9.2f ms (%7.1f MB/s), %.2f MB to upload\n", openMs, mb / (openMs / 1000.0), glb.uploadSize / (1024.0 * 1024.0));
+}
+
+// Number of triangle bounding boxes and of triangles each ray hits, summed over rays
+// (origin, direction pairs). The boxes a ray hits are the leaves a BVH has to
+// test it against at best, so their count stands in for traversal cost.
+void countRayHits(const Scene& scene, const std::vector<float>& rays, size_t& boxHits, size_t& triangleHits) {
+    size_t numRays = rays.size() / 6, numTriangles = scene.indices.size() / 3;
+    std::vector<size_t> rayBoxHits(numRays, 0), rayTriangleHits(numRays, 0);
+    parallelFor(numRays, [&](size_t r) {
+        const float* o = &rays[6 * r];
+        const float* d = &rays[6 * r + 3];
+        for (size_t t = 0; t < numTriangles; t++) {
+            const float* p[3];
+            for (int c = 0; c < 3; c++) p[c] = &scene.vertices[3 * (size_t)scene.indices[3 * t + c]];
+            float tNear = 0.0f, tFar = INFINITY;
+            for (int k = 0; k < 3; k++) {
+                float lo = std::min({ p[0][k], p[1][k], p[2][k] }), hi = std::max({ p[0][k], p[1][k], p[2][k] });
+                float t0 = (lo - o[k]) / d[k], t1 = (hi - o[k]) / d[k];
+                tNear = std::max(tNear, std::min(t0, t1));
+                tFar = std::min(tFar, std::max(t0, t1));
+            }
+            if (tNear > tFar) continue;
+            rayBoxHits[r]++;
+            // Moller-Trumbore
+            double e1[3], e2[3], s[3];
+            for (int k = 0; k < 3; k++) {
+                e1[k] = (double)p[1][k] - p[0][k];
+                e2[k] = (double)p[2][k] - p[0][k];
+                s[k] = (double)o[k] - p[0][k];
+            }
+            double h[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+            double det = e1[0] * h[0] + e1[1] * h[1] + e1[2] * h[2];
+            if (det == 0.0) continue;
+            double u = (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]) / det;
+            double q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+            double v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+            double distance = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+            if (u >= 0.0 && v >= 0.0 && u + v <= 1.0 && distance >= 0.0) rayTriangleHits[r]++;
+        }
+    });
+    boxHits = triangleHits = 0;
+    for (size_t r = 0; r < numRays; r++) {
+        boxHits += rayBoxHits[r];
+        triangleHits += rayTriangleHits[r];
+    }
+}
+
+// A wall running diagonally through the unit cube, cut into stripCount long
+// strips of two triangles each as architectural exports tend to be, split with
+// a few growth budgets and traced with random rays through the cube
+void benchSplit(uint32_t stripCount, uint32_t rayCount, int runs) {
+    Scene wall;
+    for (uint32_t i = 0; i <= stripCount; i++) {
+        float y = (float)i / stripCount;
+        wall.vertices.insert(wall.vertices.end(), { 0.0f, y, 0.0f, 1.0f, y, 1.0f });
+    }
+    for (uint32_t i = 0; i < stripCount; i++) {
+        uint32_t a = 2 * i, b = a + 1, c = a + 3, d = a + 2;
+        wall.indices.insert(wall.indices.end(), { a, b, c, a, c, d });
+    }
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<float> rays;
+    for (uint32_t r = 0; r < rayCount; r++) {
+        // from the x = 0 face towards a random point on the x = 1 face
+        float y0 = unit(rng), z0 = unit(rng), y1 = unit(rng), z1 = unit(rng);
+        rays.insert(rays.end(), { -0.01f, y0, z0, 1.0f, y1 - y0, z1 - z0 });
+    }
+    size_t boxHitsBefore, triangleHitsBefore;
+    countRayHits(wall, rays, boxHitsBefore, triangleHitsBefore);
+    printf("Pre-split (diagonal wall of %zu triangles, %u rays)\n", wall.indices.size() / 3, rayCount);
+    for (double growth : { 0.25, 1.0, 4.0 }) {
+        Scene split;
+        SplitStats stats;
+        double splitMs = bestOf(runs, [&]() {
+            split = wall;
+            stats = splitTriangles(split, growth);
+        });
+        size_t boxHits, triangleHits;
+        countRayHits(split, rays, boxHits, triangleHits);
+        printf("  split:    %9.2f ms, growth %g, ", splitMs, growth);
+        printSplitStats(stats);
+        printf("            %.1f -> %.1f triangle boxes hit per ray (%.2fx fewer), %zu -> %zu triangle hits\n", (double)boxHitsBefore / rayCount,
+            (double)boxHits / rayCount, (double)boxHitsBefore / std::max<size_t>(boxHits, 1), triangleHitsBefore, triangleHits);
+    }
+}
+
+// OBJ text with lineCount lines cycling through v, vn, vt and f as exporters write them
+std::string syntheticObjLines(size_t lineCount) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f), unit(-1.0f, 1.0f), texcoord(0.0f, 1.0f);
+    std::string text;
+    char line[128];
+    for (size_t i = 0; i < lineCount; i++) {
+        uint32_t k = (uint32_t)(i / 4) + 1;
+        switch (i % 4) {
+            case 0: snprintf(line, sizeof(line), "v %f %f %f\n", position(rng), position(rng), position(rng)); break;
+            case 1: snprintf(line, sizeof(line), "vn %f %f %f\n", unit(rng), unit(rng), unit(rng)); break;
+            case 2: snprintf(line, sizeof(line), "vt %f %f\n", texcoord(rng), texcoord(rng)); break;
+            default: snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\n", k, k, k, k, k, k, k, k, k); break;
+        }
+        text += line;
+    }
+    return text;
+}
+
+// Parses every float on the v/vn/vt lines of [begin, end) with either objParseFloat or plain from_chars
+void parseObjLineFloats(const char* begin, const char* end, bool fast, std::vector<float>& values) {
+    values.clear();
+    for (const char* p = begin; p < end;) {
+        const char* lineEnd = objFindNewline(p, end);
+        if (p[0] == 'v') {
+            const char* q = p + (p[1] == ' ' ? 2 : 3);
+            while (true) {
+                q = objSkipSpace(q, lineEnd);
+                if (q >= lineEnd) break;
+                float value;
+                const char* next = fast ? objParseFloat(q, lineEnd, value) : objParseFloatFromChars(q, lineEnd, value);
+                if (!next) break;
+                values.push_back(value);
+                q = next;
+            }
+        }
+        p = lineEnd + 1;
+    }
+}
+
+// Value throughput of the OBJ number parsing and tokenizing kernels, and a check
+// that objParseFloat gives the same bits as from_chars on exporter-style and
+// adversarial literals
+void benchObjNumbers(size_t lineCount, int runs) {
+    std::string text = syntheticObjLines(lineCount);
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    std::vector<float> reference, fast;
+    double referenceMs = bestOf(runs, [&]() { parseObjLineFloats(begin, end, false, reference); });
+    double fastMs = bestOf(runs, [&]() { parseObjLineFloats(begin, end, true, fast); });
+    bool identical = reference.size() == fast.size() && memcmp(reference.data(), fast.data(), reference.size() * sizeof(float)) == 0;
+
+    const char* tokenizerFile = "bench_tokenizer.obj";
+    FILE* f = fopen(tokenizerFile, "wb");
+    if (f) {
+        fwrite(text.data(), 1, text.size(), f);
+        fclose(f);
+    }
+    Scene tokenized;
+    double chunkMs = bestOf(runs, [&]() {
+        tokenized = Scene();
+        loadObjParallel(tokenizerFile, tokenized, 1);
+    });
+    remove(tokenizerFile);
+    // every corner of the synthetic triangles carries v/vt/vn
+    size_t chunkValues = tokenized.vertices.size() + tokenized.normals.size() + tokenized.texcoords.size() + 3 * tokenized.indices.size();
+
+    size_t memchrLines = 0, scanLines = 0;
+    double memchrMs = bestOf(runs, [&]() {
+        memchrLines = 0;
+        for (const char* p = begin; (p = (const char*)memchr(p, '\n', end - p)); p++) memchrLines++;
+    });
+    double scanMs = bestOf(runs, [&]() {
+        scanLines = 0;
+        for (const char* p = objFindNewline(begin, end); p < end; p = objFindNewline(p + 1, end)) scanLines++;
+    });
+
+    // exactness sweep over formats that take both the fast path and the fallback
+    std::mt19937 rng(2);
+    std::uniform_int_distribution<uint32_t> bits;
+    const char* formats[] = { "%f", "%.3f", "%.9g", "%g", "%e", "%.12f", "%.1f" };
+    size_t sweepCount = 0, sweepDiffer = 0;
+    char literal[64];
+    for (int i = 0; i < 1000000; i++) {
+        uint32_t b = bits(rng);
+        float x;
+        memcpy(&x, &b, sizeof(x));
+        if (!std::isfinite(x)) continue;
+        if (i % 2) x = std::ldexp((float)(b % 2000000) - 1000000.0f, -(int)(b % 24)); // short decimals
+        int n = snprintf(literal, sizeof(literal), formats[i % 7], x);
+        float a = 0.0f, c = 0.0f;
+        const char* aEnd = objParseFloatFromChars(literal, literal + n, a);
+        const char* cEnd = objParseFloat(literal, literal + n, c);
+        sweepCount++;
+        if (aEnd != cEnd || memcmp(&a, &c, sizeof(float)) != 0) sweepDiffer++;
+    }
+
+    double mb = text.size() / (1024.0 * 1024.0);
+    printf("OBJ numbers (%zu v/vn/vt/f lines, %.1f MB)\n", lineCount, mb);
+    printf("  from_chars:%8.2f ms (%7.1f Mvalues/s)\n", referenceMs, reference.size() / (referenceMs * 1000.0));
+    printf("  fast float:%8.2f ms (%7.1f Mvalues/s), %.2fx, %s\n", fastMs, fast.size() / (fastMs * 1000.0), referenceMs / fastMs, identical ? "bit-identical" : "DIFFERS");
+    printf("  tokenizer: %8.2f ms (%7.1f Mvalues/s, %7.1f MB/s), one thread\n", chunkMs, chunkValues / (chunkMs * 1000.0), mb / (chunkMs / 1000.0));
+    printf("  newlines:  %8.2f ms memchr (%zu lines), %.2f ms objFindNewline (%zu lines)\n", memchrMs, memchrLines, scanMs, scanLines);
+    printf("  exactness: %zu of %zu literals differ from from_chars\n", sweepDiffer, sweepCount);
+}
+
+int main(int argc, char** argv) {
+    uint32_t gridSize = argc > 1 ? (uint32_t)atoi(argv[1]) : 1024;
+    int runs = 3;
+
+    benchObjNumbers(4000000, runs);
+
+    benchSplit(4096, 4096, runs);
+
+    benchObj("teapot.obj", runs);
+
+    writeSyntheticObj(SYNTHETIC_OBJ, gridSize);
+    benchObj(SYNTHETIC_OBJ, runs);
+    remove(SYNTHETIC_OBJ);
+
+    writeSyntheticGlb(SYNTHETIC_GLB, gridSize, 64);
+    benchGlb(SYNTHETIC_GLB, runs);
+    remove(SYNTHETIC_GLB);
+    return 0;
+}
@@ -0,0 +1,182 @@
+// chunks.h
+// Devon McKee, 2025
+// Out-of-core geometry chunks (.rtchunks). Every scene partition is stored as a
+// self-contained block of local float32 positions followed by its indices, so
+// a chunk can be paged onto the device straight from the mapped file without
+// the rest of the scene ever being loaded.
+
+#pragma once
+
+#include "mesh.h"
+
+const char CHUNK_FILE_MAGIC[8] = { 'R', 'T', 'C', 'H', 'U', 'N', 'K', 0 };
+const uint32_t CHUNK_FILE_VERSION = 1;
+const size_t CHUNK_FILE_ALIGNMENT = 256;
+const uint32_t CHUNK_TARGET_TRIANGLES = 1 << 20; // default chunk size when paging
+
+struct ChunkRecord {
+    float lo[3];
+    float hi[3];
+    uint64_t offset; // bytes from the start of the file, positions first
+    uint64_t indexOffset; // bytes from offset
+    uint64_t size; // positions and indices
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    uint32_t indexSize; // 2 or 4
+    uint32_t padding;
+};
+
+struct ChunkFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    uint64_t fileSize;
+    uint64_t processFlags; // see mesh.h
+    uint32_t requestedChunks; // the partition count asked for, 0 = automatic
+    uint32_t chunkCount;
+};
+
+// foo/bar.obj -> foo/bar.rtchunks
+std::string chunkFilePath(const char* filename) {
+    return std::filesystem::path(filename).replace_extension(".rtchunks").string();
+}
+
+// Local copy of one partition: vertices renumbered in order of first use
+void encodeChunk(const Scene& scene, const ScenePartition& partition, ChunkRecord& record, std::vector<uint8_t>& data) {
+    std::vector<uint32_t> local;
+    std::vector<uint32_t> vertexOrder;
+    local.reserve(3 * (size_t)partition.triangleCount);
+    // open-addressing map from scene vertex ids to local ones
+    size_t size = 16;
+    while (size < 6 * (size_t)partition.triangleCount) size *= 2;
+    std::vector<uint32_t> slotKeys(size, NO_INDEX), slotValues(size);
+    for (size_t i = 3 * (size_t)partition.firstTriangle; i < 3 * ((size_t)partition.firstTriangle + partition.triangleCount); i++) {
+        uint32_t v = scene.indices[i];
+        size_t s = (size_t)hashMix(v) & (size - 1);
+        while (slotKeys[s] != NO_INDEX && slotKeys[s] != v) s = (s + 1) & (size - 1);
+        if (slotKeys[s] == NO_INDEX) {
+            slotKeys[s] = v;
+            slotValues[s] = (uint32_t)vertexOrder.size();
+            vertexOrder.push_back(v);
+        }
+        local.push_back(slotValues[s]);
+    }
+
+    memcpy(record.lo, partition.lo, sizeof(record.lo));
+    memcpy(record.hi, partition.hi, sizeof(record.hi));
+    record.vertexCount = (uint32_t)vertexOrder.size();
+    record.triangleCount = partition.triangleCount;
+    record.indexSize = record.vertexCount <= 65536 ? 2 : 4;
+    record.indexOffset = (12 * (uint64_t)record.vertexCount + 3) & ~(uint64_t)3;
+    record.size = record.indexOffset + local.size() * record.indexSize;
+    data.assign(record.size, 0);
+    for (size_t v = 0; v < vertexOrder.size(); v++) {
+        memcpy(&data[12 * v], &scene.vertices[3 * (size_t)vertexOrder[v]], 12);
+    }
+    for (size_t i = 0; i < local.size(); i++) {
+        if (record.indexSize == 2) {
+            uint16_t index = (uint16_t)local[i];
+            memcpy(&data[record.indexOffset + 2 * i], &index, 2);
+        } else {
+            memcpy(&data[record.indexOffset + 4 * i], &local[i], 4);
+        }
+    }
+}
+
+// Writes one chunk per partition, recording sourceFile's identity for validation
+bool writeChunkFile(const char* chunkFile, const Scene& scene, const std::vector<ScenePartition>& partitions, const char* sourceFile, uint64_t processFlags, uint32_t requestedChunks, unsigned numThreads = 0) {
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    ChunkFileHeader header {};
+    memcpy(header.magic, CHUNK_FILE_MAGIC, sizeof(header.magic));
+    header.version = CHUNK_FILE_VERSION;
+    header.headerSize = sizeof(ChunkFileHeader);
+    header.processFlags = processFlags;
+    header.requestedChunks = requestedChunks;
+    header.chunkCount = (uint32_t)partitions.size();
+    SceneSourceInfo info;
+    if (!getSceneSourceInfo(sourceFile, info)) return false;
+    header.sourceSize = info.size;
+    header.sourceMtime = info.mtime;
+    header.sourceHash = hashFile(sourceFile);
+
+    std::string tmpFile = std::string(chunkFile) + ".tmp";
+    FILE* f = fopen(tmpFile.c_str(), "wb");
+    if (!f) return false;
+    std::vector<ChunkRecord> records(partitions.size());
+    uint64_t offset = sizeof(ChunkFileHeader) + records.size() * sizeof(ChunkRecord);
+    bool ok = fseek(f, (long)offset, SEEK_SET) == 0;
+    const char padding[CHUNK_FILE_ALIGNMENT] = {};
+
+    // encode a batch of chunks in parallel, then append them in order
+    std::vector<std::vector<uint8_t>> batch(numThreads);
+    for (size_t first = 0; ok && first < partitions.size(); first += numThreads) {
+        size_t count = std::min<size_t>(numThreads, partitions.size() - first);
+        parallelFor(count, [&](size_t i) {
+            encodeChunk(scene, partitions[first + i], records[first + i], batch[i]);
+        }, numThreads);
+        for (size_t i = 0; ok && i < count; i++) {
+            uint64_t aligned = (offset + CHUNK_FILE_ALIGNMENT - 1) & ~(uint64_t)(CHUNK_FILE_ALIGNMENT - 1);
+            ok &= fwrite(padding, 1, aligned - offset, f) == aligned - offset;
+            records[first + i].offset = aligned;
+            ok &= fwrite(batch[i].data(), 1, batch[i].size(), f) == batch[i].size();
+            offset = aligned + batch[i].size();
+        }
+    }
+    header.fileSize = offset;
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    if (ok && !records.empty()) ok = fwrite(records.data(), sizeof(ChunkRecord), records.size(), f) == records.size();
+    ok &= fclose(f) == 0;
+    std::error_code ec;
+    if (ok) std::filesystem::rename(tmpFile, chunkFile, ec);
+    if (!ok || ec) {
+        std::filesystem::remove(tmpFile, ec);
+        return false;
+    }
+    return true;
+}
+
+// Mapped, validated .rtchunks file; data() points straight into the mapping
+struct ChunkFile {
+    MappedFile file;
+    const ChunkFileHeader* header = nullptr;
+    const ChunkRecord* records = nullptr;
+    bool open(const char* chunkFile, const char* sourceFile, uint64_t processFlags, uint32_t requestedChunks);
+    void close();
+    size_t count() const { return header->chunkCount; }
+    const uint8_t* data(size_t c) const { return (const uint8_t*)file.data + records[c].offset; }
+};
+
+bool ChunkFile::open(const char* chunkFile, const char* sourceFile, uint64_t processFlags, uint32_t requestedChunks) {
+    if (!file.open(chunkFile)) return false;
+    header = (const ChunkFileHeader*)file.data;
+    records = (const ChunkRecord*)(file.data + sizeof(ChunkFileHeader));
+    bool valid = file.size >= sizeof(ChunkFileHeader)
+        && memcmp(header->magic, CHUNK_FILE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == CHUNK_FILE_VERSION
+        && header->headerSize == sizeof(ChunkFileHeader)
+        && header->fileSize == file.size
+        && sizeof(ChunkFileHeader) + (uint64_t)header->chunkCount * sizeof(ChunkRecord) <= file.size
+        && header->processFlags == processFlags
+        && header->requestedChunks == requestedChunks;
+    for (size_t c = 0; valid && c < header->chunkCount; c++) {
+        valid = records[c].offset % CHUNK_FILE_ALIGNMENT == 0 && records[c].offset + records[c].size <= file.size;
+    }
+    if (valid) {
+        SceneSourceInfo info;
+        valid = getSceneSourceInfo(sourceFile, info) && info.size == header->sourceSize;
+        if (valid && info.mtime != header->sourceMtime) {
+            valid = hashFile(sourceFile) == header->sourceHash;
+        }
+    }
+    if (!valid) close();
+    return valid;
+}
+
+void ChunkFile::close() {
+    file.close();
+    header = nullptr;
+    records = nullptr;
+}
@@ -0,0 +1,436 @@
+// gltf.h
+// Devon McKee, 2025
+// Binary glTF 2.0 (.glb) reader. The file is memory mapped and accessors are
+// resolved to byte ranges of the BIN chunk, which are uploaded as they are;
+// no vertex or index data is copied into Scene arrays.
+
+#pragma once
+
+#include <cmath>
+#include <cfloat>
+
+#include "scene.h"
+
+// Minimal JSON tree, enough for the glTF header
+struct JsonValue {
+    enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+    Type type = JSON_NULL;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+    const JsonValue& operator[](const char* key) const;
+    const JsonValue& operator[](size_t i) const;
+    size_t size() const { return items.size(); }
+    bool has(const char* key) const { return (*this)[key].type != JSON_NULL; }
+    double asNumber(double fallback = 0.0) const { return type == JSON_NUMBER ? number : fallback; }
+    uint32_t asIndex(uint32_t fallback = NO_INDEX) const { return type == JSON_NUMBER ? (uint32_t)number : fallback; }
+};
+
+const JsonValue& JsonValue::operator[](const char* key) const {
+    static const JsonValue missing;
+    for (const auto& member : members) {
+        if (member.first == key) return member.second;
+    }
+    return missing;
+}
+
+const JsonValue& JsonValue::operator[](size_t i) const {
+    static const JsonValue missing;
+    return i < items.size() ? items[i] : missing;
+}
+
+struct JsonParser {
+    const char* p;
+    const char* end;
+    int depth = 0;
+    bool parse(JsonValue& value);
+    bool parseString(std::string& out);
+    void skipWhitespace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    }
+    bool consume(const char* literal) {
+        size_t n = strlen(literal);
+        if ((size_t)(end - p) < n || memcmp(p, literal, n) != 0) return false;
+        p += n;
+        return true;
+    }
+};
+
+bool JsonParser::parseString(std::string& out) {
+    if (p >= end || *p != '"') return false;
+    p++;
+    while (p < end && *p != '"') {
+        if (*p != '\\') {
+            out += *p++;
+            continue;
+        }
+        if (++p >= end) return false;
+        char c = *p++;
+        switch (c) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                // code point as UTF-8, surrogate pairs are not recombined
+                unsigned codePoint = 0;
+                if (end - p < 4 || std::from_chars(p, p + 4, codePoint, 16).ptr != p + 4) return false;
+                p += 4;
+                if (codePoint < 0x80) {
+                    out += (char)codePoint;
+                } else if (codePoint < 0x800) {
+                    out += (char)(0xC0 | codePoint >> 6);
+                    out += (char)(0x80 | (codePoint & 0x3F));
+                } else {
+                    out += (char)(0xE0 | codePoint >> 12);
+                    out += (char)(0x80 | (codePoint >> 6 & 0x3F));
+                    out += (char)(0x80 | (codePoint & 0x3F));
+                }
+                break;
+            }
+            default: out += c; break;
+        }
+    }
+    if (p >= end) return false;
+    p++;
+    return true;
+}
+
+bool JsonParser::parse(JsonValue& value) {
+    skipWhitespace();
+    if (p >= end || ++depth > 64) return false;
+    bool ok = true;
+    if (*p == '{') {
+        value.type = JsonValue::JSON_OBJECT;
+        p++;
+        skipWhitespace();
+        if (p < end && *p == '}') {
+            p++;
+        } else {
+            while (ok) {
+                skipWhitespace();
+                value.members.emplace_back();
+                ok = parseString(value.members.back().first);
+                skipWhitespace();
+                ok = ok && consume(":") && parse(value.members.back().second);
+                skipWhitespace();
+                if (!ok || consume("}")) break;
+                ok = consume(",");
+            }
+        }
+    } else if (*p == '[') {
+        value.type = JsonValue::JSON_ARRAY;
+        p++;
+        skipWhitespace();
+        if (p < end && *p == ']') {
+            p++;
+        } else {
+            while (ok) {
+                value.items.emplace_back();
+                ok = parse(value.items.back());
+                skipWhitespace();
+                if (!ok || consume("]")) break;
+                ok = consume(",");
+            }
+        }
+    } else if (*p == '"') {
+        value.type = JsonValue::JSON_STRING;
+        ok = parseString(value.string);
+    } else if (consume("true")) {
+        value.type = JsonValue::JSON_BOOL;
+        value.number = 1.0;
+    } else if (consume("false")) {
+        value.type = JsonValue::JSON_BOOL;
+    } else if (consume("null")) {
+        value.type = JsonValue::JSON_NULL;
+    } else {
+        value.type = JsonValue::JSON_NUMBER;
+        if (*p == '+') return false;
+        auto result = std::from_chars(p, end, value.number);
+        ok = result.ec == std::errc();
+        p = result.ptr;
+    }
+    depth--;
+    return ok;
+}
+
+const uint32_t GLB_MAGIC = 0x46546C67; // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+const uint32_t GLB_CHUNK_BIN = 0x004E4942;
+const size_t GLB_UPLOAD_ALIGNMENT = 16;
+
+enum GltfComponentType {
+    GLTF_UNSIGNED_BYTE = 5121,
+    GLTF_UNSIGNED_SHORT = 5123,
+    GLTF_UNSIGNED_INT = 5125,
+    GLTF_FLOAT = 5126
+};
+
+// A contiguous range of the BIN chunk that is uploaded as is, to uploadOffset
+// in the device buffer
+struct GlbUploadRange {
+    size_t binOffset;
+    size_t size;
+    size_t uploadOffset;
+};
+
+// Accessor resolved to the device buffer: element i starts at offset + i * stride
+struct GlbAccessor {
+    size_t offset = 0;
+    size_t stride = 0;
+    uint32_t count = 0;
+    uint32_t componentType = 0;
+};
+
+struct GlbPrimitive {
+    GlbAccessor positions; // float xyz
+    GlbAccessor indices; // 16 or 32-bit, count 0 for non-indexed primitives
+};
+
+struct GlbMesh {
+    std::vector<GlbPrimitive> primitives;
+    float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }; // from the POSITION accessors' min and max
+    float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+};
+
+// Loads the mesh and node structure of a .glb. The device buffer holds the used
+// buffer views back to back (uploadRanges, read straight out of the mapping)
+// followed by widenedIndices, 8-bit index accessors widened to 16 bits since
+// acceleration structure builds cannot read 8-bit indices.
+struct GlbScene {
+    MappedFile file;
+    const uint8_t* bin = nullptr;
+    size_t binSize = 0;
+    std::vector<GlbUploadRange> uploadRanges;
+    std::vector<uint16_t> widenedIndices;
+    size_t widenedOffset = 0;
+    size_t uploadSize = 0;
+    std::vector<GlbMesh> meshes;
+    std::vector<MeshInstance> instances; // one per node with a mesh
+    bool open(const char* filename);
+    void close();
+    size_t triangleCount() const;
+    bool bounds(float lo[3], float hi[3]) const;
+    bool resolveAccessor(const JsonValue& json, uint32_t index, GlbAccessor& accessor, std::vector<size_t>& viewOffsets);
+    void addInstances(const JsonValue& json, uint32_t node, const double* parent, int depth);
+};
+
+inline bool isGlbFile(const char* filename) {
+    return std::filesystem::path(filename).extension() == ".glb";
+}
+
+// Column major 4x4 matrix of a node, from either matrix or translation/rotation/scale
+void gltfNodeMatrix(const JsonValue& node, double* m) {
+    if (node.has("matrix")) {
+        for (int i = 0; i < 16; i++) m[i] = node["matrix"][i].asNumber(i % 5 == 0 ? 1.0 : 0.0);
+        return;
+    }
+    double t[3], r[4], s[3];
+    for (int i = 0; i < 3; i++) t[i] = node["translation"][i].asNumber(0.0);
+    for (int i = 0; i < 4; i++) r[i] = node["rotation"][i].asNumber(i == 3 ? 1.0 : 0.0);
+    for (int i = 0; i < 3; i++) s[i] = node["scale"][i].asNumber(1.0);
+    double x = r[0], y = r[1], z = r[2], w = r[3];
+    double rotation[9] = { // column major
+        1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+        2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+        2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)
+    };
+    for (int c = 0; c < 3; c++) {
+        for (int row = 0; row < 3; row++) m[4 * c + row] = rotation[3 * c + row] * s[c];
+        m[4 * c + 3] = 0.0;
+    }
+    for (int row = 0; row < 3; row++) m[12 + row] = t[row];
+    m[15] = 1.0;
+}
+
+bool GlbScene::resolveAccessor(const JsonValue& json, uint32_t index, GlbAccessor& accessor, std::vector<size_t>& viewOffsets) {
+    const JsonValue& source = json["accessors"][index];
+    uint32_t viewIndex = source["bufferView"].asIndex();
+    const JsonValue& view = json["bufferViews"][viewIndex];
+    if (source.type != JsonValue::JSON_OBJECT || view.type != JsonValue::JSON_OBJECT || source.has("sparse") || view["buffer"].asIndex() != 0) {
+        return false;
+    }
+    accessor.componentType = source["componentType"].asIndex(0);
+    accessor.count = source["count"].asIndex(0);
+    size_t componentSize = accessor.componentType == GLTF_UNSIGNED_BYTE ? 1 : accessor.componentType == GLTF_UNSIGNED_SHORT ? 2 : 4;
+    size_t components = source["type"].string == "VEC3" ? 3 : 1;
+    accessor.stride = (size_t)view["byteStride"].asNumber((double)(componentSize * components));
+    size_t viewOffset = (size_t)view["byteOffset"].asNumber(0.0), viewLength = (size_t)view["byteLength"].asNumber(0.0);
+    size_t accessorOffset = (size_t)source["byteOffset"].asNumber(0.0);
+    if (viewOffset + viewLength > binSize || (accessor.count > 0 && accessorOffset + (accessor.count - 1) * accessor.stride + componentSize * components > viewLength)) {
+        return false;
+    }
+    if (accessor.componentType == GLTF_UNSIGNED_BYTE) {
+        accessor.offset = viewOffset + accessorOffset; // into the BIN chunk, widened by the caller
+        return true;
+    }
+    if (viewOffsets[viewIndex] == SIZE_MAX) {
+        // keep the view's offset modulo the alignment so accessor alignment carries over
+        viewOffsets[viewIndex] = uploadSize + viewOffset % GLB_UPLOAD_ALIGNMENT;
+        uploadRanges.push_back({ viewOffset, viewLength, viewOffsets[viewIndex] });
+        uploadSize = (viewOffsets[viewIndex] + viewLength + GLB_UPLOAD_ALIGNMENT - 1) & ~(GLB_UPLOAD_ALIGNMENT - 1);
+    }
+    accessor.offset = viewOffsets[viewIndex] + accessorOffset;
+    return true;
+}
+
+void GlbScene::addInstances(const JsonValue& json, uint32_t node, const double* parent, int depth) {
+    const JsonValue& source = json["nodes"][node];
+    if (source.type != JsonValue::JSON_OBJECT || depth > 64) return;
+    double local[16], world[16];
+    gltfNodeMatrix(source, local);
+    for (int c = 0; c < 4; c++) {
+        for (int row = 0; row < 4; row++) {
+            double sum = 0.0;
+            for (int k = 0; k < 4; k++) sum += parent[4 * k + row] * local[4 * c + k];
+            world[4 * c + row] = sum;
+        }
+    }
+    uint32_t mesh = source["mesh"].asIndex();
+    if (mesh < meshes.size() && !meshes[mesh].primitives.empty()) {
+        MeshInstance instance = { mesh };
+        for (int row = 0; row < 3; row++) {
+            for (int c = 0; c < 4; c++) instance.transform[row][c] = (float)world[4 * c + row];
+        }
+        instances.push_back(instance);
+    }
+    const JsonValue& children = source["children"];
+    for (size_t i = 0; i < children.size(); i++) {
+        addInstances(json, children[i].asIndex(), world, depth + 1);
+    }
+}
+
+bool GlbScene::open(const char* filename) {
+    if (!file.open(filename)) return false;
+    const uint8_t* data = (const uint8_t*)file.data;
+    uint32_t header[5];
+    if (file.size < sizeof(header)) return false;
+    memcpy(header, data, sizeof(header));
+    if (header[0] != GLB_MAGIC || header[1] != 2 || header[2] > file.size || header[4] != GLB_CHUNK_JSON || 20 + (size_t)header[3] > header[2]) {
+        fprintf(stderr, "'%s' is not a glTF 2.0 binary file\n", filename);
+        return false;
+    }
+    JsonValue json;
+    JsonParser parser = { (const char*)data + 20, (const char*)data + 20 + header[3] };
+    if (!parser.parse(json) || json.type != JsonValue::JSON_OBJECT) {
+        fprintf(stderr, "Failed to parse the JSON chunk of '%s'\n", filename);
+        return false;
+    }
+    size_t binChunk = 20 + (((size_t)header[3] + 3) & ~(size_t)3);
+    if (binChunk + 8 <= header[2]) {
+        uint32_t chunk[2];
+        memcpy(chunk, data + binChunk, sizeof(chunk));
+        if (chunk[1] == GLB_CHUNK_BIN && binChunk + 8 + chunk[0] <= header[2]) {
+            bin = data + binChunk + 8;
+            binSize = chunk[0];
+        }
+    }
+
+    std::vector<size_t> viewOffsets(json["bufferViews"].size(), SIZE_MAX);
+    const JsonValue& sourceMeshes = json["meshes"];
+    meshes.resize(sourceMeshes.size());
+    size_t skipped = 0;
+    for (size_t m = 0; m < meshes.size(); m++) {
+        const JsonValue& sourcePrimitives = sourceMeshes[m]["primitives"];
+        for (size_t p = 0; p < sourcePrimitives.size(); p++) {
+            const JsonValue& source = sourcePrimitives[p];
+            GlbPrimitive primitive;
+            bool ok = source["mode"].asIndex(4) == 4 // triangles
+                && resolveAccessor(json, source["attributes"]["POSITION"].asIndex(), primitive.positions, viewOffsets)
+                && primitive.positions.componentType == GLTF_FLOAT;
+            if (ok && source.has("indices")) {
+                ok = resolveAccessor(json, source["indices"].asIndex(), primitive.indices, viewOffsets)
+                    && primitive.indices.componentType != GLTF_FLOAT && primitive.indices.count % 3 == 0;
+                if (ok && primitive.indices.componentType == GLTF_UNSIGNED_BYTE) {
+                    size_t first = widenedIndices.size();
+                    for (uint32_t i = 0; i < primitive.indices.count; i++) {
+                        widenedIndices.push_back(bin[primitive.indices.offset + i * primitive.indices.stride]);
+                    }
+                    primitive.indices.offset = 2 * first; // relative to widenedOffset until the layout is final
+                    primitive.indices.stride = 2;
+                }
+            } else if (ok && primitive.positions.count % 3 != 0) {
+                ok = false;
+            }
+            if (ok) {
+                const JsonValue& position = json["accessors"][source["attributes"]["POSITION"].asIndex()];
+                for (int k = 0; k < 3; k++) {
+                    meshes[m].lo[k] = std::min(meshes[m].lo[k], (float)position["min"][k].asNumber(0.0));
+                    meshes[m].hi[k] = std::max(meshes[m].hi[k], (float)position["max"][k].asNumber(0.0));
+                }
+                meshes[m].primitives.push_back(primitive);
+            } else {
+                skipped++;
+            }
+        }
+    }
+    widenedOffset = uploadSize;
+    uploadSize += widenedIndices.size() * sizeof(uint16_t);
+    for (GlbMesh& mesh : meshes) {
+        for (GlbPrimitive& primitive : mesh.primitives) {
+            if (primitive.indices.componentType == GLTF_UNSIGNED_BYTE) {
+                primitive.indices.offset += widenedOffset;
+                primitive.indices.componentType = GLTF_UNSIGNED_SHORT;
+            }
+        }
+    }
+    if (skipped > 0) {
+        fprintf(stderr, "Skipped %zu primitives of '%s' that are not float triangle lists in the BIN chunk\n", skipped, filename);
+    }
+
+    double identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+    const JsonValue& scenes = json["scenes"];
+    if (scenes.size() > 0) {
+        const JsonValue& roots = scenes[json["scene"].asIndex(0)]["nodes"];
+        for (size_t i = 0; i < roots.size(); i++) {
+            addInstances(json, roots[i].asIndex(), identity, 0);
+        }
+    } else {
+        // no scene, every mesh once at the origin
+        for (uint32_t m = 0; m < meshes.size(); m++) {
+            if (meshes[m].primitives.empty()) continue;
+            MeshInstance instance = { m, { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } } };
+            instances.push_back(instance);
+        }
+    }
+    return true;
+}
+
+void GlbScene::close() {
+    file.close();
+    bin = nullptr;
+    binSize = 0;
+}
+
+// World space bounds of all instances, false when there are none
+bool GlbScene::bounds(float lo[3], float hi[3]) const {
+    for (int k = 0; k < 3; k++) {
+        lo[k] = FLT_MAX;
+        hi[k] = -FLT_MAX;
+    }
+    for (const MeshInstance& instance : instances) {
+        const GlbMesh& mesh = meshes[instance.mesh];
+        for (int corner = 0; corner < 8; corner++) {
+            float p[3] = { corner & 1 ? mesh.hi[0] : mesh.lo[0], corner & 2 ? mesh.hi[1] : mesh.lo[1], corner & 4 ? mesh.hi[2] : mesh.lo[2] };
+            for (int row = 0; row < 3; row++) {
+                const float* t = instance.transform[row];
+                float world = t[0] * p[0] + t[1] * p[1] + t[2] * p[2] + t[3];
+                lo[row] = std::min(lo[row], world);
+                hi[row] = std::max(hi[row], world);
+            }
+        }
+    }
+    return !instances.empty();
+}
+
+size_t GlbScene::triangleCount() const {
+    size_t count = 0;
+    for (const MeshInstance& instance : instances) {
+        for (const GlbPrimitive& primitive : meshes[instance.mesh].primitives) {
+            count += (primitive.indices.count > 0 ? primitive.indices.count : primitive.positions.count) / 3;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,1447 @@
+// mesh.h
+// Devon McKee, 2025
+// Mesh processing passes run on a loaded Scene before it is uploaded.
+
+#pragma once
+
+#include <cmath>
+#include <unordered_map>
+
+#include "scene.h"
+
+// Passes applied to a scene, stored in the .rtscene header so a cache built
+// with different passes is not reused
+enum MeshProcessBits {
+    MESH_PROCESS_WELD = 1,
+    MESH_PROCESS_REORDER = 2,
+    MESH_PROCESS_DEDUP = 4
+};
+
+// Splits [0, n) into at most one contiguous block per thread and runs
+// f(begin, end, block) for each, returns the number of blocks
+template <typename F>
+size_t parallelForBlocks(size_t n, F f, unsigned numThreads = 0) {
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t numBlocks = std::max<size_t>(1, std::min<size_t>(numThreads, n / 4096));
+    parallelFor(numBlocks, [&](size_t b) {
+        f(n * b / numBlocks, n * (b + 1) / numBlocks, b);
+    }, numThreads);
+    return numBlocks;
+}
+
+// Stable counting sort of the items [0, n) into numBuckets buckets. Afterwards the
+// items of bucket k are order[bucketOffsets[k]..bucketOffsets[k + 1]) in increasing order.
+template <typename F>
+void partitionIndices(size_t n, size_t numBuckets, F bucketOf, std::vector<uint32_t>& order, std::vector<size_t>& bucketOffsets, unsigned numThreads = 0) {
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t numBlocks = std::max<size_t>(1, std::min<size_t>(numThreads, n / 4096));
+    std::vector<size_t> counts(numBlocks * numBuckets, 0);
+    parallelFor(numBlocks, [&](size_t b) {
+        for (size_t i = n * b / numBlocks; i < n * (b + 1) / numBlocks; i++) counts[b * numBuckets + bucketOf(i)]++;
+    }, numThreads);
+    bucketOffsets.assign(numBuckets + 1, 0);
+    size_t offset = 0;
+    for (size_t k = 0; k < numBuckets; k++) {
+        bucketOffsets[k] = offset;
+        for (size_t b = 0; b < numBlocks; b++) {
+            size_t count = counts[b * numBuckets + k];
+            counts[b * numBuckets + k] = offset;
+            offset += count;
+        }
+    }
+    bucketOffsets[numBuckets] = offset;
+    order.resize(n);
+    parallelFor(numBlocks, [&](size_t b) {
+        size_t* cursors = &counts[b * numBuckets];
+        for (size_t i = n * b / numBlocks; i < n * (b + 1) / numBlocks; i++) order[cursors[bucketOf(i)]++] = (uint32_t)i;
+    }, numThreads);
+}
+
+// Sorts data with one std::sort per thread followed by rounds of pairwise merges
+template <typename T, typename Less>
+void parallelSort(std::vector<T>& data, Less less, unsigned numThreads = 0) {
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t n = data.size();
+    size_t numBlocks = std::max<size_t>(1, std::min<size_t>(numThreads, n / 4096));
+    std::vector<size_t> bounds(numBlocks + 1);
+    for (size_t b = 0; b <= numBlocks; b++) bounds[b] = n * b / numBlocks;
+    parallelFor(numBlocks, [&](size_t b) {
+        std::sort(data.begin() + bounds[b], data.begin() + bounds[b + 1], less);
+    }, numThreads);
+    for (size_t width = 1; width < numBlocks; width *= 2) {
+        size_t numMerges = (numBlocks + 2 * width - 1) / (2 * width);
+        parallelFor(numMerges, [&](size_t m) {
+            size_t first = 2 * width * m;
+            size_t middle = std::min(first + width, numBlocks);
+            size_t last = std::min(first + 2 * width, numBlocks);
+            if (middle < last) {
+                std::inplace_merge(data.begin() + bounds[first], data.begin() + bounds[middle], data.begin() + bounds[last], less);
+            }
+        }, numThreads);
+    }
+}
+
+// Number of hash shards for the parallel dedup passes, a power of two
+inline uint32_t hashShardBits(unsigned numThreads) {
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t bits = 0;
+    while ((1u << bits) < numThreads * 4) bits++;
+    return bits;
+}
+
+inline size_t hashShard(uint64_t hash, uint32_t bits) {
+    return bits == 0 ? 0 : (size_t)(hash >> (64 - bits));
+}
+
+// Open-addressing set over item ids of one shard. find() returns the first
+// inserted item equal to i, or inserts i and returns it.
+struct HashShardTable {
+    std::vector<uint32_t> slots;
+    size_t mask;
+    void init(size_t count) {
+        size_t size = 16;
+        while (size < count * 2) size *= 2;
+        slots.assign(size, NO_INDEX);
+        mask = size - 1;
+    }
+    template <typename Eq>
+    uint32_t find(uint32_t i, uint64_t hash, const std::vector<uint64_t>& hashes, Eq equal) {
+        for (size_t s = (size_t)hash & mask;; s = (s + 1) & mask) {
+            uint32_t other = slots[s];
+            if (other == NO_INDEX) {
+                slots[s] = i;
+                return i;
+            }
+            if (hashes[other] == hash && equal(other, i)) return other;
+        }
+    }
+};
+
+// Shape deduplication
+// OBJ files often repeat one object many times (bolts, chairs, leaves), each
+// copy stored again in world space. Every shape gets a rigid frame: its centroid
+// and two axes through the first of its vertices far enough from the centroid
+// and from the first axis. Shapes with the same topology (the same triangles
+// over the same vertex order) whose vertices agree in their own frames, up to
+// DEDUP_TOLERANCE of their radius, are copies. Normals, texcoords and colors have
+// to agree as well. The first shape of each set of copies becomes a mesh and
+// every copy an instance of it; shapes without copies are merged into one mesh
+// placed at identity. Copies stored with another vertex order or mirrored are
+// not found and just stay in the scene. Meant to run right after loading, while
+// scene.shapes still holds the OBJ objects and groups.
+
+struct DedupStats {
+    size_t shapes = 0;
+    size_t duplicateShapes = 0;
+    size_t meshes = 0;
+    size_t instances = 0;
+    size_t trianglesBefore = 0;
+    size_t trianglesAfter = 0;
+    size_t verticesBefore = 0;
+    size_t verticesAfter = 0;
+    size_t bytesBefore = 0;
+    size_t bytesAfter = 0;
+};
+
+const float DEDUP_TOLERANCE = 1e-4f;
+
+// A shape's triangles over its own vertices, numbered in order of first use,
+// and its rigid frame. axes are the columns of the rotation to world space.
+struct ShapeFrame {
+    std::vector<uint32_t> vertices; // scene vertex of each local vertex
+    std::vector<uint32_t> topology; // local vertex of each corner
+    uint64_t topologyHash = 0;
+    bool rigid = false; // false when the vertices don't span a plane
+    float center[3] = {};
+    float radius = 0.0f;
+    float axes[3][3] = {};
+};
+
+ShapeFrame shapeFrame(const Scene& scene, size_t firstTriangle, size_t endTriangle) {
+    ShapeFrame frame;
+    std::unordered_map<uint32_t, uint32_t> local;
+    frame.topology.reserve(3 * (endTriangle - firstTriangle));
+    for (size_t c = 3 * firstTriangle; c < 3 * endTriangle; c++) {
+        auto [it, inserted] = local.try_emplace(scene.indices[c], (uint32_t)frame.vertices.size());
+        if (inserted) frame.vertices.push_back(scene.indices[c]);
+        frame.topology.push_back(it->second);
+    }
+    frame.topologyHash = hashBytes(frame.topology.data(), frame.topology.size() * sizeof(uint32_t), frame.vertices.size());
+
+    double sum[3] = {};
+    for (uint32_t v : frame.vertices) {
+        for (int k = 0; k < 3; k++) sum[k] += scene.vertices[3 * (size_t)v + k];
+    }
+    for (int k = 0; k < 3; k++) frame.center[k] = (float)(sum[k] / frame.vertices.size());
+    auto offset = [&](uint32_t v, float* d) {
+        for (int k = 0; k < 3; k++) d[k] = scene.vertices[3 * (size_t)v + k] - frame.center[k];
+    };
+    for (uint32_t v : frame.vertices) {
+        float d[3];
+        offset(v, d);
+        frame.radius = std::max(frame.radius, std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+    }
+    if (frame.radius == 0.0f) return frame;
+
+    float* u = frame.axes[0];
+    float* v = frame.axes[1];
+    float* w = frame.axes[2];
+    bool haveU = false, haveV = false;
+    for (uint32_t p : frame.vertices) {
+        float d[3];
+        offset(p, d);
+        if (!haveU) {
+            float length = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+            if (length < 0.5f * frame.radius) continue;
+            for (int k = 0; k < 3; k++) u[k] = d[k] / length;
+            haveU = true;
+        } else {
+            float along = d[0] * u[0] + d[1] * u[1] + d[2] * u[2];
+            for (int k = 0; k < 3; k++) d[k] -= along * u[k];
+            float length = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+            if (length <= 0.25f * frame.radius) continue;
+            for (int k = 0; k < 3; k++) v[k] = d[k] / length;
+            haveV = true;
+            break;
+        }
+    }
+    if (!haveV) return frame;
+    w[0] = u[1] * v[2] - u[2] * v[1];
+    w[1] = u[2] * v[0] - u[0] * v[2];
+    w[2] = u[0] * v[1] - u[1] * v[0];
+    frame.rigid = true;
+    return frame;
+}
+
+// Direction d in the frame's own coordinates
+inline void toFrame(const ShapeFrame& frame, const float* d, float* q) {
+    for (int a = 0; a < 3; a++) q[a] = frame.axes[a][0] * d[0] + frame.axes[a][1] * d[1] + frame.axes[a][2] * d[2];
+}
+
+DedupStats dedupShapes(Scene& scene, unsigned numThreads = 0) {
+    DedupStats stats;
+    size_t numTriangles = scene.indices.size() / 3;
+    stats.shapes = scene.shapes.size();
+    stats.trianglesBefore = stats.trianglesAfter = numTriangles;
+    stats.verticesBefore = stats.verticesAfter = scene.vertices.size() / 3;
+    stats.bytesBefore = stats.bytesAfter = sceneBytes(scene);
+    size_t numShapes = scene.shapes.size();
+    if (numShapes < 2) {
+        scene.shapes.clear();
+        return stats;
+    }
+    auto shapeEnd = [&](size_t s) { return s + 1 < numShapes ? (size_t)scene.shapes[s + 1] : numTriangles; };
+
+    std::vector<ShapeFrame> frames(numShapes);
+    parallelFor(numShapes, [&](size_t s) { frames[s] = shapeFrame(scene, scene.shapes[s], shapeEnd(s)); }, numThreads);
+
+    // per-corner attributes, nullptr where a corner has none
+    size_t numCorners = scene.indices.size();
+    bool cornerNormals = scene.normalIndices.size() == numCorners && !scene.normals.empty();
+    bool cornerTexcoords = scene.texcoordIndices.size() == numCorners && !scene.texcoords.empty();
+    bool vertexNormals = !cornerNormals && !scene.normals.empty() && scene.normals.size() == scene.vertices.size();
+    bool vertexTexcoords = !cornerTexcoords && !scene.texcoords.empty() && scene.texcoords.size() / 2 == scene.vertices.size() / 3;
+    bool hasColors = !scene.colors.empty() && scene.colors.size() == scene.vertices.size();
+    auto normalOf = [&](size_t c) -> const float* {
+        uint32_t n = cornerNormals ? scene.normalIndices[c] : vertexNormals ? scene.indices[c] : NO_INDEX;
+        return n == NO_INDEX ? nullptr : &scene.normals[3 * (size_t)n];
+    };
+    auto texcoordOf = [&](size_t c) -> const float* {
+        uint32_t t = cornerTexcoords ? scene.texcoordIndices[c] : vertexTexcoords ? scene.indices[c] : NO_INDEX;
+        return t == NO_INDEX ? nullptr : &scene.texcoords[2 * (size_t)t];
+    };
+
+    auto sameShape = [&](size_t a, size_t b) {
+        const ShapeFrame& fa = frames[a];
+        const ShapeFrame& fb = frames[b];
+        if (!fa.rigid || !fb.rigid || fa.topologyHash != fb.topologyHash || fa.vertices.size() != fb.vertices.size() || fa.topology != fb.topology) return false;
+        float tolerance = DEDUP_TOLERANCE * std::max(fa.radius, fb.radius);
+        if (std::fabs(fa.radius - fb.radius) > tolerance) return false;
+        auto close = [](const float* x, const float* y, int n, float limit) {
+            for (int k = 0; k < n; k++) {
+                if (std::fabs(x[k] - y[k]) > limit) return false;
+            }
+            return true;
+        };
+        for (size_t i = 0; i < fa.vertices.size(); i++) {
+            const float* pa = &scene.vertices[3 * (size_t)fa.vertices[i]];
+            const float* pb = &scene.vertices[3 * (size_t)fb.vertices[i]];
+            float da[3], db[3], qa[3], qb[3];
+            for (int k = 0; k < 3; k++) {
+                da[k] = pa[k] - fa.center[k];
+                db[k] = pb[k] - fb.center[k];
+            }
+            toFrame(fa, da, qa);
+            toFrame(fb, db, qb);
+            if (!close(qa, qb, 3, tolerance)) return false;
+            if (hasColors && !close(&scene.colors[3 * (size_t)fa.vertices[i]], &scene.colors[3 * (size_t)fb.vertices[i]], 3, DEDUP_TOLERANCE)) return false;
+        }
+        size_t ca = 3 * (size_t)scene.shapes[a], cb = 3 * (size_t)scene.shapes[b];
+        for (size_t i = 0; i < fa.topology.size(); i++) {
+            const float* na = normalOf(ca + i);
+            const float* nb = normalOf(cb + i);
+            if ((na == nullptr) != (nb == nullptr)) return false;
+            if (na) {
+                float qa[3], qb[3];
+                toFrame(fa, na, qa);
+                toFrame(fb, nb, qb);
+                if (!close(qa, qb, 3, 1e-3f)) return false;
+            }
+            const float* ta = texcoordOf(ca + i);
+            const float* tb = texcoordOf(cb + i);
+            if ((ta == nullptr) != (tb == nullptr)) return false;
+            if (ta && !close(ta, tb, 2, DEDUP_TOLERANCE)) return false;
+        }
+        return true;
+    };
+
+    // group shapes by topology hash, then match each group greedily against its representatives
+    std::vector<uint32_t> order(numShapes);
+    for (size_t s = 0; s < numShapes; s++) order[s] = (uint32_t)s;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return frames[a].topologyHash < frames[b].topologyHash || (frames[a].topologyHash == frames[b].topologyHash && a < b);
+    });
+    std::vector<size_t> groupStarts;
+    for (size_t i = 0; i < numShapes; i++) {
+        if (i == 0 || frames[order[i]].topologyHash != frames[order[i - 1]].topologyHash) groupStarts.push_back(i);
+    }
+    groupStarts.push_back(numShapes);
+    std::vector<uint32_t> repOf(numShapes);
+    parallelFor(groupStarts.size() - 1, [&](size_t g) {
+        std::vector<uint32_t> reps;
+        for (size_t i = groupStarts[g]; i < groupStarts[g + 1]; i++) {
+            uint32_t s = order[i];
+            repOf[s] = s;
+            for (uint32_t rep : reps) {
+                if (sameShape(rep, s)) {
+                    repOf[s] = rep;
+                    break;
+                }
+            }
+            if (repOf[s] == s) reps.push_back(s);
+        }
+    }, numThreads);
+
+    std::vector<uint32_t> copies(numShapes, 0);
+    for (size_t s = 0; s < numShapes; s++) copies[repOf[s]]++;
+    for (size_t s = 0; s < numShapes; s++) {
+        if (repOf[s] != s) stats.duplicateShapes++;
+    }
+    if (stats.duplicateShapes == 0) {
+        scene.shapes.clear();
+        return stats;
+    }
+
+    // mesh 0 gathers the shapes without copies, then one mesh per set of copies
+    std::vector<uint32_t> meshOf(numShapes, NO_INDEX);
+    std::vector<uint32_t> meshShapes; // first shape of each mesh's triangles, all of them for mesh 0
+    bool hasSingles = false;
+    for (size_t s = 0; s < numShapes; s++) {
+        if (copies[s] == 1 && repOf[s] == s) hasSingles = true;
+    }
+    uint32_t numMeshes = hasSingles ? 1 : 0;
+    for (size_t s = 0; s < numShapes; s++) {
+        if (copies[s] > 1) meshOf[s] = numMeshes++;
+    }
+
+    std::vector<uint32_t> triangleOrder, shapes;
+    triangleOrder.reserve(numTriangles);
+    if (hasSingles) {
+        shapes.push_back(0);
+        for (size_t s = 0; s < numShapes; s++) {
+            if (copies[s] != 1 || repOf[s] != s) continue;
+            for (size_t t = scene.shapes[s]; t < shapeEnd(s); t++) triangleOrder.push_back((uint32_t)t);
+        }
+    }
+    for (size_t s = 0; s < numShapes; s++) {
+        if (copies[s] <= 1) continue;
+        shapes.push_back((uint32_t)triangleOrder.size());
+        for (size_t t = scene.shapes[s]; t < shapeEnd(s); t++) triangleOrder.push_back((uint32_t)t);
+    }
+
+    // instances: identity for mesh 0 and representatives, R_s R_rep^T about the centroids for copies
+    std::vector<uint32_t> instanceShapes;
+    std::vector<float> instanceTransforms;
+    if (hasSingles) {
+        const float identity[12] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+        instanceShapes.push_back(0);
+        instanceTransforms.insert(instanceTransforms.end(), identity, identity + 12);
+    }
+    for (size_t s = 0; s < numShapes; s++) {
+        uint32_t rep = repOf[s];
+        if (copies[rep] <= 1) continue;
+        const ShapeFrame& fs = frames[s];
+        const ShapeFrame& fr = frames[rep];
+        float transform[3][4];
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 3; col++) {
+                transform[row][col] = s == rep ? (row == col ? 1.0f : 0.0f)
+                    : fs.axes[0][row] * fr.axes[0][col] + fs.axes[1][row] * fr.axes[1][col] + fs.axes[2][row] * fr.axes[2][col];
+            }
+            transform[row][3] = s == rep ? 0.0f
+                : fs.center[row] - (transform[row][0] * fr.center[0] + transform[row][1] * fr.center[1] + transform[row][2] * fr.center[2]);
+        }
+        instanceShapes.push_back(meshOf[rep]);
+        instanceTransforms.insert(instanceTransforms.end(), &transform[0][0], &transform[0][0] + 12);
+    }
+    frames = std::vector<ShapeFrame>();
+
+    // gather the kept triangles and renumber every stream's elements in order of first use
+    auto compact = [&](std::vector<uint32_t>& stream, std::vector<float>& data, int width) {
+        if (stream.size() != numCorners) return;
+        std::vector<uint32_t> kept(3 * triangleOrder.size()), remap(data.size() / width, NO_INDEX);
+        std::vector<float> compacted;
+        compacted.reserve(data.size());
+        for (size_t t = 0; t < triangleOrder.size(); t++) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t id = stream[3 * (size_t)triangleOrder[t] + k];
+                if (id != NO_INDEX && remap[id] == NO_INDEX) {
+                    remap[id] = (uint32_t)(compacted.size() / width);
+                    compacted.insert(compacted.end(), &data[(size_t)width * id], &data[(size_t)width * id] + width);
+                }
+                kept[3 * t + k] = id == NO_INDEX ? NO_INDEX : remap[id];
+            }
+        }
+        stream.swap(kept);
+        data.swap(compacted);
+    };
+    if (cornerNormals) compact(scene.normalIndices, scene.normals, 3);
+    if (cornerTexcoords) compact(scene.texcoordIndices, scene.texcoords, 2);
+    std::vector<uint32_t> vertexOrder;
+    {
+        std::vector<uint32_t> kept(3 * triangleOrder.size()), remap(scene.vertices.size() / 3, NO_INDEX);
+        for (size_t t = 0; t < triangleOrder.size(); t++) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = scene.indices[3 * (size_t)triangleOrder[t] + k];
+                if (remap[v] == NO_INDEX) {
+                    remap[v] = (uint32_t)vertexOrder.size();
+                    vertexOrder.push_back(v);
+                }
+                kept[3 * t + k] = remap[v];
+            }
+        }
+        scene.indices.swap(kept);
+    }
+    auto gatherVertices = [&](std::vector<float>& data, int width) {
+        std::vector<float> gathered((size_t)width * vertexOrder.size());
+        for (size_t v = 0; v < vertexOrder.size(); v++) memcpy(&gathered[(size_t)width * v], &data[(size_t)width * vertexOrder[v]], width * sizeof(float));
+        data.swap(gathered);
+    };
+    gatherVertices(scene.vertices, 3);
+    if (hasColors) gatherVertices(scene.colors, 3);
+    if (vertexNormals) gatherVertices(scene.normals, 3);
+    if (vertexTexcoords) gatherVertices(scene.texcoords, 2);
+    if (scene.triangleIds.size() == numTriangles) {
+        std::vector<uint32_t> kept(triangleOrder.size());
+        for (size_t t = 0; t < triangleOrder.size(); t++) kept[t] = scene.triangleIds[triangleOrder[t]];
+        scene.triangleIds.swap(kept);
+    }
+    scene.shapes = std::move(shapes);
+    scene.instanceShapes = std::move(instanceShapes);
+    scene.instanceTransforms = std::move(instanceTransforms);
+
+    stats.meshes = numMeshes;
+    stats.instances = scene.instanceShapes.size();
+    stats.trianglesAfter = scene.indices.size() / 3;
+    stats.verticesAfter = scene.vertices.size() / 3;
+    stats.bytesAfter = sceneBytes(scene);
+    return stats;
+}
+
+void printDedupStats(const DedupStats& stats) {
+    long long bytesRemoved = (long long)stats.bytesBefore - (long long)stats.bytesAfter;
+    printf("Deduplicated %zu of %zu shapes into %zu instances of %zu meshes, %zu -> %zu triangles and %zu -> %zu vertices, removed %lld of %zu bytes\n",
+        stats.duplicateShapes, stats.shapes, stats.instances, stats.meshes, stats.trianglesBefore, stats.trianglesAfter, stats.verticesBefore, stats.verticesAfter,
+        bytesRemoved, stats.bytesBefore);
+}
+
+// Vertex welding
+// Every triangle corner is turned into a key of its position, normal, texcoord
+// and color bits. Keys are hashed and sharded by their top hash bits so each shard
+// is deduplicated on its own thread. Triangles whose corners collapse onto one
+// another or that have zero area are dropped, as are exact duplicates (same
+// vertices and winding, within one shape). Finally vertices are renumbered in order of first use,
+// which drops unreferenced ones, and every attribute array becomes per-vertex.
+// Shapes keep their triangles, minus the dropped ones.
+
+struct WeldStats {
+    size_t verticesBefore = 0;
+    size_t verticesAfter = 0;
+    size_t trianglesBefore = 0;
+    size_t trianglesAfter = 0;
+    size_t degenerateTriangles = 0;
+    size_t duplicateTriangles = 0;
+    size_t bytesBefore = 0; // vertex and index buffer bytes, see sceneUploadBytes
+    size_t bytesAfter = 0;
+};
+
+const int WELD_KEY_SIZE = 11; // position, normal, texcoord, color
+
+WeldStats weldScene(Scene& scene, unsigned numThreads = 0) {
+    WeldStats stats;
+    stats.verticesBefore = scene.vertices.size() / 3;
+    stats.trianglesBefore = scene.indices.size() / 3;
+    stats.bytesBefore = sceneUploadBytes(scene);
+
+    size_t numCorners = scene.indices.size();
+    bool hasNormals = !scene.normals.empty() && scene.normalIndices.size() == numCorners;
+    bool hasTexcoords = !scene.texcoords.empty() && scene.texcoordIndices.size() == numCorners;
+    bool hasColors = scene.colors.size() == scene.vertices.size();
+
+    auto cornerKey = [&](size_t c, uint32_t* key) {
+        const uint32_t missing = 0xffffffffu; // a NaN pattern the parser never produces
+        uint32_t v = scene.indices[c];
+        memcpy(key, &scene.vertices[3 * v], 3 * sizeof(float));
+        uint32_t n = hasNormals ? scene.normalIndices[c] : NO_INDEX;
+        if (n != NO_INDEX) memcpy(key + 3, &scene.normals[3 * n], 3 * sizeof(float));
+        else key[3] = key[4] = key[5] = missing;
+        uint32_t t = hasTexcoords ? scene.texcoordIndices[c] : NO_INDEX;
+        if (t != NO_INDEX) memcpy(key + 6, &scene.texcoords[2 * t], 2 * sizeof(float));
+        else key[6] = key[7] = missing;
+        if (hasColors) memcpy(key + 8, &scene.colors[3 * v], 3 * sizeof(float));
+        else key[8] = key[9] = key[10] = missing;
+    };
+
+    // 1. hash corners
+    std::vector<uint64_t> hashes(numCorners);
+    parallelForBlocks(numCorners, [&](size_t begin, size_t end, size_t) {
+        uint32_t key[WELD_KEY_SIZE];
+        for (size_t c = begin; c < end; c++) {
+            cornerKey(c, key);
+            hashes[c] = hashBytes(key, sizeof(key));
+        }
+    }, numThreads);
+
+    // 2. dedup corners per shard, the first corner of each unique key represents it
+    uint32_t shardBits = hashShardBits(numThreads);
+    size_t numShards = (size_t)1 << shardBits;
+    std::vector<uint32_t> order;
+    std::vector<size_t> shardOffsets;
+    partitionIndices(numCorners, numShards, [&](size_t c) { return hashShard(hashes[c], shardBits); }, order, shardOffsets, numThreads);
+
+    std::vector<uint32_t> cornerVertex(numCorners);
+    std::vector<std::vector<uint32_t>> shardReps(numShards);
+    parallelFor(numShards, [&](size_t s) {
+        HashShardTable table;
+        table.init(shardOffsets[s + 1] - shardOffsets[s]);
+        auto equal = [&](uint32_t a, uint32_t b) {
+            uint32_t keyA[WELD_KEY_SIZE], keyB[WELD_KEY_SIZE];
+            cornerKey(a, keyA);
+            cornerKey(b, keyB);
+            return memcmp(keyA, keyB, sizeof(keyA)) == 0;
+        };
+        std::vector<uint32_t>& reps = shardReps[s];
+        for (size_t i = shardOffsets[s]; i < shardOffsets[s + 1]; i++) {
+            uint32_t c = order[i];
+            uint32_t rep = table.find(c, hashes[c], hashes, equal);
+            if (rep == c) {
+                cornerVertex[c] = (uint32_t)reps.size();
+                reps.push_back(c);
+            } else {
+                cornerVertex[c] = cornerVertex[rep];
+            }
+        }
+    }, numThreads);
+
+    std::vector<uint32_t> shardBase(numShards + 1, 0);
+    for (size_t s = 0; s < numShards; s++) shardBase[s + 1] = shardBase[s] + (uint32_t)shardReps[s].size();
+    std::vector<uint32_t> vertexRep(shardBase[numShards]);
+    parallelFor(numShards, [&](size_t s) {
+        for (size_t i = shardOffsets[s]; i < shardOffsets[s + 1]; i++) cornerVertex[order[i]] += shardBase[s];
+        std::copy(shardReps[s].begin(), shardReps[s].end(), vertexRep.begin() + shardBase[s]);
+        shardReps[s] = std::vector<uint32_t>();
+    }, numThreads);
+
+    // 3. flag degenerate triangles and hash the rest in a winding-preserving canonical rotation
+    size_t numTriangles = numCorners / 3;
+    std::vector<uint8_t> keep(numTriangles, 1);
+    std::vector<uint64_t> triHashes(numTriangles);
+    auto canonical = [&](size_t t, uint32_t* tri) {
+        const uint32_t* v = &cornerVertex[3 * t];
+        int first = (v[0] < v[1] && v[0] < v[2]) ? 0 : (v[1] < v[2] ? 1 : 2);
+        for (int k = 0; k < 3; k++) tri[k] = v[(first + k) % 3];
+        tri[3] = (uint32_t)(std::upper_bound(scene.shapes.begin(), scene.shapes.end(), (uint32_t)t) - scene.shapes.begin());
+    };
+    parallelForBlocks(numTriangles, [&](size_t begin, size_t end, size_t) {
+        for (size_t t = begin; t < end; t++) {
+            const float* p[3];
+            for (int k = 0; k < 3; k++) p[k] = &scene.vertices[3 * scene.indices[3 * t + k]];
+            float e0[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+            float e1[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+            float cx = e0[1] * e1[2] - e0[2] * e1[1];
+            float cy = e0[2] * e1[0] - e0[0] * e1[2];
+            float cz = e0[0] * e1[1] - e0[1] * e1[0];
+            if (cx == 0.0f && cy == 0.0f && cz == 0.0f) {
+                keep[t] = 0;
+                continue;
+            }
+            uint32_t tri[4];
+            canonical(t, tri);
+            triHashes[t] = hashBytes(tri, sizeof(tri));
+        }
+    }, numThreads);
+
+    // 4. drop duplicate triangles, keeping the first occurrence
+    partitionIndices(numTriangles, numShards, [&](size_t t) { return keep[t] ? hashShard(triHashes[t], shardBits) : 0; }, order, shardOffsets, numThreads);
+    parallelFor(numShards, [&](size_t s) {
+        HashShardTable table;
+        table.init(shardOffsets[s + 1] - shardOffsets[s]);
+        auto equal = [&](uint32_t a, uint32_t b) {
+            uint32_t triA[4], triB[4];
+            canonical(a, triA);
+            canonical(b, triB);
+            return memcmp(triA, triB, sizeof(triA)) == 0;
+        };
+        for (size_t i = shardOffsets[s]; i < shardOffsets[s + 1]; i++) {
+            uint32_t t = order[i];
+            if (keep[t] && table.find(t, triHashes[t], triHashes, equal) != t) keep[t] = 2;
+        }
+    }, numThreads);
+    for (size_t t = 0; t < numTriangles; t++) {
+        if (keep[t] == 0) stats.degenerateTriangles++;
+        else if (keep[t] == 2) stats.duplicateTriangles++;
+    }
+    hashes = std::vector<uint64_t>();
+    triHashes = std::vector<uint64_t>();
+    order = std::vector<uint32_t>();
+
+    // 5. renumber referenced vertices in order of first use, shapes start at their first kept triangle
+    std::vector<uint32_t> remap(vertexRep.size(), NO_INDEX);
+    std::vector<uint32_t> indices, shapes(scene.shapes.size());
+    indices.reserve(numCorners - 3 * (stats.degenerateTriangles + stats.duplicateTriangles));
+    uint32_t numVertices = 0;
+    size_t shape = 0;
+    for (size_t t = 0; t < numTriangles; t++) {
+        while (shape < shapes.size() && scene.shapes[shape] <= t) shapes[shape++] = (uint32_t)(indices.size() / 3);
+        if (keep[t] != 1) continue;
+        for (int k = 0; k < 3; k++) {
+            uint32_t& id = remap[cornerVertex[3 * t + k]];
+            if (id == NO_INDEX) id = numVertices++;
+            indices.push_back(id);
+        }
+    }
+
+    // 6. gather per-vertex attributes from each vertex's representative corner
+    Scene welded;
+    welded.vertices.resize(3 * (size_t)numVertices);
+    if (hasNormals) welded.normals.resize(3 * (size_t)numVertices);
+    if (hasTexcoords) welded.texcoords.resize(2 * (size_t)numVertices);
+    if (hasColors) welded.colors.resize(3 * (size_t)numVertices);
+    parallelForBlocks(vertexRep.size(), [&](size_t begin, size_t end, size_t) {
+        for (size_t v = begin; v < end; v++) {
+            uint32_t id = remap[v];
+            if (id == NO_INDEX) continue;
+            uint32_t c = vertexRep[v];
+            uint32_t p = scene.indices[c];
+            memcpy(&welded.vertices[3 * (size_t)id], &scene.vertices[3 * (size_t)p], 3 * sizeof(float));
+            if (hasColors) memcpy(&welded.colors[3 * (size_t)id], &scene.colors[3 * (size_t)p], 3 * sizeof(float));
+            if (hasNormals) {
+                uint32_t n = scene.normalIndices[c];
+                float* dst = &welded.normals[3 * (size_t)id];
+                if (n != NO_INDEX) memcpy(dst, &scene.normals[3 * (size_t)n], 3 * sizeof(float));
+                else dst[0] = dst[1] = dst[2] = 0.0f;
+            }
+            if (hasTexcoords) {
+                uint32_t t = scene.texcoordIndices[c];
+                float* dst = &welded.texcoords[2 * (size_t)id];
+                if (t != NO_INDEX) memcpy(dst, &scene.texcoords[2 * (size_t)t], 2 * sizeof(float));
+                else dst[0] = dst[1] = 0.0f;
+            }
+        }
+    }, numThreads);
+    while (shape < shapes.size()) shapes[shape++] = (uint32_t)(indices.size() / 3);
+    welded.indices = std::move(indices);
+    welded.shapes = std::move(shapes);
+    welded.instanceShapes = std::move(scene.instanceShapes);
+    welded.instanceTransforms = std::move(scene.instanceTransforms);
+    scene = std::move(welded);
+
+    stats.verticesAfter = numVertices;
+    stats.trianglesAfter = scene.indices.size() / 3;
+    stats.bytesAfter = sceneUploadBytes(scene);
+    return stats;
+}
+
+void printWeldStats(const WeldStats& stats) {
+    long long bytesRemoved = (long long)stats.bytesBefore - (long long)stats.bytesAfter;
+    printf("Welded %zu -> %zu vertices and %zu -> %zu triangles (%zu degenerate, %zu duplicate), vertex and index buffers %zu -> %zu bytes (%lld removed)\n",
+        stats.verticesBefore, stats.verticesAfter, stats.trianglesBefore, stats.trianglesAfter, stats.degenerateTriangles, stats.duplicateTriangles,
+        stats.bytesBefore, stats.bytesAfter, bytesRemoved);
+}
+
+// Locality reordering
+// Triangles are sorted along a Morton (Z-order) curve through their centroids so
+// that neighbouring triangles in the index buffer are neighbours in space, which
+// helps both the BLAS builder and attribute fetches in hit shaders. Vertices are
+// then renumbered in order of first use so vertex data follows the same order.
+// Works on welded and unwelded scenes: per-corner normal/texcoord index streams
+// are permuted along with the triangles. Triangles stay within their shape.
+// An input whose order is already at least as coherent is left as it is.
+
+struct ReorderStats {
+    double spreadBefore = 0.0;
+    double spreadAfter = 0.0; // of the sorted order, even when it wasn't applied
+    bool applied = false;
+};
+
+// Mean distance between the centroids of consecutive triangles in the index
+// buffer, or in order (the triangle at each position) when given, relative to
+// the scene's bounding box diagonal
+double triangleOrderSpread(const Scene& scene, const float* lo, const float* hi, const uint32_t* order = nullptr) {
+    size_t numTriangles = scene.indices.size() / 3;
+    if (numTriangles < 2) return 0.0;
+    double diagonal = std::sqrt((double)(hi[0] - lo[0]) * (hi[0] - lo[0]) + (double)(hi[1] - lo[1]) * (hi[1] - lo[1]) + (double)(hi[2] - lo[2]) * (hi[2] - lo[2]));
+    if (diagonal == 0.0) return 0.0;
+    double sum = 0.0, previous[3] = {};
+    for (size_t i = 0; i < numTriangles; i++) {
+        size_t t = order ? order[i] : i;
+        double centroid[3], d2 = 0.0;
+        for (int k = 0; k < 3; k++) {
+            centroid[k] = (scene.vertices[3 * scene.indices[3 * t + 0] + k] + scene.vertices[3 * scene.indices[3 * t + 1] + k]
+                + scene.vertices[3 * scene.indices[3 * t + 2] + k]) / 3.0;
+            d2 += (centroid[k] - previous[k]) * (centroid[k] - previous[k]);
+            previous[k] = centroid[k];
+        }
+        if (i > 0) sum += std::sqrt(d2);
+    }
+    return sum / (numTriangles - 1) / diagonal;
+}
+
+// Interleaves the low 21 bits of x with two zero bits between each
+inline uint64_t mortonSpread(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+struct SortKey {
+    uint32_t shape;
+    uint64_t key;
+    uint32_t id;
+};
+
+ReorderStats reorderScene(Scene& scene, unsigned numThreads = 0) {
+    ReorderStats stats;
+    size_t numVertices = scene.vertices.size() / 3;
+    size_t numTriangles = scene.indices.size() / 3;
+    if (numTriangles == 0) return stats;
+
+    // scene bounds
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<float> blockBounds(6 * numThreads);
+    size_t numBlocks = parallelForBlocks(numVertices, [&](size_t begin, size_t end, size_t b) {
+        float* bounds = &blockBounds[6 * b];
+        for (int k = 0; k < 3; k++) {
+            bounds[k] = INFINITY;
+            bounds[3 + k] = -INFINITY;
+        }
+        for (size_t v = begin; v < end; v++) {
+            for (int k = 0; k < 3; k++) {
+                bounds[k] = std::min(bounds[k], scene.vertices[3 * v + k]);
+                bounds[3 + k] = std::max(bounds[3 + k], scene.vertices[3 * v + k]);
+            }
+        }
+    }, numThreads);
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, scale[3];
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (size_t b = 0; b < numBlocks; b++) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], blockBounds[6 * b + k]);
+            hi[k] = std::max(hi[k], blockBounds[6 * b + 3 + k]);
+        }
+    }
+    for (int k = 0; k < 3; k++) scale[k] = hi[k] > lo[k] ? (float)0x1fffff / (hi[k] - lo[k]) : 0.0f;
+    stats.spreadBefore = triangleOrderSpread(scene, lo, hi);
+
+    // sort triangles by the Morton code of their centroid
+    std::vector<SortKey> keys(numTriangles);
+    parallelForBlocks(numTriangles, [&](size_t begin, size_t end, size_t) {
+        for (size_t t = begin; t < end; t++) {
+            uint64_t code = 0;
+            for (int k = 0; k < 3; k++) {
+                float centroid = (scene.vertices[3 * scene.indices[3 * t + 0] + k]
+                    + scene.vertices[3 * scene.indices[3 * t + 1] + k]
+                    + scene.vertices[3 * scene.indices[3 * t + 2] + k]) / 3.0f;
+                float q = std::clamp((centroid - lo[k]) * scale[k], 0.0f, (float)0x1fffff);
+                code |= mortonSpread((uint64_t)q) << k;
+            }
+            uint32_t shape = (uint32_t)(std::upper_bound(scene.shapes.begin(), scene.shapes.end(), (uint32_t)t) - scene.shapes.begin());
+            keys[t] = { shape, code, (uint32_t)t };
+        }
+    }, numThreads);
+    parallelSort(keys, [](const SortKey& a, const SortKey& b) {
+        return a.shape < b.shape || (a.shape == b.shape && (a.key < b.key || (a.key == b.key && a.id < b.id)));
+    }, numThreads);
+    std::vector<uint32_t> order(numTriangles);
+    for (size_t t = 0; t < numTriangles; t++) order[t] = keys[t].id;
+    stats.spreadAfter = triangleOrderSpread(scene, lo, hi, order.data());
+    if (stats.spreadAfter >= stats.spreadBefore) return stats;
+    stats.applied = true;
+
+    auto permuteCorners = [&](std::vector<uint32_t>& stream) {
+        if (stream.size() != scene.indices.size()) return;
+        std::vector<uint32_t> sorted(stream.size());
+        parallelForBlocks(numTriangles, [&](size_t begin, size_t end, size_t) {
+            for (size_t t = begin; t < end; t++) {
+                memcpy(&sorted[3 * t], &stream[3 * (size_t)keys[t].id], 3 * sizeof(uint32_t));
+            }
+        }, numThreads);
+        stream.swap(sorted);
+    };
+    permuteCorners(scene.normalIndices);
+    permuteCorners(scene.texcoordIndices);
+    permuteCorners(scene.indices);
+    if (!scene.triangleIds.empty()) {
+        std::vector<uint32_t> sorted(numTriangles);
+        for (size_t t = 0; t < numTriangles; t++) sorted[t] = scene.triangleIds[keys[t].id];
+        scene.triangleIds.swap(sorted);
+    }
+    keys = std::vector<SortKey>();
+
+    // renumber vertices in order of first use and move per-vertex data to match
+    std::vector<uint32_t> remap(numVertices, NO_INDEX);
+    std::vector<uint32_t> vertexOrder;
+    vertexOrder.reserve(numVertices);
+    for (uint32_t& v : scene.indices) {
+        if (remap[v] == NO_INDEX) {
+            remap[v] = (uint32_t)vertexOrder.size();
+            vertexOrder.push_back(v);
+        }
+        v = remap[v];
+    }
+    auto permuteVertices = [&](std::vector<float>& attribute, size_t width) {
+        if (attribute.size() != numVertices * width) return;
+        std::vector<float> sorted(vertexOrder.size() * width);
+        parallelForBlocks(vertexOrder.size(), [&](size_t begin, size_t end, size_t) {
+            for (size_t v = begin; v < end; v++) {
+                memcpy(&sorted[width * v], &attribute[width * (size_t)vertexOrder[v]], width * sizeof(float));
+            }
+        }, numThreads);
+        attribute.swap(sorted);
+    };
+    bool perVertexNormals = scene.normalIndices.empty();
+    bool perVertexTexcoords = scene.texcoordIndices.empty();
+    permuteVertices(scene.vertices, 3);
+    permuteVertices(scene.colors, 3);
+    if (perVertexNormals) permuteVertices(scene.normals, 3);
+    if (perVertexTexcoords) permuteVertices(scene.texcoords, 2);
+    return stats;
+}
+
+void printReorderStats(const ReorderStats& stats) {
+    if (!stats.applied) {
+        printf("Kept the triangle order, a Morton curve would take the mean step between consecutive triangles from %.4f to %.4f of the scene diagonal\n",
+            stats.spreadBefore, stats.spreadAfter);
+        return;
+    }
+    printf("Reordered triangles along a Morton curve, mean step between consecutive triangles %.4f -> %.4f of the scene diagonal\n", stats.spreadBefore, stats.spreadAfter);
+}
+
+// Spatial partitioning
+// Splits the triangles into numPartitions spatially coherent clusters so each
+// can get its own BLAS under the TLAS. Clusters come from recursive median
+// splits of triangle centroids along the longest axis of each cluster's
+// centroid bounds, with the split point chosen so every leaf ends up with
+// about the same number of triangles. The index streams are permuted so each
+// cluster is a contiguous range of triangles; vertices are left shared. A scene
+// with instances (see dedupShapes) is partitioned by its shapes instead, the
+// meshes the instances place.
+
+struct ScenePartition {
+    uint32_t firstTriangle;
+    uint32_t triangleCount;
+    float lo[3];
+    float hi[3];
+};
+
+ScenePartition partitionBounds(const float* vertices, const uint32_t* indices, uint32_t firstTriangle, uint32_t triangleCount) {
+    ScenePartition partition = { firstTriangle, triangleCount, { INFINITY, INFINITY, INFINITY }, { -INFINITY, -INFINITY, -INFINITY } };
+    for (size_t i = 3 * (size_t)firstTriangle; i < 3 * ((size_t)firstTriangle + triangleCount); i++) {
+        for (int k = 0; k < 3; k++) {
+            partition.lo[k] = std::min(partition.lo[k], vertices[3 * (size_t)indices[i] + k]);
+            partition.hi[k] = std::max(partition.hi[k], vertices[3 * (size_t)indices[i] + k]);
+        }
+    }
+    return partition;
+}
+
+inline ScenePartition partitionBounds(const Scene& scene, uint32_t firstTriangle, uint32_t triangleCount) {
+    return partitionBounds(scene.vertices.data(), scene.indices.data(), firstTriangle, triangleCount);
+}
+
+// A range of triangles to be split into count clusters
+struct TriangleRange {
+    size_t begin, end;
+    uint32_t count;
+};
+
+// Splits every range into its count clusters in place, ranges don't overlap
+// and are in increasing order. Returns the clusters in triangle order.
+std::vector<ScenePartition> splitTriangleRanges(Scene& scene, const std::vector<TriangleRange>& ranges, unsigned numThreads = 0) {
+    size_t numTriangles = scene.indices.size() / 3;
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<float> centroids(3 * numTriangles);
+    std::vector<uint32_t> order(numTriangles);
+    parallelForBlocks(numTriangles, [&](size_t begin, size_t end, size_t) {
+        for (size_t t = begin; t < end; t++) {
+            for (int k = 0; k < 3; k++) {
+                centroids[3 * t + k] = (scene.vertices[3 * scene.indices[3 * t + 0] + k] + scene.vertices[3 * scene.indices[3 * t + 1] + k]
+                    + scene.vertices[3 * scene.indices[3 * t + 2] + k]) / 3.0f;
+            }
+            order[t] = (uint32_t)t;
+        }
+    }, numThreads);
+
+    // split level by level, every node of a level on its own thread
+    struct Node {
+        size_t begin, end;
+        uint32_t partitions;
+    };
+    std::vector<Node> nodes, leaves;
+    for (const TriangleRange& range : ranges) {
+        nodes.push_back({ range.begin, range.end, (uint32_t)std::max<size_t>(1, std::min<size_t>(range.count, range.end - range.begin)) });
+    }
+    while (!nodes.empty()) {
+        std::vector<Node> children(2 * nodes.size());
+        parallelFor(nodes.size(), [&](size_t n) {
+            Node node = nodes[n];
+            if (node.partitions == 1) return;
+            float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+            for (size_t i = node.begin; i < node.end; i++) {
+                for (int k = 0; k < 3; k++) {
+                    lo[k] = std::min(lo[k], centroids[3 * order[i] + k]);
+                    hi[k] = std::max(hi[k], centroids[3 * order[i] + k]);
+                }
+            }
+            int axis = 0;
+            for (int k = 1; k < 3; k++) {
+                if (hi[k] - lo[k] > hi[axis] - lo[axis]) axis = k;
+            }
+            uint32_t leftPartitions = node.partitions / 2;
+            size_t middle = node.begin + (node.end - node.begin) * leftPartitions / node.partitions;
+            std::nth_element(order.begin() + node.begin, order.begin() + middle, order.begin() + node.end, [&](uint32_t a, uint32_t b) {
+                return centroids[3 * a + axis] < centroids[3 * b + axis] || (centroids[3 * a + axis] == centroids[3 * b + axis] && a < b);
+            });
+            children[2 * n + 0] = { node.begin, middle, leftPartitions };
+            children[2 * n + 1] = { middle, node.end, node.partitions - leftPartitions };
+        }, numThreads);
+        std::vector<Node> next;
+        for (size_t n = 0; n < nodes.size(); n++) {
+            if (nodes[n].partitions == 1) {
+                leaves.push_back(nodes[n]);
+            } else {
+                next.push_back(children[2 * n + 0]);
+                next.push_back(children[2 * n + 1]);
+            }
+        }
+        nodes.swap(next);
+    }
+    std::sort(leaves.begin(), leaves.end(), [](const Node& a, const Node& b) { return a.begin < b.begin || (a.begin == b.begin && a.end < b.end); });
+    centroids = std::vector<float>();
+
+    auto permuteCorners = [&](std::vector<uint32_t>& stream) {
+        if (stream.size() != scene.indices.size()) return;
+        std::vector<uint32_t> sorted(stream.size());
+        parallelForBlocks(numTriangles, [&](size_t begin, size_t end, size_t) {
+            for (size_t t = begin; t < end; t++) {
+                memcpy(&sorted[3 * t], &stream[3 * (size_t)order[t]], 3 * sizeof(uint32_t));
+            }
+        }, numThreads);
+        stream.swap(sorted);
+    };
+    permuteCorners(scene.normalIndices);
+    permuteCorners(scene.texcoordIndices);
+    permuteCorners(scene.indices);
+    if (!scene.triangleIds.empty()) {
+        std::vector<uint32_t> sorted(numTriangles);
+        for (size_t t = 0; t < numTriangles; t++) sorted[t] = scene.triangleIds[order[t]];
+        scene.triangleIds.swap(sorted);
+    }
+
+    std::vector<ScenePartition> partitions(leaves.size());
+    parallelFor(leaves.size(), [&](size_t p) {
+        partitions[p] = partitionBounds(scene, (uint32_t)leaves[p].begin, (uint32_t)(leaves[p].end - leaves[p].begin));
+    }, numThreads);
+    return partitions;
+}
+
+std::vector<ScenePartition> partitionScene(Scene& scene, uint32_t numPartitions, unsigned numThreads = 0) {
+    size_t numTriangles = scene.indices.size() / 3;
+    if (!scene.instanceShapes.empty()) {
+        std::vector<ScenePartition> partitions(scene.shapes.size());
+        parallelFor(partitions.size(), [&](size_t p) {
+            size_t end = p + 1 < scene.shapes.size() ? scene.shapes[p + 1] : numTriangles;
+            partitions[p] = partitionBounds(scene, scene.shapes[p], (uint32_t)(end - scene.shapes[p]));
+        }, numThreads);
+        return partitions;
+    }
+    if (std::min<size_t>(numPartitions, numTriangles) <= 1) {
+        return { partitionBounds(scene, 0, (uint32_t)numTriangles) };
+    }
+    return splitTriangleRanges(scene, { { 0, numTriangles, numPartitions } }, numThreads);
+}
+
+// partitionScene for a cached scene read straight from its mapping, which is
+// never split: a partition per mesh of an instanced scene, else the whole scene
+std::vector<ScenePartition> partitionSceneCache(const SceneCache& cache, unsigned numThreads = 0) {
+    const float* vertices = cache.array<float>(SCENE_CACHE_VERTICES);
+    const uint32_t* indices = cache.array<uint32_t>(SCENE_CACHE_INDICES);
+    const uint32_t* shapes = cache.array<uint32_t>(SCENE_CACHE_SHAPES);
+    size_t numTriangles = cache.count(SCENE_CACHE_INDICES) / 3;
+    size_t numShapes = cache.count(SCENE_CACHE_SHAPES);
+    if (cache.count(SCENE_CACHE_INSTANCE_SHAPES) == 0) return { partitionBounds(vertices, indices, 0, (uint32_t)numTriangles) };
+    std::vector<ScenePartition> partitions(numShapes);
+    parallelFor(partitions.size(), [&](size_t p) {
+        size_t end = p + 1 < numShapes ? shapes[p + 1] : numTriangles;
+        partitions[p] = partitionBounds(vertices, indices, shapes[p], (uint32_t)(end - shapes[p]));
+    }, numThreads);
+    return partitions;
+}
+
+// Splits every partition of more than maxTriangles triangles the same way, into
+// as few clusters as keep each within maxTriangles. The pieces of partition p
+// are firstPiece[p] up to firstPiece[p + 1] of the result.
+std::vector<ScenePartition> splitPartitions(Scene& scene, const std::vector<ScenePartition>& partitions, uint32_t maxTriangles, std::vector<uint32_t>& firstPiece,
+    unsigned numThreads = 0) {
+    std::vector<TriangleRange> ranges;
+    firstPiece.assign(1, 0);
+    bool split = false;
+    for (const ScenePartition& partition : partitions) {
+        uint32_t count = (uint32_t)std::max<size_t>(1, ((size_t)partition.triangleCount + maxTriangles - 1) / maxTriangles);
+        ranges.push_back({ partition.firstTriangle, (size_t)partition.firstTriangle + partition.triangleCount, count });
+        firstPiece.push_back(firstPiece.back() + count);
+        split |= count > 1;
+    }
+    if (!split) return partitions;
+    return splitTriangleRanges(scene, ranges, numThreads);
+}
+
+inline double boundsSurfaceArea(const float* lo, const float* hi) {
+    double d[3];
+    for (int k = 0; k < 3; k++) d[k] = std::max(0.0, (double)hi[k] - lo[k]);
+    return 2.0 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+// The overlap figure is the summed surface area of the partition bounds over
+// that of the scene bounds, roughly how many BLASes a random ray through the
+// scene enters (1.0 for a single partition)
+void printScenePartitions(const std::vector<ScenePartition>& partitions) {
+    if (partitions.empty()) return;
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    double area = 0.0;
+    uint32_t minTriangles = UINT32_MAX, maxTriangles = 0;
+    for (const ScenePartition& partition : partitions) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], partition.lo[k]);
+            hi[k] = std::max(hi[k], partition.hi[k]);
+        }
+        area += boundsSurfaceArea(partition.lo, partition.hi);
+        minTriangles = std::min(minTriangles, partition.triangleCount);
+        maxTriangles = std::max(maxTriangles, partition.triangleCount);
+    }
+    double sceneArea = boundsSurfaceArea(lo, hi);
+    printf("Partitioned into %zu clusters of %u-%u triangles, overlap %.2f\n", partitions.size(), minTriangles, maxTriangles, sceneArea > 0.0 ? area / sceneArea : 1.0);
+}
+
+// Triangle pre-splitting
+// Long, thin triangles lying diagonally to the axes have bounding boxes far
+// larger than themselves, and the BVH builder can only put them in large,
+// overlapping leaves. Triangles whose box surface area exceeds maxAreaRatio
+// times their own area are cut into pieces at edge midpoints, largest boxes
+// first, until the triangle count has grown by maxGrowth. Both triangles on a
+// cut edge share its midpoint vertex, which gets interpolated attributes; the
+// halves keep the winding of their parent. scene.triangleIds maps every
+// triangle back to the input triangle it came from, so shading by primitive is
+// unchanged. Meant to run after weldScene, which drops triangles without
+// updating triangleIds; reorderScene and partitionScene permute it along with
+// the triangles.
+
+struct SplitStats {
+    size_t trianglesBefore = 0;
+    size_t trianglesAfter = 0;
+    size_t candidates = 0; // triangles over the ratio before splitting
+    size_t split = 0; // candidates cut before the budget ran out
+    size_t cuts = 0; // one triangle added each
+    double boxAreaBefore = 0.0; // summed surface area of the triangle bounding boxes
+    double boxAreaAfter = 0.0;
+};
+
+const float SPLIT_MAX_AREA_RATIO = 16.0f; // an axis aligned right triangle has 4
+const size_t SPLIT_MAX_PIECES = 8; // per round of cuts on one triangle
+
+// Surface area of triangle t's bounding box, and the triangle's own area
+inline double triangleBoxArea(const Scene& scene, size_t t, double& area) {
+    const float* p[3];
+    for (int c = 0; c < 3; c++) p[c] = &scene.vertices[3 * (size_t)scene.indices[3 * t + c]];
+    float lo[3], hi[3];
+    double e1[3], e2[3];
+    for (int k = 0; k < 3; k++) {
+        lo[k] = std::min({ p[0][k], p[1][k], p[2][k] });
+        hi[k] = std::max({ p[0][k], p[1][k], p[2][k] });
+        e1[k] = (double)p[1][k] - p[0][k];
+        e2[k] = (double)p[2][k] - p[0][k];
+    }
+    double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+    area = 0.5 * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    return boundsSurfaceArea(lo, hi);
+}
+
+// Summed box surface area over all triangles
+double sceneBoxArea(const Scene& scene, unsigned numThreads) {
+    std::vector<double> blockSums(numThreads, 0.0);
+    size_t numBlocks = parallelForBlocks(scene.indices.size() / 3, [&](size_t begin, size_t end, size_t b) {
+        double area;
+        for (size_t t = begin; t < end; t++) blockSums[b] += triangleBoxArea(scene, t, area);
+    }, numThreads);
+    double sum = 0.0;
+    for (size_t b = 0; b < numBlocks; b++) sum += blockSums[b];
+    return sum;
+}
+
+SplitStats splitTriangles(Scene& scene, double maxGrowth, float maxAreaRatio = SPLIT_MAX_AREA_RATIO, unsigned numThreads = 0) {
+    SplitStats stats;
+    size_t numTriangles = scene.indices.size() / 3;
+    stats.trianglesBefore = stats.trianglesAfter = numTriangles;
+    if (numTriangles == 0) return stats;
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (scene.triangleIds.size() != numTriangles) {
+        scene.triangleIds.resize(numTriangles);
+        for (size_t t = 0; t < numTriangles; t++) scene.triangleIds[t] = (uint32_t)t;
+    }
+
+    // the triangles over the ratio, as a max-heap on box area
+    struct Candidate {
+        double boxArea;
+        uint32_t triangle;
+        bool operator<(const Candidate& other) const { return boxArea < other.boxArea || (boxArea == other.boxArea && triangle > other.triangle); }
+    };
+    std::vector<std::vector<Candidate>> blockCandidates(numThreads);
+    std::vector<double> blockSums(numThreads, 0.0);
+    size_t numBlocks = parallelForBlocks(numTriangles, [&](size_t begin, size_t end, size_t b) {
+        for (size_t t = begin; t < end; t++) {
+            double area, boxArea = triangleBoxArea(scene, t, area);
+            blockSums[b] += boxArea;
+            if (area > 0.0 && boxArea > maxAreaRatio * area) blockCandidates[b].push_back({ boxArea, (uint32_t)t });
+        }
+    }, numThreads);
+    std::vector<Candidate> heap;
+    for (size_t b = 0; b < numBlocks; b++) {
+        stats.boxAreaBefore += blockSums[b];
+        heap.insert(heap.end(), blockCandidates[b].begin(), blockCandidates[b].end());
+    }
+    blockCandidates = std::vector<std::vector<Candidate>>();
+    stats.candidates = heap.size();
+    std::make_heap(heap.begin(), heap.end());
+
+    size_t numVertices = scene.vertices.size() / 3;
+    bool vertexNormals = scene.normalIndices.empty() && scene.normals.size() == 3 * numVertices;
+    bool vertexTexcoords = scene.texcoordIndices.empty() && scene.texcoords.size() == 2 * numVertices;
+    bool vertexColors = scene.colors.size() == 3 * numVertices;
+    auto lerp = [](std::vector<float>& attribute, size_t width, uint32_t a, uint32_t b) {
+        for (size_t k = 0; k < width; k++) attribute.push_back(0.5f * (attribute[width * a + k] + attribute[width * b + k]));
+        return (uint32_t)(attribute.size() / width - 1);
+    };
+    auto normalize = [](std::vector<float>& normals) {
+        float* n = &normals[normals.size() - 3];
+        float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length > 0.0f) for (int k = 0; k < 3; k++) n[k] /= length;
+    };
+    // per-corner attributes are interpolated when both ends of the cut edge have one
+    auto splitCorners = [&](std::vector<uint32_t>& stream, std::vector<float>& attribute, size_t width, size_t t, int i, int j, bool isNormal) {
+        if (stream.empty()) return;
+        uint32_t a = stream[3 * t + i], b = stream[3 * t + j], m = NO_INDEX;
+        if (a != NO_INDEX && b != NO_INDEX) {
+            m = lerp(attribute, width, a, b);
+            if (isNormal) normalize(attribute);
+        }
+        uint32_t corners[3] = { stream[3 * t], stream[3 * t + 1], stream[3 * t + 2] };
+        corners[i] = m;
+        stream.insert(stream.end(), corners, corners + 3);
+        stream[3 * t + j] = m;
+    };
+
+    // cuts triangle t at the midpoint of the edge, corner i to corner j, whose
+    // halves have the least summed box area and returns the new triangle, which
+    // takes corner i's place
+    std::unordered_map<uint64_t, uint32_t> midpoints; // edge (lower, higher vertex) -> its midpoint vertex
+    auto cut = [&](size_t t) {
+        int i = 0;
+        double best = INFINITY;
+        for (int c = 0; c < 3; c++) {
+            const float* p[3];
+            for (int k = 0; k < 3; k++) p[k] = &scene.vertices[3 * (size_t)scene.indices[3 * t + (c + k) % 3]];
+            float mid[3], lo[2][3], hi[2][3];
+            for (int k = 0; k < 3; k++) {
+                mid[k] = 0.5f * (p[0][k] + p[1][k]);
+                lo[0][k] = std::min({ p[0][k], mid[k], p[2][k] });
+                hi[0][k] = std::max({ p[0][k], mid[k], p[2][k] });
+                lo[1][k] = std::min({ mid[k], p[1][k], p[2][k] });
+                hi[1][k] = std::max({ mid[k], p[1][k], p[2][k] });
+            }
+            double area = boundsSurfaceArea(lo[0], hi[0]) + boundsSurfaceArea(lo[1], hi[1]);
+            if (area < best) {
+                best = area;
+                i = c;
+            }
+        }
+        int j = (i + 1) % 3;
+        uint32_t a = scene.indices[3 * t + i], b = scene.indices[3 * t + j];
+        uint64_t edge = (uint64_t)std::min(a, b) << 32 | std::max(a, b);
+        auto [it, inserted] = midpoints.try_emplace(edge, (uint32_t)(scene.vertices.size() / 3));
+        if (inserted) {
+            lerp(scene.vertices, 3, a, b);
+            if (vertexColors) lerp(scene.colors, 3, a, b);
+            if (vertexNormals) {
+                lerp(scene.normals, 3, a, b);
+                normalize(scene.normals);
+            }
+            if (vertexTexcoords) lerp(scene.texcoords, 2, a, b);
+        }
+        uint32_t m = it->second;
+        uint32_t corners[3] = { scene.indices[3 * t], scene.indices[3 * t + 1], scene.indices[3 * t + 2] };
+        corners[i] = m;
+        scene.indices.insert(scene.indices.end(), corners, corners + 3);
+        scene.indices[3 * t + j] = m;
+        splitCorners(scene.normalIndices, scene.normals, 3, t, i, j, true);
+        splitCorners(scene.texcoordIndices, scene.texcoords, 2, t, i, j, false);
+        scene.triangleIds.push_back(scene.triangleIds[t]);
+        stats.cuts++;
+        return scene.indices.size() / 3 - 1;
+    };
+
+    // a single cut of a sliver often leaves one half with its parent's whole box,
+    // so a popped triangle is cut until every piece has at most half its box
+    // area (or SPLIT_MAX_PIECES pieces), and the pieces still over the ratio
+    // go back on the heap
+    size_t budget = (size_t)(maxGrowth * numTriangles);
+    std::vector<Candidate> pieces;
+    std::vector<bool> wasSplit(numTriangles, false); // by input triangle
+    while (!heap.empty() && budget > 0) {
+        std::pop_heap(heap.begin(), heap.end());
+        Candidate parent = heap.back();
+        heap.pop_back();
+        if (!wasSplit[scene.triangleIds[parent.triangle]]) {
+            wasSplit[scene.triangleIds[parent.triangle]] = true;
+            stats.split++;
+        }
+        pieces = { parent };
+        for (size_t count = 1; count < SPLIT_MAX_PIECES && budget > 0; count++, budget--) {
+            auto largest = std::max_element(pieces.begin(), pieces.end());
+            if (largest->boxArea <= 0.5 * parent.boxArea) break;
+            size_t t = largest->triangle;
+            *largest = pieces.back();
+            pieces.pop_back();
+            size_t half = cut(t);
+            for (size_t piece : { t, half }) {
+                double area;
+                pieces.push_back({ triangleBoxArea(scene, piece, area), (uint32_t)piece });
+            }
+        }
+        for (const Candidate& piece : pieces) {
+            double area;
+            triangleBoxArea(scene, piece.triangle, area);
+            if (area > 0.0 && piece.boxArea > maxAreaRatio * area) {
+                heap.push_back(piece);
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    }
+    stats.trianglesAfter = scene.indices.size() / 3;
+    stats.boxAreaAfter = sceneBoxArea(scene, numThreads);
+    return stats;
+}
+
+void printSplitStats(const SplitStats& stats) {
+    printf("Pre-split %zu of %zu long triangles with %zu cuts, %zu -> %zu triangles (+%.1f%%), summed triangle box area %.1f%% of before\n",
+        stats.split, stats.candidates, stats.cuts, stats.trianglesBefore, stats.trianglesAfter, 100.0 * stats.cuts / std::max<size_t>(stats.trianglesBefore, 1),
+        100.0 * stats.boxAreaAfter / std::max(stats.boxAreaBefore, 1e-30));
+}
+
+// Compact geometry encodings
+// Picks the smallest vertex and index formats for upload: 16-bit indices when
+// every index fits, and 16-bit positions when the largest round-trip error stays
+// within tolerance (relative to the bounding box diagonal). Positions are stored
+// relative to the bounding box so both 16-bit formats spend their precision on
+// the mesh itself; the returned transform maps them back to scene space and is
+// meant to be passed to the BLAS build as its transformData.
+
+enum VertexEncoding {
+    VERTEX_ENCODING_FLOAT32, // xyz floats, stride 12
+    VERTEX_ENCODING_SNORM16, // xyzw snorm16 scaled to the bounding box, stride 8
+    VERTEX_ENCODING_FLOAT16 // xyzw half floats centered on the bounding box, stride 8
+};
+
+inline const char* vertexEncodingString(VertexEncoding encoding) {
+    switch (encoding) {
+        case VERTEX_ENCODING_FLOAT32:
+            return "float32";
+        case VERTEX_ENCODING_SNORM16:
+            return "snorm16";
+        case VERTEX_ENCODING_FLOAT16:
+            return "float16";
+        default:
+            return "unknown";
+    }
+}
+
+struct CompactGeometry {
+    VertexEncoding vertexEncoding = VERTEX_ENCODING_FLOAT32;
+    uint32_t vertexStride = 3 * sizeof(float);
+    std::vector<uint8_t> vertices;
+    uint32_t indexSize = sizeof(uint32_t);
+    std::vector<uint8_t> indices;
+    float transform[3][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } }; // row-major 3x4, encoded -> scene space
+    double maxError = 0.0; // largest position error in scene units
+    size_t bytesBefore = 0;
+};
+
+// Round to nearest even float to half conversion, overflow goes to infinity
+inline uint16_t floatToHalf(float value) {
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+    uint16_t half;
+    if (x >= 0x47800000u) { // >= 65536 or inf/nan
+        half = x > 0x7f800000u ? 0x7e00 : 0x7c00;
+    } else if (x < 0x38800000u) { // half subnormal or zero, let float addition do the rounding
+        const uint32_t magicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+        float magic, f;
+        memcpy(&magic, &magicBits, sizeof(magic));
+        memcpy(&f, &x, sizeof(f));
+        f += magic;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        half = (uint16_t)(bits - magicBits);
+    } else {
+        uint32_t mantissaOdd = (x >> 13) & 1;
+        x += 0xc8000fffu; // rebias exponent from 127 to 15 and add the rounding bias
+        x += mantissaOdd;
+        half = (uint16_t)(x >> 13);
+    }
+    return half | (uint16_t)(sign >> 16);
+}
+
+inline float halfToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    if (exponent == 0) {
+        float f = mantissa * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+    uint32_t bits = sign | (exponent == 31 ? 0x7f800000u | (mantissa << 13) : ((exponent + 112) << 23) | (mantissa << 13));
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Encodes scene positions with the given encoding, returns the largest error in scene units
+double encodePositions(const Scene& scene, VertexEncoding encoding, const float* center, const float* halfExtent, std::vector<uint8_t>& out, unsigned numThreads) {
+    size_t numVertices = scene.vertices.size() / 3;
+    uint32_t stride = encoding == VERTEX_ENCODING_FLOAT32 ? 12 : 8;
+    out.resize(numVertices * stride);
+    std::vector<double> blockError(std::max(1u, numThreads == 0 ? std::thread::hardware_concurrency() : numThreads), 0.0);
+    parallelForBlocks(numVertices, [&](size_t begin, size_t end, size_t b) {
+        double error = 0.0;
+        for (size_t v = begin; v < end; v++) {
+            const float* p = &scene.vertices[3 * v];
+            uint8_t* dst = &out[v * stride];
+            if (encoding == VERTEX_ENCODING_FLOAT32) {
+                memcpy(dst, p, 12);
+                continue;
+            }
+            int16_t encoded[4] = { 0, 0, 0, 0 };
+            for (int k = 0; k < 3; k++) {
+                double decoded;
+                if (encoding == VERTEX_ENCODING_SNORM16) {
+                    float n = halfExtent[k] > 0.0f ? std::clamp((p[k] - center[k]) / halfExtent[k], -1.0f, 1.0f) : 0.0f;
+                    encoded[k] = (int16_t)std::lround(n * 32767.0f);
+                    decoded = center[k] + (double)halfExtent[k] * (encoded[k] / 32767.0);
+                } else {
+                    uint16_t half = floatToHalf(p[k] - center[k]);
+                    memcpy(&encoded[k], &half, sizeof(half));
+                    decoded = center[k] + (double)halfToFloat(half);
+                }
+                error = std::max(error, std::fabs(decoded - p[k]));
+            }
+            memcpy(dst, encoded, sizeof(encoded));
+        }
+        blockError[b] = error;
+    }, numThreads);
+    return *std::max_element(blockError.begin(), blockError.end());
+}
+
+// tolerance <= 0 keeps float32 positions; allowSnorm16/allowFloat16 say which formats the device can build from
+CompactGeometry encodeGeometry(const Scene& scene, double tolerance, bool allowIndex16, bool allowSnorm16, bool allowFloat16, unsigned numThreads = 0) {
+    CompactGeometry geometry;
+    size_t numVertices = scene.vertices.size() / 3;
+    geometry.bytesBefore = scene.vertices.size() * sizeof(float) + scene.indices.size() * sizeof(uint32_t);
+
+    // indices
+    geometry.indexSize = allowIndex16 && numVertices <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+    geometry.indices.resize(scene.indices.size() * geometry.indexSize);
+    if (geometry.indexSize == sizeof(uint16_t)) {
+        uint16_t* dst = (uint16_t*)geometry.indices.data();
+        parallelForBlocks(scene.indices.size(), [&](size_t begin, size_t end, size_t) {
+            for (size_t i = begin; i < end; i++) dst[i] = (uint16_t)scene.indices[i];
+        }, numThreads);
+    } else if (!scene.indices.empty()) {
+        memcpy(geometry.indices.data(), scene.indices.data(), geometry.indices.size());
+    }
+
+    // positions
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (size_t v = 0; v < numVertices; v++) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], scene.vertices[3 * v + k]);
+            hi[k] = std::max(hi[k], scene.vertices[3 * v + k]);
+        }
+    }
+    float center[3], halfExtent[3];
+    double diagonal = 0.0;
+    for (int k = 0; k < 3; k++) {
+        center[k] = numVertices > 0 ? 0.5f * (lo[k] + hi[k]) : 0.0f;
+        halfExtent[k] = numVertices > 0 ? std::max(hi[k] - center[k], center[k] - lo[k]) : 0.0f;
+        diagonal += 4.0 * halfExtent[k] * halfExtent[k];
+    }
+    double maxError = tolerance * std::sqrt(diagonal);
+
+    VertexEncoding best = VERTEX_ENCODING_FLOAT32;
+    double bestError = 0.0;
+    std::vector<uint8_t> candidate;
+    VertexEncoding candidates[2] = { VERTEX_ENCODING_SNORM16, VERTEX_ENCODING_FLOAT16 };
+    bool allowed[2] = { allowSnorm16, allowFloat16 };
+    for (int i = 0; i < 2 && tolerance > 0.0 && numVertices > 0; i++) {
+        if (!allowed[i]) continue;
+        double error = encodePositions(scene, candidates[i], center, halfExtent, candidate, numThreads);
+        if (error <= maxError && (best == VERTEX_ENCODING_FLOAT32 || error < bestError)) {
+            best = candidates[i];
+            bestError = error;
+            geometry.vertices.swap(candidate);
+        }
+    }
+    if (best == VERTEX_ENCODING_FLOAT32) {
+        encodePositions(scene, best, center, halfExtent, geometry.vertices, numThreads);
+    } else {
+        for (int k = 0; k < 3; k++) {
+            geometry.transform[k][k] = best == VERTEX_ENCODING_SNORM16 ? halfExtent[k] : 1.0f;
+            geometry.transform[k][3] = center[k];
+        }
+    }
+    geometry.vertexEncoding = best;
+    geometry.vertexStride = best == VERTEX_ENCODING_FLOAT32 ? 12 : 8;
+    geometry.maxError = bestError;
+    return geometry;
+}
+
+void printCompactGeometry(const CompactGeometry& geometry) {
+    size_t bytesAfter = geometry.vertices.size() + geometry.indices.size();
+    printf("Encoded geometry as %s positions and %u-bit indices, %zu -> %zu bytes (%zu saved), max position error %g\n",
+        vertexEncodingString(geometry.vertexEncoding), geometry.indexSize * 8, geometry.bytesBefore, bytesAfter,
+        geometry.bytesBefore - bytesAfter, geometry.maxError);
+}
@@ -0,0 +1,248 @@
+// pager.h
+// Devon McKee, 2025
+// Streams .rtchunks geometry on and off the device under a memory budget,
+// expects utils.h, accel.h and tlas.h to be included first.
+
+#pragma once
+
+#include "chunks.h"
+
+const VkDeviceSize PAGER_UPLOAD_PER_UPDATE = 64 << 20; // bytes paged in per update after the first
+
+struct PagedChunk {
+    Buffer buffer; // positions followed by indices, as in the chunk file
+    AccelerationStructure blas;
+    VkDeviceSize cost; // geometry and BLAS bytes while resident
+    bool resident = false;
+};
+
+// Keeps the chunks nearest the camera resident, as many as fit in budget
+// bytes. Every other chunk is drawn as an instance of a unit cube BLAS
+// scaled to its bounds, so distant content still occludes and shows up in
+// the image. The budget covers chunk geometry, their BLASes and the largest
+// build scratch, which stays allocated in scratch; the TLAS, instance buffer
+// and proxy cube are not counted. Page-ins share build calls only as far as
+// that one build's worth of scratch allows.
+struct GeometryPager {
+    Device device;
+    VkCommandPool commandPool;
+    Uploader* uploader;
+    ChunkFile chunks;
+    std::vector<PagedChunk> pages;
+    VkDeviceSize budget;
+    VkDeviceSize residentBytes = 0;
+    VkDeviceSize scratchReserve = 0;
+    ScratchArena scratch;
+    Buffer proxyBuffer;
+    AccelerationStructure proxyBlas;
+    uint64_t totalLoads = 0;
+    uint64_t totalEvictions = 0;
+    bool enabled = false;
+    void create(Device device, VkCommandPool commandPool, Uploader& uploader, VkDeviceSize budget);
+    bool update(const float* camera, VkDeviceSize maxUploadBytes, TopLevelManager& topLevel);
+    void destroy();
+    TriangleGeometry geometry(size_t c, VkDeviceAddress address) const;
+};
+
+TriangleGeometry GeometryPager::geometry(size_t c, VkDeviceAddress address) const {
+    const ChunkRecord& record = chunks.records[c];
+    return {
+        .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+        .vertexAddress = address,
+        .vertexStride = 12,
+        .maxVertex = std::max(record.vertexCount, 1u) - 1,
+        .indexType = record.indexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32,
+        .indexAddress = address + record.indexOffset,
+        .transformAddress = 0,
+        .primitiveOffset = 0,
+        .primitiveCount = record.triangleCount
+    };
+}
+
+// chunks must already be open
+void GeometryPager::create(Device device, VkCommandPool commandPool, Uploader& uploader, VkDeviceSize budget) {
+    this->device = device;
+    this->commandPool = commandPool;
+    this->uploader = &uploader;
+    this->budget = budget;
+    scratch.limit = 0; // never grown past what one build needs, the budget reserves exactly that
+    enabled = true;
+
+    // BLAS sizes only depend on formats and counts, so every chunk's cost is known up front
+    pages.resize(chunks.count());
+    for (size_t c = 0; c < pages.size(); c++) {
+        TriangleGeometry mesh = geometry(c, 0);
+        VkAccelerationStructureGeometryKHR accelerationStructureGeometry {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+            .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+            .geometry = {
+                .triangles = {
+                    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                    .vertexFormat = mesh.vertexFormat,
+                    .vertexStride = mesh.vertexStride,
+                    .maxVertex = mesh.maxVertex,
+                    .indexType = mesh.indexType
+                }
+            },
+            .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
+        };
+        VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+            .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+            .geometryCount = 1,
+            .pGeometries = &accelerationStructureGeometry
+        };
+        VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+        vkGetAccelerationStructureBuildSizesKHR(device.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &accelerationStructureBuildGeometryInfo, &mesh.primitiveCount, &accelerationStructureBuildSizesInfo);
+        pages[c].cost = chunks.records[c].size + accelerationStructureBuildSizesInfo.accelerationStructureSize;
+        scratchReserve = std::max(scratchReserve, accelerationStructureBuildSizesInfo.buildScratchSize);
+    }
+
+    // unit cube proxy, 8 corners and 12 triangles
+    const float corners[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+    const uint16_t faces[36] = { 0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4, 3, 7, 6, 3, 6, 2, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5 };
+    createBuffer(device, sizeof(corners) + sizeof(faces), proxyBuffer,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+    uploader.upload(proxyBuffer, 0, corners, sizeof(corners));
+    uploader.upload(proxyBuffer, sizeof(corners), faces, sizeof(faces));
+    uploader.wait();
+    VkDeviceAddress proxyAddress = getBufferDeviceAddress(device, proxyBuffer);
+    std::vector<std::vector<TriangleGeometry>> proxyMesh = { { {
+        .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+        .vertexAddress = proxyAddress,
+        .vertexStride = sizeof(corners[0]),
+        .maxVertex = 7,
+        .indexType = VK_INDEX_TYPE_UINT16,
+        .indexAddress = proxyAddress + sizeof(corners),
+        .transformAddress = 0,
+        .primitiveOffset = 0,
+        .primitiveCount = 12
+    } } };
+    std::vector<AccelerationStructure> proxyBlases;
+    buildBottomLevelAccelerationStructures(device, commandPool, scratch, proxyMesh, proxyBlases);
+    proxyBlas = proxyBlases[0];
+
+    if (scratchReserve >= budget) {
+        fprintf(stderr, "Geometry budget of %.1f MB is below the %.1f MB needed to build one chunk, only proxies will be drawn\n",
+            budget / (1024.0 * 1024.0), scratchReserve / (1024.0 * 1024.0));
+    }
+}
+
+inline float boundsDistance(const float* lo, const float* hi, const float* point) {
+    float d2 = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        float d = std::max({ lo[k] - point[k], 0.0f, point[k] - hi[k] });
+        d2 += d * d;
+    }
+    return std::sqrt(d2);
+}
+
+// Picks the resident set for camera, pages chunks in and out and brings
+// topLevel up to date when anything changed: the first update builds it, later
+// ones swap the records of chunks that changed between resident and proxy and
+// commit them, which rebuilds it in place. Returns true when the TLAS changed.
+bool GeometryPager::update(const float* camera, VkDeviceSize maxUploadBytes, TopLevelManager& topLevel) {
+    std::vector<uint32_t> order(pages.size());
+    std::vector<float> distances(pages.size());
+    for (size_t c = 0; c < pages.size(); c++) {
+        order[c] = (uint32_t)c;
+        distances[c] = boundsDistance(chunks.records[c].lo, chunks.records[c].hi, camera);
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return distances[a] < distances[b] || (distances[a] == distances[b] && a < b); });
+
+    // nearest first, skipping chunks that do not fit in what is left
+    std::vector<bool> wanted(pages.size(), false);
+    VkDeviceSize available = budget > scratchReserve ? budget - scratchReserve : 0;
+    for (uint32_t c : order) {
+        if (pages[c].cost <= available) {
+            wanted[c] = true;
+            available -= pages[c].cost;
+        }
+    }
+
+    uint32_t evictions = 0, loads = 0;
+    for (size_t c = 0; c < pages.size(); c++) {
+        if (pages[c].resident && !wanted[c]) {
+            pages[c].blas.destroy(device);
+            destroyBuffer(device, pages[c].buffer);
+            pages[c].buffer = Buffer();
+            pages[c].resident = false;
+            residentBytes -= pages[c].cost;
+            evictions++;
+        }
+    }
+
+    std::vector<uint32_t> loaded;
+    std::vector<std::vector<TriangleGeometry>> meshes;
+    VkDeviceSize uploadBytes = 0;
+    for (uint32_t c : order) {
+        if (!wanted[c] || pages[c].resident) continue;
+        const ChunkRecord& record = chunks.records[c];
+        if (!loaded.empty() && uploadBytes + record.size > maxUploadBytes) break;
+        createBuffer(device, record.size, pages[c].buffer,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        uploader->upload(pages[c].buffer, 0, chunks.data(c), record.size);
+        meshes.push_back({ geometry(c, getBufferDeviceAddress(device, pages[c].buffer)) });
+        loaded.push_back(c);
+        uploadBytes += record.size;
+    }
+    uploader->wait();
+    if (!loaded.empty()) {
+        std::vector<AccelerationStructure> blases;
+        buildBottomLevelAccelerationStructures(device, commandPool, scratch, meshes, blases);
+        for (size_t i = 0; i < loaded.size(); i++) {
+            pages[loaded[i]].blas = blases[i];
+            pages[loaded[i]].resident = true;
+            residentBytes += pages[loaded[i]].cost;
+        }
+        loads = (uint32_t)loaded.size();
+    }
+    bool built = topLevel.tlas.handle != VK_NULL_HANDLE && topLevel.instances.size() == pages.size();
+    if (loads == 0 && evictions == 0 && built) return false;
+    totalLoads += loads;
+    totalEvictions += evictions;
+
+    // resident chunks as themselves, the rest as scaled proxies, which trace and
+    // shade like any other geometry
+    std::vector<VkAccelerationStructureInstanceKHR> instances(pages.size());
+    uint32_t residentCount = 0;
+    for (size_t c = 0; c < pages.size(); c++) {
+        const ChunkRecord& record = chunks.records[c];
+        if (pages[c].resident) {
+            instances[c] = makeInstance(pages[c].blas, IDENTITY_TRANSFORM, (uint32_t)c);
+            residentCount++;
+        } else {
+            float transform[3][4] = {};
+            for (int k = 0; k < 3; k++) {
+                transform[k][k] = std::max(record.hi[k] - record.lo[k], 1e-6f);
+                transform[k][3] = record.lo[k];
+            }
+            instances[c] = makeInstance(proxyBlas, transform, (uint32_t)c);
+        }
+    }
+    if (built) {
+        for (size_t c = 0; c < pages.size(); c++) topLevel.setInstance((uint32_t)c, instances[c]);
+        topLevel.commit(commandPool, scratch);
+    } else {
+        topLevel.build(device, commandPool, scratch, instances);
+    }
+
+    printf("Paged in %u and out %u chunks, %u/%zu resident (%.1f/%.1f MB)\n", loads, evictions, residentCount, pages.size(),
+        residentBytes / (1024.0 * 1024.0), budget / (1024.0 * 1024.0));
+    return true;
+}
+
+void GeometryPager::destroy() {
+    if (!enabled) return;
+    for (PagedChunk& page : pages) {
+        if (!page.resident) continue;
+        page.blas.destroy(device);
+        destroyBuffer(device, page.buffer);
+    }
+    proxyBlas.destroy(device);
+    destroyBuffer(device, proxyBuffer);
+    scratch.destroy(device);
+    chunks.close();
+}
@@ -0,0 +1,82 @@
+// pipecache.h
+// Devon McKee, 2025
+// VkPipelineCache kept in a file between runs so pipelines aren't compiled from
+// scratch on every launch. The file holds the driver's cache data as returned
+// by vkGetPipelineCacheData, whose header names the vendor, device and
+// pipelineCacheUUID it was written with; data written for another device or
+// driver is ignored and the cache starts empty. Expects utils.h to be included
+// first.
+
+#pragma once
+
+#include "scene.h"
+
+struct PipelineCache {
+    Device device;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    std::string path;
+    size_t loadedBytes = 0; // cache data the cache was created with, 0 for a cold start
+    size_t savedBytes = 0;
+    void create(Device device, const char* path);
+    bool save();
+    void destroy();
+};
+
+// Creates the cache from path if it holds data for this device, empty otherwise
+void PipelineCache::create(Device device, const char* path) {
+    this->device = device;
+    this->path = path;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device.physicalDevice, &properties);
+    MappedFile file;
+    bool valid = false;
+    if (file.open(path)) {
+        VkPipelineCacheHeaderVersionOne header;
+        valid = file.size >= sizeof(header);
+        if (valid) {
+            memcpy(&header, file.data, sizeof(header));
+            valid = header.headerSize >= sizeof(header)
+                && header.headerSize <= file.size
+                && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+                && header.vendorID == properties.vendorID
+                && header.deviceID == properties.deviceID
+                && memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+        }
+        if (!valid) fprintf(stderr, "Ignoring pipeline cache '%s', it was written for another device or driver\n", path);
+    }
+    VkPipelineCacheCreateInfo pipelineCacheCI {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = valid ? file.size : 0,
+        .pInitialData = valid ? file.data : nullptr
+    };
+    vkCheck(vkCreatePipelineCache(device.device, &pipelineCacheCI, nullptr, &cache));
+    loadedBytes = valid ? file.size : 0;
+    file.close();
+}
+
+// Writes the cache's data to path, failures only cost the next run a cold start
+bool PipelineCache::save() {
+    size_t size = 0;
+    vkCheck(vkGetPipelineCacheData(device.device, cache, &size, nullptr));
+    std::vector<uint8_t> data(size);
+    if (size == 0 || vkGetPipelineCacheData(device.device, cache, &size, data.data()) != VK_SUCCESS) return false;
+    std::string tmpPath = path + ".tmp";
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(data.data(), 1, size, f) == size;
+    ok &= fclose(f) == 0;
+    std::error_code ec;
+    if (ok) std::filesystem::rename(tmpPath, path, ec);
+    if (!ok || ec) {
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    savedBytes = size;
+    return true;
+}
+
+void PipelineCache::destroy() {
+    if (cache == VK_NULL_HANDLE) return;
+    vkDestroyPipelineCache(device.device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+}
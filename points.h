@@ -0,0 +1,146 @@
+// points.h
+// Devon McKee, 2025
+// Point clouds and particle systems as analytic spheres and disks, traced as
+// AABB geometry through shaders/point.rint instead of being tessellated. The
+// tessellation is kept for comparison.
+
+#pragma once
+
+#include "scene.h"
+#include "mesh.h"
+
+enum PointKind {
+    POINT_SPHERE = 0,
+    POINT_DISK = 1 // facing normal, like a surfel
+};
+
+// Layout of the Points buffer in point.rint (std430)
+struct PointPrimitive {
+    float center[3];
+    float radius;
+    float normal[3];
+    uint32_t kind;
+};
+
+// Axis aligned bounds of a point, VkAabbPositionsKHR layout
+struct PointAabb {
+    float lo[3];
+    float hi[3];
+};
+
+PointAabb pointAabb(const PointPrimitive& point) {
+    PointAabb aabb;
+    for (int k = 0; k < 3; k++) {
+        // a disk reaches radius * sin(angle between its normal and axis k) along the axis
+        float extent = point.kind == POINT_DISK ? point.radius * std::sqrt(std::max(0.0f, 1.0f - point.normal[k] * point.normal[k])) : point.radius;
+        aabb.lo[k] = point.center[k] - extent;
+        aabb.hi[k] = point.center[k] + extent;
+    }
+    return aabb;
+}
+
+std::vector<PointAabb> pointAabbs(const std::vector<PointPrimitive>& points, unsigned numThreads = 0) {
+    std::vector<PointAabb> aabbs(points.size());
+    parallelForBlocks(points.size(), [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; i++) aabbs[i] = pointAabb(points[i]);
+    }, numThreads);
+    return aabbs;
+}
+
+// count points uniformly spread through [lo, hi], with radii between 0.5 and 1
+// times radius and every diskEvery-th one a randomly oriented disk (0 for none)
+std::vector<PointPrimitive> scatterPoints(size_t count, const float lo[3], const float hi[3], float radius, uint32_t diskEvery = 0, uint64_t seed = 1,
+    unsigned numThreads = 0) {
+    std::vector<PointPrimitive> points(count);
+    parallelForBlocks(count, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; i++) {
+            uint64_t h = hashMix(seed ^ hashMix(i));
+            float u[6];
+            for (int k = 0; k < 6; k++) {
+                h = hashMix(h + k);
+                u[k] = (h >> 40) * (1.0f / (1 << 24));
+            }
+            PointPrimitive& point = points[i];
+            for (int k = 0; k < 3; k++) point.center[k] = lo[k] + u[k] * (hi[k] - lo[k]);
+            point.radius = radius * (0.5f + 0.5f * u[3]);
+            // uniform direction from two uniforms
+            float z = 2.0f * u[4] - 1.0f, phi = 6.2831853f * u[5], r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            point.normal[0] = r * std::cos(phi);
+            point.normal[1] = r * std::sin(phi);
+            point.normal[2] = z;
+            point.kind = diskEvery > 0 && i % diskEvery == 0 ? POINT_DISK : POINT_SPHERE;
+        }
+    }, numThreads);
+    return points;
+}
+
+// Triangulates every point into scene, spheres as UV spheres of rings (at
+// least 2) x segments quads, which are single triangles at the poles, and disks
+// as fans of segments triangles
+void tessellatePoints(const std::vector<PointPrimitive>& points, uint32_t rings, uint32_t segments, Scene& scene, unsigned numThreads = 0) {
+    size_t sphereVertices = (size_t)(rings + 1) * segments, sphereIndices = 6 * (size_t)(rings - 1) * segments;
+    size_t diskVertices = segments + 1, diskIndices = 3 * (size_t)segments;
+    std::vector<size_t> vertexOffsets(points.size() + 1, 0), indexOffsets(points.size() + 1, 0);
+    for (size_t i = 0; i < points.size(); i++) {
+        bool disk = points[i].kind == POINT_DISK;
+        vertexOffsets[i + 1] = vertexOffsets[i] + (disk ? diskVertices : sphereVertices);
+        indexOffsets[i + 1] = indexOffsets[i] + (disk ? diskIndices : sphereIndices);
+    }
+    scene = Scene();
+    scene.vertices.resize(3 * vertexOffsets.back());
+    scene.indices.resize(indexOffsets.back());
+    parallelForBlocks(points.size(), [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; i++) {
+            const PointPrimitive& point = points[i];
+            float* v = &scene.vertices[3 * vertexOffsets[i]];
+            uint32_t* index = &scene.indices[indexOffsets[i]];
+            uint32_t base = (uint32_t)vertexOffsets[i];
+            if (point.kind == POINT_DISK) {
+                // tangent frame around the normal
+                const float* n = point.normal;
+                float t[3] = { 1.0f, 0.0f, 0.0f };
+                if (std::fabs(n[0]) > 0.9f) t[0] = 0.0f, t[1] = 1.0f;
+                float d = t[0] * n[0] + t[1] * n[1] + t[2] * n[2], length = 0.0f;
+                for (int k = 0; k < 3; k++) {
+                    t[k] -= d * n[k];
+                    length += t[k] * t[k];
+                }
+                for (int k = 0; k < 3; k++) t[k] /= std::sqrt(length);
+                float b[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+                for (int k = 0; k < 3; k++) v[k] = point.center[k];
+                for (uint32_t s = 0; s < segments; s++) {
+                    float phi = 6.2831853f * s / segments;
+                    for (int k = 0; k < 3; k++) v[3 * (s + 1) + k] = point.center[k] + point.radius * (std::cos(phi) * t[k] + std::sin(phi) * b[k]);
+                    uint32_t triangle[3] = { base, base + 1 + s, base + 1 + (s + 1) % segments };
+                    memcpy(&index[3 * s], triangle, sizeof(triangle));
+                }
+            } else {
+                for (uint32_t r = 0; r <= rings; r++) {
+                    float theta = 3.14159265f * r / rings;
+                    for (uint32_t s = 0; s < segments; s++) {
+                        float phi = 6.2831853f * s / segments;
+                        float direction[3] = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+                        for (int k = 0; k < 3; k++) v[3 * (r * segments + s) + k] = point.center[k] + point.radius * direction[k];
+                    }
+                }
+                for (uint32_t r = 0; r < rings; r++) {
+                    for (uint32_t s = 0; s < segments; s++) {
+                        uint32_t i0 = base + r * segments + s, i1 = base + r * segments + (s + 1) % segments;
+                        uint32_t i2 = i1 + segments, i3 = i0 + segments;
+                        // i0 and i1 coincide on the first ring, i2 and i3 on the last
+                        if (r > 0) {
+                            uint32_t triangle[3] = { i0, i1, i2 };
+                            memcpy(index, triangle, sizeof(triangle));
+                            index += 3;
+                        }
+                        if (r + 1 < rings) {
+                            uint32_t triangle[3] = { i0, i2, i3 };
+                            memcpy(index, triangle, sizeof(triangle));
+                            index += 3;
+                        }
+                    }
+                }
+            }
+        }
+    }, numThreads);
+}
@@ -7,6 +7,10 @@
 #include <string>
 #include <limits>
 #include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include "volk/volk.h"
 #include <GLFW/glfw3.h>
@@ -18,40 +22,265 @@
 #include <obj/tiny_obj_loader.h>
 
 #include "utils.h"
+#include "accel.h"
+#include "scene.h"
+#include "mesh.h"
+#include "gltf.h"
+#include "tlas.h"
+#include "pager.h"
+#include "ascache.h"
+#include "astune.h"
+#include "points.h"
+#include "pipecache.h"
 
 const int WINDOW_WIDTH = 800;
 const int WINDOW_HEIGHT = 600;
 
-struct Scene {
-    std::vector<float> vertices;
-    std::vector<float> normals;
-    std::vector<float> texcoords;
-    std::vector<float> colors;
-    std::vector<uint32_t> indices;
+struct Options {
+    const char* objFile = "teapot.obj";
+    bool tinyobj = false; // use the single-threaded tinyobj reader instead of loadObjParallel
+    bool sceneCache = true; // read/write <objFile>.rtscene next to the source
+    bool dedup = true; // turn repeated OBJ shapes into instances of one mesh, see dedupShapes
+    bool weld = true; // weld vertices into a single index stream, see weldScene
+    bool reorder = false; // sort triangles along a Morton curve (timed against the loaded order with --bench-frames), see reorderScene and compareReorder
+    uint32_t benchFrames = 0; // render this many frames, report trace throughput and exit
+    bool compact = true; // upload 16-bit indices/positions when possible, see encodeGeometry
+    double positionTolerance = 0.0; // max 16-bit position error relative to the scene diagonal, 0 keeps float32
+    double splitGrowth = 0.0; // pre-split long, thin triangles, adding at most this fraction of triangles, see splitTriangles
+    uint32_t partitions = 1; // split the mesh into this many spatial clusters with one BLAS each, see partitionScene
+    uint32_t pageBudgetMb = 0; // page geometry chunks under this device memory budget, see GeometryPager
+    bool serialStartup = false; // read the scene on the main thread after initialization, for comparison
+    const char* asCacheDirectory = "rtas_cache"; // serialized BLASes keyed by content, nullptr to always build, see AccelerationStructureCache
+    bool compactBlas = true; // build BLASes with ALLOW_COMPACTION and copy them into compacted ones, see compactAccelerationStructures
+    bool hostBuild = false; // build BLASes on the CPU through deferred host operations (timed against a device build with --bench-frames), see buildBottomLevelAccelerationStructuresOnHost
+    bool animate = false; // deform the OBJ scene's geometry transform every frame, refit its BLASes and update the TLAS, see updateDynamicBlases
+    uint32_t instances = 0; // replicate the scene's instances up to this many TLAS instances, see replicateInstances
+    const char* asPolicyFile = "rtas_policy.txt"; // BLAS build flags per mesh class, see BuildPolicy
+    bool autotune = false; // time every candidate in BUILD_FLAG_CANDIDATES and write the winners to asPolicyFile, see autotuneBuildFlags
+    uint32_t points = 0; // scatter this many spheres and disks through the scene, traced as AABBs by point.rint, see uploadPoints
+    bool comparePoints = false; // also build the points as triangles and compare memory and trace time, see comparePointGeometry
+    uint32_t movingInstances = 0; // move this many instances every frame, updating only their TLAS records, see moveInstances
+    uint32_t scratchBudgetMb = 0; // cap BLAS build scratch, splitting OBJ meshes that need more (others warn), see buildBottomLevelAccelerationStructuresWithinBudget
+    uint32_t buildBudgetMb = 0; // cap scratch plus the not yet compacted BLASes during BLAS builds, likewise
+    const char* pipelineCacheFile = "rt_pipeline.cache"; // VkPipelineCache data kept between runs, nullptr to compile pipelines from scratch, see PipelineCache
+    uint64_t processFlags() const;
+    BuildBudget buildBudget() const;
+    void parse(int argc, char** argv);
 };
 
+void Options::parse(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--tinyobj") == 0) {
+            tinyobj = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            sceneCache = false;
+        } else if (strcmp(argv[i], "--no-dedup") == 0) {
+            dedup = false;
+        } else if (strcmp(argv[i], "--no-weld") == 0) {
+            weld = false;
+        } else if (strcmp(argv[i], "--reorder") == 0) {
+            reorder = true;
+        } else if (strcmp(argv[i], "--bench-frames") == 0 && i + 1 < argc) {
+            benchFrames = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-compact") == 0) {
+            compact = false;
+        } else if (strcmp(argv[i], "--position-tolerance") == 0 && i + 1 < argc) {
+            positionTolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--presplit") == 0 && i + 1 < argc) {
+            splitGrowth = std::max(0.0, atof(argv[++i]));
+        } else if (strcmp(argv[i], "--partitions") == 0 && i + 1 < argc) {
+            partitions = (uint32_t)std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--page-budget") == 0 && i + 1 < argc) {
+            pageBudgetMb = (uint32_t)std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--serial-startup") == 0) {
+            serialStartup = true;
+        } else if (strcmp(argv[i], "--as-cache") == 0 && i + 1 < argc) {
+            asCacheDirectory = argv[++i];
+        } else if (strcmp(argv[i], "--no-as-cache") == 0) {
+            asCacheDirectory = nullptr;
+        } else if (strcmp(argv[i], "--no-blas-compaction") == 0) {
+            compactBlas = false;
+        } else if (strcmp(argv[i], "--host-build") == 0) {
+            hostBuild = true;
+        } else if (strcmp(argv[i], "--animate") == 0) {
+            animate = true;
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            instances = (uint32_t)std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--as-policy") == 0 && i + 1 < argc) {
+            asPolicyFile = argv[++i];
+        } else if (strcmp(argv[i], "--autotune") == 0) {
+            autotune = true;
+        } else if (strcmp(argv[i], "--points") == 0 && i + 1 < argc) {
+            points = (uint32_t)std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--compare-points") == 0) {
+            comparePoints = true;
+        } else if (strcmp(argv[i], "--move-instances") == 0 && i + 1 < argc) {
+            movingInstances = (uint32_t)std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--scratch-budget") == 0 && i + 1 < argc) {
+            scratchBudgetMb = (uint32_t)std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--build-budget") == 0 && i + 1 < argc) {
+            buildBudgetMb = (uint32_t)std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--pipeline-cache") == 0 && i + 1 < argc) {
+            pipelineCacheFile = argv[++i];
+        } else if (strcmp(argv[i], "--no-pipeline-cache") == 0) {
+            pipelineCacheFile = nullptr;
+        } else if (argv[i][0] != '-') {
+            objFile = argv[i];
+        } else {
+            fprintf(stderr, "Unknown option '%s'!\n", argv[i]);
+            fprintf(stderr, "Usage: rt [--tinyobj] [--no-cache] [--no-dedup] [--no-weld] [--reorder] [--bench-frames N] [--no-compact] [--position-tolerance T] [--presplit G] [--partitions N] [--page-budget MB] [--serial-startup] [--as-cache DIR] [--no-as-cache] [--no-blas-compaction] [--host-build] [--animate] [--instances N] [--as-policy FILE] [--autotune] [--points N] [--compare-points] [--move-instances N] [--scratch-budget MB] [--build-budget MB] [--pipeline-cache FILE] [--no-pipeline-cache] [file.obj|file.rtscene|file.glb]\n");
+            exit(1);
+        }
+    }
+}
+
+uint64_t Options::processFlags() const {
+    // the pager's chunk file holds no instances
+    bool dedupShapes = dedup && pageBudgetMb == 0;
+    return (weld ? MESH_PROCESS_WELD : 0) | (reorder ? MESH_PROCESS_REORDER : 0) | (dedupShapes ? MESH_PROCESS_DEDUP : 0);
+}
+
+BuildBudget Options::buildBudget() const {
+    return { .scratch = (VkDeviceSize)scratchBudgetMb << 20, .peak = (VkDeviceSize)buildBudgetMb << 20 };
+}
+
+// Named spans of startup work on the main and loader threads, relative to launch
+struct StartupTimeline {
+    struct Span {
+        const char* name;
+        const char* thread;
+        double beginMs;
+        double endMs;
+    };
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    std::vector<Span> spans;
+    double waitMs = 0.0; // main thread presenting placeholders until the scene was read
+    double now() const { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); }
+    template <typename F> void run(const char* name, const char* thread, F f);
+    void print();
+};
+
+template <typename F>
+void StartupTimeline::run(const char* name, const char* thread, F f) {
+    double beginMs = now();
+    f();
+    double endMs = now();
+    std::lock_guard<std::mutex> lock(mutex);
+    spans.push_back({ name, thread, beginMs, endMs });
+}
+
+// The critical path is walked back from the last span: each step is the span on
+// either thread that finished last before the current one started
+void StartupTimeline::print() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) { return a.beginMs < b.beginMs; });
+    std::vector<bool> critical(spans.size(), false);
+    size_t last = 0;
+    for (size_t i = 0; i < spans.size(); i++) {
+        if (spans[i].endMs > spans[last].endMs) last = i;
+    }
+    for (size_t current = last; !spans.empty();) {
+        critical[current] = true;
+        size_t previous = spans.size();
+        for (size_t i = 0; i < spans.size(); i++) {
+            if (!critical[i] && spans[i].endMs <= spans[current].beginMs + 0.5 && (previous == spans.size() || spans[i].endMs > spans[previous].endMs)) previous = i;
+        }
+        if (previous == spans.size()) break;
+        current = previous;
+    }
+    printf("Startup timeline (ms since launch, * on the critical path):\n");
+    for (size_t i = 0; i < spans.size(); i++) {
+        printf("  %c %-6s %-28s %9.2f - %9.2f (%.2f ms)\n", critical[i] ? '*' : ' ', spans[i].thread, spans[i].name, spans[i].beginMs, spans[i].endMs, spans[i].endMs - spans[i].beginMs);
+    }
+    printf("  main thread waited %.2f ms for the scene\n", waitMs);
+}
+
 struct Context {
+    Options options;
     GLFWwindow* window;
     VkInstance instance;
     Device device;
     VkCommandPool commandPool;
+    Uploader uploader;
     VkSurfaceKHR surface;
     Swapchain swapchain;
-    VkAccelerationStructureKHR accelerationStructure;
+    std::vector<AccelerationStructure> blases;
+    TopLevelManager topLevel; // TLAS and mapped instance buffer, the pager builds its own into them
+    ScratchArena scratch; // shared by every BLAS and TLAS build outside the pager
     VkDescriptorSetLayout rtDescriptorSetLayout;
     VkDescriptorPool rtDescriptorPool;
     VkDescriptorSet rtDescriptorSet;
     VkPipelineLayout rtPipelineLayout;
     VkPipeline rtPipeline;
+    PipelineCache pipelineCache; // unused (VK_NULL_HANDLE) without options.pipelineCacheFile
     ShaderBindingTable rtSBT;
     Scene scene;
+    Scene unreorderedScene; // scene as it was before reorderScene when benchmarking --reorder, see compareReorder
+    SceneCache sceneCache; // open while scene's positions and indices are read straight from it, see readObjScene
     Buffer vertexBuffer;
     Buffer indexBuffer;
-    Buffer accelerationBuffer;
+    Buffer transformBuffer;
+    VkFormat vertexFormat;
+    VkDeviceSize vertexStride;
+    VkIndexType indexType;
+    bool hasTransform;
+    std::vector<std::vector<TriangleGeometry>> meshes; // geometries of each BLAS
+    std::vector<uint64_t> meshHashes; // content hash of each BLAS's inputs, when the AS cache is used
+    AccelerationStructureCache asCache;
+    BuildPolicy buildPolicy; // BLAS build flags by mesh class, from options.asPolicyFile or autotuneBuildFlags
+    bool hostBuild = false; // options.hostBuild on a device with accelerationStructureHostCommands
+    CompactGeometry hostGeometry; // encoded geometry kept on the host for host builds
+    std::vector<std::vector<TriangleGeometry>> hostMeshes; // meshes with host pointers into hostGeometry
+    std::vector<MeshInstance> meshInstances; // TLAS instances of meshes
+    std::vector<PointPrimitive> points; // procedural spheres and disks, instanced after meshInstances
+    Buffer pointBuffer; // points as read by point.rint, never empty as its descriptor is always in use
+    Buffer aabbBuffer;
+    AccelerationStructure pointBlas;
+    uint32_t pointSbtOffset = 1; // the procedural hit group, 0 while pointBlas holds the tessellated points
+    float sceneLo[3] = { 0.0f, 0.0f, 0.0f }; // world space bounds of meshInstances
+    float sceneHi[3] = { 0.0f, 0.0f, 0.0f };
+    float baseTransform[3][4]; // encoded -> scene space, what transformBuffer holds when not animating
+    std::vector<DynamicBlas> dynamicBlases; // one per partition with --animate
+    RefitPolicy refitPolicy;
+    RefitStats refitTotals;
+    uint32_t animatedFrames = 0;
+    std::chrono::steady_clock::time_point animationStart;
+    std::vector<ScenePartition> partitions; // read by prepareScene, one BLAS each
+    GlbScene glb;
+    GeometryPager pager;
+    float cameraPosition[3] = { 0.0f, 0.0f, -1.0f }; // ray origin in gen.rgen
+    Image outputImage; // written by gen.rgen, blitted to the swapchain
+    VkSemaphore imageAvailable;
+    VkSemaphore renderFinished;
+    StartupTimeline timeline;
+    std::string loadError; // why prepareScene failed, reported by main once the loader is joined
     void initialize();
-    void loadScene();
+    bool prepareScene();
+    void uploadScene();
+    bool readObjScene();
+    bool readChunkFile();
+    void uploadObjScene();
+    void createPager();
+    void uploadGlbScene();
+    void uploadPoints();
+    void loadBuildPolicy();
+    std::vector<VkBuildAccelerationStructureFlagsKHR> meshBuildFlags() const;
+    void autotuneBuildFlags();
+    std::vector<float> benchmarkOrigins() const;
+    double timeTraceRays(const std::vector<float>& origins);
     void createAccelerationStructure();
+    void comparePointGeometry();
+    void compareReorder();
+    BuildStats buildTopLevel();
     void createRTPipeline();
+    void writeAccelerationStructureDescriptor();
+    void updateGeometry();
+    void animateGeometry();
+    void moveInstances();
+    uint32_t acquireImage();
+    void present(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void renderPlaceholder();
     void render();
     void destroy();
 };
@@ -183,10 +412,19 @@ void Context::initialize() {
         .rayTraversalPrimitiveCulling = VK_TRUE
     };
 
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR supportedAccelerationStructureFeatures { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
+    VkPhysicalDeviceFeatures2 supportedFeatures { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, .pNext = &supportedAccelerationStructureFeatures };
+    vkGetPhysicalDeviceFeatures2(device.physicalDevice, &supportedFeatures);
+    hostBuild = options.hostBuild && supportedAccelerationStructureFeatures.accelerationStructureHostCommands;
+    if (options.hostBuild && !hostBuild) {
+        fprintf(stderr, "Device does not support host acceleration structure commands, building on the device\n");
+    }
+
     VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
         .pNext = &rayTracingPipelineFeatures,
-        .accelerationStructure = VK_TRUE
+        .accelerationStructure = VK_TRUE,
+        .accelerationStructureHostCommands = hostBuild ? VK_TRUE : VK_FALSE
     };
 
     VkPhysicalDeviceFeatures deviceFeatures {
@@ -219,6 +457,8 @@ void Context::initialize() {
         .queueFamilyIndex = queueFamilyId
     };
     vkCheck(vkCreateCommandPool(device.device, &poolCI, nullptr, &commandPool));
+    uploader.create(device, commandPool);
+    topLevel.device = device;
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
@@ -228,162 +468,844 @@ void Context::initialize() {
     vkCheck(glfwCreateWindowSurface(instance, window, nullptr, &surface));
 
     swapchain.create(device, window, surface);
+
+    VkSemaphoreCreateInfo semaphoreCI { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    vkCheck(vkCreateSemaphore(device.device, &semaphoreCI, nullptr, &imageAvailable));
+    vkCheck(vkCreateSemaphore(device.device, &semaphoreCI, nullptr, &renderFinished));
+
+    createImage(device, swapchain.extent, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, outputImage);
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    imageBarrier(commandBuffer, outputImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+        0, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    endSingleTimeCommands(device, commandPool, commandBuffer);
 }
 
-void Context::loadScene() {
-    const char* objFile = "teapot.obj";
-    tinyobj::ObjReaderConfig readerConfig;
-    readerConfig.mtl_search_path = "./";
-    readerConfig.triangulate = true;
-    tinyobj::ObjReader reader;
-    if (!reader.ParseFromFile(objFile, readerConfig)) {
-        if (!reader.Error().empty()) {
-            fprintf(stderr, "TinyObjReader: %s\n", reader.Error().c_str());
+// Reads the scene into host memory without touching the device, so it can run
+// on a loader thread while the instance, device and pipeline are created. On
+// failure it sets loadError rather than exiting under the main thread.
+bool Context::prepareScene() {
+    if (isGlbFile(options.objFile)) {
+        if (!glb.open(options.objFile)) {
+            loadError = "Failed to load '" + std::string(options.objFile) + "'!";
+            return false;
+        }
+    } else if (options.pageBudgetMb > 0) {
+        return readChunkFile();
+    } else {
+        if (!readObjScene()) return false;
+        if (options.splitGrowth > 0.0 && !scene.instanceShapes.empty()) {
+            printf("Not pre-splitting triangles, the scene's meshes are instanced\n");
+        } else if (options.splitGrowth > 0.0) {
+            printSplitStats(splitTriangles(scene, options.splitGrowth));
+        }
+        partitions = sceneCache.header ? partitionSceneCache(sceneCache) : partitionScene(scene, options.partitions);
+        if (partitions.size() > 1) {
+            printScenePartitions(partitions);
         }
     }
-    if (!reader.Warning().empty()) {
-        fprintf(stderr, "TinyObjReader: %s\n", reader.Warning().c_str());
+    return true;
+}
+
+// Moves what prepareScene read onto the device and describes the BLAS inputs
+void Context::uploadScene() {
+    if (isGlbFile(options.objFile)) {
+        uploadGlbScene();
+    } else if (options.pageBudgetMb > 0) {
+        createPager();
+    } else {
+        uploadObjScene();
+    }
+    if (options.instances > meshInstances.size() && !pager.enabled) {
+        auto replicateStart = std::chrono::steady_clock::now();
+        meshInstances = replicateInstances(meshInstances, options.instances, sceneLo, sceneHi);
+        double replicateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - replicateStart).count();
+        printf("Replicated the scene to %zu instances of %zu meshes in %.2f ms\n", meshInstances.size(), meshes.size(), replicateMs);
     }
-    tinyobj::attrib_t attrib = reader.GetAttrib();
-    scene.vertices = attrib.vertices;
-    scene.normals = attrib.normals;
-    scene.texcoords = attrib.texcoords;
-    scene.colors = attrib.colors;
-    std::vector<tinyobj::shape_t> shapes = reader.GetShapes();
-    for (uint32_t i = 0; i < shapes.size(); i++) {
-        for (uint32_t j = 0; j < shapes[i].mesh.indices.size(); j++) {
-            scene.indices.push_back(shapes[i].mesh.indices[j].vertex_index); // FIXME: coalesce normal and texcoord vertices together so there's one index, otherwise they won't work
+    uploadPoints();
+}
+
+// Scatters options.points spheres and disks (every fourth point) through the
+// scene bounds, sized at a fifth of their average spacing, and uploads them with
+// their AABBs. pointBuffer is created and written even without points, the
+// procedural hit group's descriptor has to be valid.
+void Context::uploadPoints() {
+    if (options.points > 0 && pager.enabled) {
+        printf("Not adding points, the paged TLAS only holds the pager's instances\n");
+    } else if (options.points > 0) {
+        float lo[3], hi[3];
+        float extent = 0.0f;
+        for (int k = 0; k < 3; k++) extent = std::max(extent, sceneHi[k] - sceneLo[k]);
+        for (int k = 0; k < 3; k++) {
+            lo[k] = extent > 0.0f ? sceneLo[k] : -1.0f;
+            hi[k] = extent > 0.0f ? sceneHi[k] : 1.0f;
         }
+        if (extent <= 0.0f) extent = 2.0f;
+        points = scatterPoints(options.points, lo, hi, 0.2f * extent / std::cbrt((float)options.points), 4);
+    }
+    createBuffer(device, std::max<size_t>(points.size(), 1) * sizeof(PointPrimitive), pointBuffer,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    if (!points.empty()) {
+        std::vector<PointAabb> aabbs = pointAabbs(points);
+        createBuffer(device, aabbs.size() * sizeof(PointAabb), aabbBuffer,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+        uploader.upload(pointBuffer, 0, points.data(), points.size() * sizeof(PointPrimitive));
+        uploader.upload(aabbBuffer, 0, aabbs.data(), aabbs.size() * sizeof(PointAabb));
+        uploader.wait();
+        printf("Scattered %zu points (%.2f MB with their AABBs)\n", points.size(), points.size() * (sizeof(PointPrimitive) + sizeof(PointAabb)) / (1024.0 * 1024.0));
     }
-    printf("Loaded '%s', %d vertices and %d triangles\n", objFile, scene.vertices.size() / 3, scene.indices.size() / 3);
 
-    Buffer stagingBuffer;
-    createBuffer(device, std::max(scene.vertices.size() * sizeof(float), scene.indices.size() * sizeof(uint32_t)), stagingBuffer, 
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, false, false);
+    VkDescriptorBufferInfo pointBufferDescriptor {
+        .buffer = pointBuffer.buffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE
+    };
+    VkWriteDescriptorSet pointBufferWrite {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = rtDescriptorSet,
+        .dstBinding = 3,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &pointBufferDescriptor
+    };
+    vkUpdateDescriptorSets(device.device, 1, &pointBufferWrite, 0, nullptr);
+}
 
-    createBuffer(device, scene.vertices.size() * sizeof(float), vertexBuffer, 
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+// Fills scene from the .rtscene cache or by parsing and processing the OBJ
+bool Context::readObjScene() {
+    const char* objFile = options.objFile;
+    auto loadStart = std::chrono::steady_clock::now();
+    std::string cacheFile = sceneCachePath(objFile);
+    bool fromCache = false;
+    if (isSceneCacheFile(objFile)) {
+        fromCache = sceneCache.open(objFile); // baked offline, no source to validate against
+    } else if (options.sceneCache) {
+        fromCache = sceneCache.open(cacheFile.c_str(), objFile, options.processFlags());
+    }
+    if (fromCache) {
+        // a cached scene that won't be split, encoded, paged or built on the host
+        // is uploaded straight from the mapping, only its instancing is copied
+        bool mapped = options.splitGrowth <= 0.0 && (options.partitions <= 1 || sceneCache.count(SCENE_CACHE_INSTANCE_SHAPES) > 0) && !options.compact
+            && !options.hostBuild && !options.buildBudget().enabled() && options.pageBudgetMb == 0;
+        sceneCache.copyTo(scene, !mapped);
+        if (!mapped) sceneCache.close();
+    } else {
+        bool loaded = !isSceneCacheFile(objFile) && (options.tinyobj ? loadObjTinyObj(objFile, scene) : loadObjParallel(objFile, scene));
+        if (!loaded) {
+            loadError = "Failed to load '" + std::string(objFile) + "'!";
+            return false;
+        }
+        if (options.processFlags() & MESH_PROCESS_DEDUP) {
+            printDedupStats(dedupShapes(scene));
+        } else {
+            scene.shapes.clear();
+        }
+        if (options.weld) {
+            printWeldStats(weldScene(scene));
+        }
+        if (options.reorder) {
+            if (options.benchFrames > 0 && options.pageBudgetMb == 0 && scene.instanceShapes.empty()) unreorderedScene = scene;
+            printReorderStats(reorderScene(scene));
+        }
+        if (options.sceneCache && !writeSceneCache(cacheFile.c_str(), scene, objFile, options.processFlags())) {
+            fprintf(stderr, "Failed to write scene cache '%s'\n", cacheFile.c_str());
+        }
+    }
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+    bool mapped = sceneCache.header != nullptr;
+    size_t numVertices = mapped ? sceneCache.count(SCENE_CACHE_VERTICES) / 3 : scene.vertices.size() / 3;
+    size_t numTriangles = mapped ? sceneCache.count(SCENE_CACHE_INDICES) / 3 : scene.indices.size() / 3;
+    printf("Loaded '%s'%s, %zu vertices and %zu triangles in %.2f ms (%.1f MB of geometry%s, peak RSS %.1f MB)\n", objFile, fromCache ? " from cache" : "",
+        numVertices, numTriangles, loadMs, (mapped ? sceneCache.file.size : sceneBytes(scene)) / (1024.0 * 1024.0), mapped ? " mapped" : "",
+        peakResidentBytes() / (1024.0 * 1024.0));
+    return true;
+}
+
+void Context::uploadObjScene() {
+    // partitions whose BLAS wouldn't build within the budget become several BLASes,
+    // sized as float32 geometry with any flags the build may use
+    BuildBudget budget = options.buildBudget();
+    std::vector<uint32_t> firstPiece; // pieces of each partition, empty when nothing was split
+    if (budget.enabled() && !partitions.empty()) {
+        uint32_t largest = 0;
+        for (const ScenePartition& partition : partitions) largest = std::max(largest, partition.triangleCount);
+        TriangleGeometry geometry {
+            .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+            .vertexAddress = 0,
+            .vertexStride = 3 * sizeof(float),
+            .maxVertex = (uint32_t)(scene.vertices.size() / 3) - 1,
+            .indexType = VK_INDEX_TYPE_UINT32,
+            .indexAddress = 0,
+            .transformAddress = 0,
+            .primitiveOffset = 0,
+            .primitiveCount = largest
+        };
+        std::vector<VkBuildAccelerationStructureFlagsKHR> candidates = { DYNAMIC_BLAS_FLAGS };
+        if (!options.animate) {
+            candidates.assign(std::begin(BUILD_FLAG_CANDIDATES), std::end(BUILD_FLAG_CANDIDATES));
+            if (!options.compactBlas) {
+                for (VkBuildAccelerationStructureFlagsKHR& flags : candidates) flags &= ~VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+            }
+        }
+        uint32_t maxTriangles = maxTrianglesWithinBudget(device, geometry, candidates, budget);
+        size_t before = partitions.size();
+        partitions = splitPartitions(scene, partitions, maxTriangles, firstPiece);
+        if (partitions.size() > before) {
+            printf("Split %zu meshes into %zu of at most %u triangles to build them within the budget\n", before, partitions.size(), maxTriangles);
+        } else {
+            firstPiece.clear();
+        }
+    }
+    // a mapped cached scene is float32 positions and 32-bit indices as stored, not copied to be encoded
+    bool mapped = sceneCache.header != nullptr;
+    CompactGeometry geometry;
+    if (!mapped) {
+        bool allowSnorm16 = options.compact && supportsAccelerationStructureVertexFormat(device, VK_FORMAT_R16G16B16A16_SNORM);
+        bool allowFloat16 = options.compact && supportsAccelerationStructureVertexFormat(device, VK_FORMAT_R16G16B16A16_SFLOAT);
+        geometry = encodeGeometry(scene, options.compact ? options.positionTolerance : 0.0, options.compact, allowSnorm16, allowFloat16);
+        printCompactGeometry(geometry);
+    }
+    const uint8_t* vertexData = mapped ? (const uint8_t*)sceneCache.array<float>(SCENE_CACHE_VERTICES) : geometry.vertices.data();
+    size_t vertexBytes = mapped ? sceneCache.count(SCENE_CACHE_VERTICES) * sizeof(float) : geometry.vertices.size();
+    const uint8_t* indexData = mapped ? (const uint8_t*)sceneCache.array<uint32_t>(SCENE_CACHE_INDICES) : geometry.indices.data();
+    size_t indexBytes = mapped ? sceneCache.count(SCENE_CACHE_INDICES) * sizeof(uint32_t) : geometry.indices.size();
+    uint32_t maxVertex = (uint32_t)(vertexBytes / geometry.vertexStride) - 1;
+    std::vector<uint32_t> instanceShapes = std::move(scene.instanceShapes);
+    std::vector<float> instanceTransforms = std::move(scene.instanceTransforms);
+    scene = Scene(); // only the encoded copy is uploaded, don't keep both on the host
+    switch (geometry.vertexEncoding) {
+        case VERTEX_ENCODING_SNORM16:
+            vertexFormat = VK_FORMAT_R16G16B16A16_SNORM;
+            break;
+        case VERTEX_ENCODING_FLOAT16:
+            vertexFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+            break;
+        default:
+            vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+            break;
+    }
+    vertexStride = geometry.vertexStride;
+    indexType = geometry.indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    hasTransform = geometry.vertexEncoding != VERTEX_ENCODING_FLOAT32 || options.animate; // animation writes its deformation into the transform
+    memcpy(baseTransform, geometry.transform, sizeof(baseTransform));
 
-    createBuffer(device, scene.indices.size() * sizeof(uint32_t), indexBuffer, 
+    createBuffer(device, vertexBytes, vertexBuffer, 
         VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
-    void* data;
-    vkMapMemory(device.device, stagingBuffer.memory, 0, scene.vertices.size() * sizeof(float), 0, &data);
-    memcpy(data, scene.vertices.data(), scene.vertices.size() * sizeof(float));
-    vkUnmapMemory(device.device, stagingBuffer.memory);
+    createBuffer(device, indexBytes, indexBuffer, 
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
-    copyBuffer(device, commandPool, stagingBuffer, vertexBuffer, scene.vertices.size() * sizeof(float));
+    createBuffer(device, sizeof(VkTransformMatrixKHR), transformBuffer, 
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+
+    auto uploadStart = std::chrono::steady_clock::now();
+    VkDeviceSize uploadedBefore = uploader.bytesUploaded;
+    uploader.upload(vertexBuffer, 0, vertexData, vertexBytes);
+    uploader.upload(indexBuffer, 0, indexData, indexBytes);
+    uploader.upload(transformBuffer, 0, geometry.transform, sizeof(VkTransformMatrixKHR));
+    uploader.wait();
+    double uploadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - uploadStart).count();
+    double uploadMb = (uploader.bytesUploaded - uploadedBefore) / (1024.0 * 1024.0);
+    printf("Uploaded %.2f MB in %.2f ms (%.1f MB/s)\n", uploadMb, uploadSeconds * 1000.0, uploadMb / uploadSeconds);
+    if (options.benchFrames > 0) {
+        // benchmark runs also time the same upload through a staging buffer and a queue wait per buffer
+        auto stagedStart = std::chrono::steady_clock::now();
+        uploadThroughStagingBuffer(device, commandPool, vertexBuffer, vertexData, vertexBytes);
+        uploadThroughStagingBuffer(device, commandPool, indexBuffer, indexData, indexBytes);
+        double stagedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stagedStart).count();
+        printf("Upload through a staging buffer per buffer: %.2f ms, the ring takes %.2fx that\n", stagedMs, uploadSeconds * 1000.0 / std::max(stagedMs, 1e-3));
+    }
 
-    vkMapMemory(device.device, stagingBuffer.memory, 0, scene.indices.size() * sizeof(uint32_t), 0, &data);
-    memcpy(data, scene.indices.data(), scene.indices.size() * sizeof(uint32_t));
-    vkUnmapMemory(device.device, stagingBuffer.memory);
+    // one BLAS per partition, each reading its range of the shared index buffer
+    VkDeviceAddress transformBufferAddress = hasTransform ? getBufferDeviceAddress(device, transformBuffer) : 0;
+    // instanced meshes are in their shape's local space, the scene is only where the instances put them
+    for (int k = 0; k < 3; k++) {
+        sceneLo[k] = INFINITY;
+        sceneHi[k] = -INFINITY;
+        for (size_t p = 0; instanceShapes.empty() && p < partitions.size(); p++) {
+            sceneLo[k] = std::min(sceneLo[k], partitions[p].lo[k]);
+            sceneHi[k] = std::max(sceneHi[k], partitions[p].hi[k]);
+        }
+    }
+    // the meshes a shape became, more than one if it was split for the build budget
+    auto shapeMeshes = [&](uint32_t shape, uint32_t& first, uint32_t& end) {
+        first = firstPiece.empty() ? shape : firstPiece[shape];
+        end = firstPiece.empty() ? shape + 1 : firstPiece[shape + 1];
+    };
+    for (size_t i = 0; i < instanceShapes.size(); i++) {
+        const float (*transform)[4] = (const float (*)[4])&instanceTransforms[12 * i];
+        uint32_t first, end;
+        shapeMeshes(instanceShapes[i], first, end);
+        for (uint32_t m = first; m < end; m++) {
+            float lo[3], hi[3];
+            transformBounds(transform, partitions[m].lo, partitions[m].hi, lo, hi);
+            for (int k = 0; k < 3; k++) {
+                sceneLo[k] = std::min(sceneLo[k], lo[k]);
+                sceneHi[k] = std::max(sceneHi[k], hi[k]);
+            }
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        if (sceneLo[k] > sceneHi[k]) sceneLo[k] = sceneHi[k] = 0.0f; // no geometry
+    }
+    bool buildOnHost = hostBuild && !options.animate; // refits and in-place rebuilds need device built sizes
+    if (buildOnHost) hostGeometry = std::move(geometry); // vertexData and indexData move along with it
+    const CompactGeometry& encoded = buildOnHost ? hostGeometry : geometry;
+    uint64_t verticesHash = options.asCacheDirectory ? hashBytesParallel(vertexData, vertexBytes) : 0;
+    for (const ScenePartition& partition : partitions) {
+        TriangleGeometry mesh {
+            .vertexFormat = vertexFormat,
+            .vertexAddress = getBufferDeviceAddress(device, vertexBuffer),
+            .vertexStride = vertexStride,
+            .maxVertex = maxVertex,
+            .indexType = indexType,
+            .indexAddress = getBufferDeviceAddress(device, indexBuffer),
+            .transformAddress = transformBufferAddress,
+            .primitiveOffset = (uint32_t)(3 * (size_t)partition.firstTriangle * encoded.indexSize),
+            .primitiveCount = partition.triangleCount
+        };
+        meshes.push_back({ mesh });
+        if (options.asCacheDirectory) {
+            uint64_t h = hashBytes(indexData + mesh.primitiveOffset, 3 * (size_t)partition.triangleCount * encoded.indexSize, verticesHash);
+            if (hasTransform) h = hashBytes(encoded.transform, sizeof(encoded.transform), h);
+            meshHashes.push_back(accelerationStructureContentHash(h, meshes.back()));
+        }
+        if (buildOnHost) {
+            mesh.vertexAddress = (VkDeviceAddress)(uintptr_t)hostGeometry.vertices.data();
+            mesh.indexAddress = (VkDeviceAddress)(uintptr_t)hostGeometry.indices.data();
+            mesh.transformAddress = hasTransform ? (VkDeviceAddress)(uintptr_t)hostGeometry.transform : 0;
+            hostMeshes.push_back({ mesh });
+        }
+        if (instanceShapes.empty()) {
+            MeshInstance instance = { (uint32_t)meshInstances.size() };
+            memcpy(instance.transform, IDENTITY_TRANSFORM, sizeof(instance.transform));
+            meshInstances.push_back(instance);
+        }
+    }
+    sceneCache.close(); // uploaded and hashed, nothing reads the mapping after this
+    // a deduplicated scene places its meshes, one per shape, through its own instances
+    for (size_t i = 0; i < instanceShapes.size(); i++) {
+        uint32_t first, end;
+        shapeMeshes(instanceShapes[i], first, end);
+        for (uint32_t m = first; m < end; m++) {
+            MeshInstance instance = { m };
+            memcpy(instance.transform, &instanceTransforms[12 * i], sizeof(instance.transform));
+            meshInstances.push_back(instance);
+        }
+    }
+}
 
-    copyBuffer(device, commandPool, stagingBuffer, indexBuffer, scene.indices.size() * sizeof(uint32_t));
+// Pages partitions in from <objFile>.rtchunks instead of uploading the whole
+// scene, a valid chunk file is used without reading the scene at all
+bool Context::readChunkFile() {
+    const char* objFile = options.objFile;
+    std::string chunkFile = chunkFilePath(objFile);
+    uint32_t requestedChunks = options.partitions > 1 ? options.partitions : 0;
+    if (!pager.chunks.open(chunkFile.c_str(), objFile, options.processFlags(), requestedChunks)) {
+        if (!readObjScene()) return false;
+        if (!scene.instanceShapes.empty()) {
+            loadError = "'" + std::string(objFile) + "' holds instanced meshes, which can't be paged! Bake it with --no-dedup.";
+            return false;
+        }
+        size_t numTriangles = scene.indices.size() / 3;
+        uint32_t numChunks = requestedChunks > 0 ? requestedChunks : (uint32_t)std::max<size_t>(1, (numTriangles + CHUNK_TARGET_TRIANGLES - 1) / CHUNK_TARGET_TRIANGLES);
+        std::vector<ScenePartition> chunkPartitions = partitionScene(scene, numChunks);
+        printScenePartitions(chunkPartitions);
+        bool written = writeChunkFile(chunkFile.c_str(), scene, chunkPartitions, objFile, options.processFlags(), requestedChunks);
+        if (!written || !pager.chunks.open(chunkFile.c_str(), objFile, options.processFlags(), requestedChunks)) {
+            loadError = "Failed to write chunk file '" + chunkFile + "'!";
+            return false;
+        }
+        scene = Scene(); // everything from here on is read from the chunk file
+    }
+    return true;
+}
 
-    destroyBuffer(device, stagingBuffer);
+void Context::createPager() {
+    VkDeviceSize budget = (VkDeviceSize)options.pageBudgetMb << 20;
+    VkDeviceSize heapSize = deviceLocalHeapSize(device);
+    if (budget > heapSize / 10 * 9) {
+        fprintf(stderr, "Geometry budget of %u MB is close to or above the %llu MB device heap\n", options.pageBudgetMb, (unsigned long long)(heapSize >> 20));
+    }
+    printf("Paging %zu chunks from '%s' under a %u MB budget\n", pager.chunks.count(), chunkFilePath(options.objFile).c_str(), options.pageBudgetMb);
+    pager.create(device, commandPool, uploader, budget);
 }
 
-void Context::createAccelerationStructure() {
-    VkDeviceAddress vertexBufferAddress = getBufferDeviceAddress(device, vertexBuffer);
-    VkDeviceAddress indexBufferAddress = getBufferDeviceAddress(device, indexBuffer);
-
-    VkAccelerationStructureGeometryKHR accelerationStructureGeometry {
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-        .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
-        .geometry = {
-            .triangles = {
-                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+// Uploads the buffer views used by triangle positions and indices straight from
+// the mapped file into vertexBuffer, each glTF mesh becomes a BLAS with one
+// geometry per primitive and each node referencing a mesh a TLAS instance
+void Context::uploadGlbScene() {
+    const char* glbFile = options.objFile;
+    auto uploadStart = std::chrono::steady_clock::now();
+    createBuffer(device, std::max<VkDeviceSize>(glb.uploadSize, 1), vertexBuffer,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    for (const GlbUploadRange& range : glb.uploadRanges) {
+        uploader.upload(vertexBuffer, range.uploadOffset, glb.bin + range.binOffset, range.size);
+    }
+    uploader.upload(vertexBuffer, glb.widenedOffset, glb.widenedIndices.data(), glb.widenedIndices.size() * sizeof(uint16_t));
+    uploader.wait();
+
+    VkDeviceAddress bufferAddress = getBufferDeviceAddress(device, vertexBuffer);
+    uint64_t binHash = 0;
+    if (options.asCacheDirectory) {
+        for (const GlbUploadRange& range : glb.uploadRanges) binHash = hashBytes(glb.bin + range.binOffset, range.size, binHash);
+        binHash = hashBytes(glb.widenedIndices.data(), glb.widenedIndices.size() * sizeof(uint16_t), binHash);
+    }
+    std::vector<uint32_t> meshIndex(glb.meshes.size(), NO_INDEX);
+    for (size_t m = 0; m < glb.meshes.size(); m++) {
+        if (glb.meshes[m].primitives.empty()) continue;
+        meshIndex[m] = (uint32_t)meshes.size();
+        std::vector<TriangleGeometry>& geometries = meshes.emplace_back();
+        for (const GlbPrimitive& primitive : glb.meshes[m].primitives) {
+            bool indexed = primitive.indices.count > 0;
+            geometries.push_back({
                 .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
-                .vertexData = { .deviceAddress = vertexBufferAddress },
-                .vertexStride = sizeof(float) * 3,
-                .maxVertex = (uint32_t)(scene.vertices.size() / 3) - 1,
-                .indexType = VK_INDEX_TYPE_UINT32,
-                .indexData = { .deviceAddress = indexBufferAddress },
-                .transformData = { .deviceAddress = 0 }
+                .vertexAddress = bufferAddress + primitive.positions.offset,
+                .vertexStride = primitive.positions.stride,
+                .maxVertex = std::max(primitive.positions.count, 1u) - 1,
+                .indexType = !indexed ? VK_INDEX_TYPE_NONE_KHR : primitive.indices.componentType == GLTF_UNSIGNED_SHORT ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32,
+                .indexAddress = indexed ? bufferAddress + primitive.indices.offset : 0,
+                .transformAddress = 0,
+                .primitiveOffset = 0,
+                .primitiveCount = (indexed ? primitive.indices.count : primitive.positions.count) / 3
+            });
+        }
+        if (options.asCacheDirectory) {
+            // where in the upload the primitives read from tells meshes of the same shape apart
+            uint64_t h = binHash;
+            for (const GlbPrimitive& primitive : glb.meshes[m].primitives) {
+                uint64_t offsets[] = { primitive.positions.offset, primitive.indices.offset };
+                h = hashBytes(offsets, sizeof(offsets), h);
             }
-        },
-        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
-    };
-
-    VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo {
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
-        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-        .geometryCount = 1,
-        .pGeometries = &accelerationStructureGeometry
-    };
+            meshHashes.push_back(accelerationStructureContentHash(h, geometries));
+        }
+    }
+    for (MeshInstance instance : glb.instances) {
+        instance.mesh = meshIndex[instance.mesh];
+        meshInstances.push_back(instance);
+    }
+    glb.bounds(sceneLo, sceneHi);
 
-    uint32_t primitiveCount = (uint32_t)(scene.indices.size() / 3);
+    double uploadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - uploadStart).count();
+    double uploadMb = glb.uploadSize / (1024.0 * 1024.0);
+    printf("Loaded '%s', %zu meshes, %zu instances and %zu triangles, uploaded %.2f MB in %.2f ms (%.1f MB/s)\n", glbFile, meshes.size(), meshInstances.size(),
+        glb.triangleCount(), uploadMb, uploadSeconds * 1000.0, uploadMb / uploadSeconds);
+    glb.close();
+}
 
-    VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
-    vkGetAccelerationStructureBuildSizesKHR(device.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &accelerationStructureBuildGeometryInfo, &primitiveCount, &accelerationStructureBuildSizesInfo);
+// Defaults to the flags every BLAS was built with before the policy, a policy
+// file tuned on this device overrides them per mesh class
+void Context::loadBuildPolicy() {
+    buildPolicy = BuildPolicy(VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+        | (options.compactBlas ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR : 0));
+    if (options.autotune || !buildPolicy.load(device, options.asPolicyFile)) return;
+    printf("Loaded BLAS build policy from '%s':", options.asPolicyFile);
+    for (int c = 0; c < MESH_CLASS_COUNT; c++) {
+        if (buildPolicy.tuned[c]) printf(" %s %s", MESH_CLASS_NAMES[c], buildFlagsString(buildPolicy.flags[c]).c_str());
+    }
+    printf("\n");
+}
 
-    createBuffer(device, accelerationStructureBuildSizesInfo.accelerationStructureSize, accelerationBuffer, 
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+// Build flags of each BLAS from buildPolicy, by the class of its mesh
+std::vector<VkBuildAccelerationStructureFlagsKHR> Context::meshBuildFlags() const {
+    std::vector<VkBuildAccelerationStructureFlagsKHR> flags(meshes.size());
+    for (size_t m = 0; m < meshes.size(); m++) {
+        flags[m] = buildPolicy.flags[meshClass(meshes[m])];
+        if (!options.compactBlas) flags[m] &= ~VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+    }
+    return flags;
+}
 
-    VkAccelerationStructureCreateInfoKHR accelerationStructureCI {
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-        .buffer = accelerationBuffer.buffer,
-        .size = accelerationStructureBuildSizesInfo.accelerationStructureSize,
-        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR
-    };
+// Traces the whole image from each origin (x, y, z triples) in one command
+// buffer, with a barrier between the passes so that they don't overlap
+double Context::timeTraceRays(const std::vector<float>& origins) {
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipelineLayout, 0, 1, &rtDescriptorSet, 0, nullptr);
+    for (size_t i = 0; i + 2 < origins.size(); i += 3) {
+        float origin[4] = { origins[i], origins[i + 1], origins[i + 2], 0.0f };
+        vkCmdPushConstants(commandBuffer, rtPipelineLayout, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, sizeof(origin), origin);
+        vkCmdTraceRaysKHR(commandBuffer, &rtSBT.rgenSBTEntry, &rtSBT.missSBTEntry, &rtSBT.hitGroupSBTEntry, &rtSBT.callableSBTEntry,
+            swapchain.extent.width, swapchain.extent.height, 1);
+        imageBarrier(commandBuffer, outputImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+    }
+    auto traceStart = std::chrono::steady_clock::now();
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - traceStart).count();
+}
 
-    vkCheck(vkCreateAccelerationStructureKHR(device.device, &accelerationStructureCI, nullptr, &accelerationStructure));
+// Ray origins for timeTraceRays, TUNE_CAMERA_OFFSETS around the scene
+// TUNE_TRACE_REPEATS times
+std::vector<float> Context::benchmarkOrigins() const {
+    float center[3];
+    float extent = 1e-3f;
+    for (int k = 0; k < 3; k++) {
+        center[k] = 0.5f * (sceneLo[k] + sceneHi[k]);
+        extent = std::max(extent, sceneHi[k] - sceneLo[k]);
+    }
+    std::vector<float> origins;
+    for (uint32_t r = 0; r < TUNE_TRACE_REPEATS; r++) {
+        for (const float* offset : TUNE_CAMERA_OFFSETS) {
+            origins.push_back(center[0] + offset[0] * extent);
+            origins.push_back(center[1] + offset[1] * extent);
+            origins.push_back(sceneLo[2] + offset[2] * extent);
+        }
+    }
+    return origins;
+}
 
-    VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo  {
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
-        .accelerationStructure = accelerationStructure
-    };
-    VkDeviceAddress accelerationStructureDeviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device.device, &accelerationStructureDeviceAddressInfo);
-    
-    Buffer scratchBuffer;
-    createBuffer(device, accelerationStructureBuildSizesInfo.buildScratchSize, scratchBuffer, 
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+// Builds the meshes of each class in the scene with every candidate in
+// BUILD_FLAG_CANDIDATES (the other classes with the policy so far) and measures
+// the build and compaction time, the memory the class's BLASes end up taking
+// and the time to trace from TUNE_CAMERA_OFFSETS. The winners replace
+// buildPolicy and are saved to options.asPolicyFile.
+void Context::autotuneBuildFlags() {
+    if (pager.enabled || (options.animate && !isGlbFile(options.objFile))) {
+        printf("Not autotuning BLAS build flags, paged and animated scenes build with fixed flags\n");
+        return;
+    }
+    std::vector<float> origins = benchmarkOrigins();
+
+    printf("Autotuning BLAS build flags over %zu meshes:\n", meshes.size());
+    for (int c = 0; c < MESH_CLASS_COUNT; c++) {
+        std::vector<uint32_t> members, others;
+        std::vector<std::vector<TriangleGeometry>> memberMeshes, otherMeshes;
+        std::vector<VkBuildAccelerationStructureFlagsKHR> currentFlags = meshBuildFlags(), otherFlags;
+        for (uint32_t m = 0; m < meshes.size(); m++) {
+            if (meshClass(meshes[m]) == c) {
+                members.push_back(m);
+                memberMeshes.push_back(meshes[m]);
+            } else {
+                others.push_back(m);
+                otherMeshes.push_back(meshes[m]);
+                otherFlags.push_back(currentFlags[m]);
+            }
+        }
+        if (members.empty()) continue;
+        std::vector<AccelerationStructure> otherBlases;
+        if (!otherMeshes.empty()) {
+            buildBottomLevelAccelerationStructures(device, commandPool, scratch, otherMeshes, otherBlases, otherFlags);
+            compactAccelerationStructures(device, commandPool, otherBlases, otherFlags);
+        }
 
-    VkDeviceAddress scratchBufferAddress = getBufferDeviceAddress(device, scratchBuffer);
+        std::vector<TuneResult> results;
+        for (VkBuildAccelerationStructureFlagsKHR candidate : BUILD_FLAG_CANDIDATES) {
+            if (!options.compactBlas && (candidate & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR)) continue;
+            std::vector<VkBuildAccelerationStructureFlagsKHR> memberFlags(members.size(), candidate);
+            std::vector<AccelerationStructure> built;
+            BuildStats buildStats = buildBottomLevelAccelerationStructures(device, commandPool, scratch, memberMeshes, built, memberFlags);
+            CompactionStats compaction = compactAccelerationStructures(device, commandPool, built, memberFlags);
+            TuneResult result = { .flags = candidate, .buildMs = buildStats.buildMs + compaction.compactMs, .memory = 0 };
+            for (const AccelerationStructure& blas : built) result.memory += blas.size;
+
+            blases.resize(meshes.size());
+            for (size_t i = 0; i < members.size(); i++) blases[members[i]] = built[i];
+            for (size_t i = 0; i < others.size(); i++) blases[others[i]] = otherBlases[i];
+            buildTopLevel();
+            writeAccelerationStructureDescriptor();
+            timeTraceRays(origins); // the first pass pays for cold caches
+            result.traceMs = timeTraceRays(origins);
+            results.push_back(result);
+
+            topLevel.destroy();
+            for (AccelerationStructure& blas : built) blas.destroy(device);
+        }
+        for (AccelerationStructure& blas : otherBlases) blas.destroy(device);
+        blases.clear();
+
+        size_t best = pickTuneResult(results);
+        buildPolicy.flags[c] = results[best].flags;
+        buildPolicy.tuned[c] = true;
+        printf("  %s meshes (%zu):\n", MESH_CLASS_NAMES[c], members.size());
+        for (size_t i = 0; i < results.size(); i++) {
+            printf("  %c %-36s build %9.2f ms, %9.2f MB, trace %9.3f ms\n", i == best ? '*' : ' ', buildFlagsString(results[i].flags).c_str(),
+                results[i].buildMs, results[i].memory / (1024.0 * 1024.0), results[i].traceMs);
+        }
+    }
+    if (buildPolicy.save(device, options.asPolicyFile)) {
+        printf("Saved BLAS build policy to '%s'\n", options.asPolicyFile);
+    } else {
+        fprintf(stderr, "Failed to write BLAS build policy '%s'!\n", options.asPolicyFile);
+    }
+}
 
-    accelerationStructureBuildGeometryInfo.dstAccelerationStructure = accelerationStructure;
-    accelerationStructureBuildGeometryInfo.scratchData = { .deviceAddress = scratchBufferAddress };
+void Context::createAccelerationStructure() {
+    if (pager.enabled) {
+        pager.update(cameraPosition, UINT64_MAX, topLevel);
+        return;
+    }
+    // dynamic BLASes are rebuilt in place, which needs their uncompacted size
+    bool animate = options.animate && !isGlbFile(options.objFile);
+    std::vector<VkBuildAccelerationStructureFlagsKHR> meshFlags = animate ? std::vector<VkBuildAccelerationStructureFlagsKHR>(meshes.size(), DYNAMIC_BLAS_FLAGS) : meshBuildFlags();
+    // cached BLASes are deserialized, only the rest are built (and compacted) and then stored
+    bool useCache = options.asCacheDirectory && !animate && hostMeshes.empty() && meshHashes.size() == meshes.size();
+    std::vector<bool> cached(meshes.size(), false);
+    blases.resize(meshes.size());
+    if (useCache) {
+        asCache.create(device, commandPool, options.asCacheDirectory);
+        asCache.load(meshHashes, meshFlags, blases, cached);
+        if (asCache.stats.hits > 0) {
+            printf("Loaded %zu of %zu BLAS from '%s' in %.2f ms (%.2f MB)\n", asCache.stats.hits, meshes.size(), options.asCacheDirectory, asCache.stats.loadMs,
+                asCache.stats.bytesRead / (1024.0 * 1024.0));
+        }
+    }
+    std::vector<uint32_t> missing;
+    std::vector<std::vector<TriangleGeometry>> missingMeshes;
+    std::vector<VkBuildAccelerationStructureFlagsKHR> missingFlags;
+    for (uint32_t m = 0; m < meshes.size(); m++) {
+        if (cached[m]) continue;
+        missing.push_back(m);
+        missingMeshes.push_back(meshes[m]);
+        missingFlags.push_back(meshFlags[m]);
+    }
 
-    VkCommandBufferAllocateInfo allocInfo {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = commandPool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1
-    };
-    VkCommandBuffer commandBuffer;
-    vkCheck(vkAllocateCommandBuffers(device.device, &allocInfo, &commandBuffer));
-    VkCommandBufferBeginInfo beginInfo {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-    };
-    vkCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+    BuildStats blasStats;
+    std::vector<AccelerationStructure> built;
+    bool compacted = false; // budgeted builds compact each batch as it completes
+    if (!hostMeshes.empty()) {
+        blasStats = buildBottomLevelAccelerationStructuresOnHost(device, commandPool, hostMeshes, built, meshFlags);
+        printf("Built %zu BLAS with %zu triangles on the host in %.2f ms, copied to the device in %.2f ms (%llu bytes, %llu bytes scratch)\n", built.size(),
+            blasStats.primitiveCount, blasStats.buildMs, blasStats.transferMs, (unsigned long long)blasStats.accelerationSize, (unsigned long long)blasStats.scratchSize);
+        // BLASes the device can't deserialize are built on it instead
+        std::vector<uint32_t> incompatible;
+        std::vector<std::vector<TriangleGeometry>> incompatibleMeshes;
+        std::vector<VkBuildAccelerationStructureFlagsKHR> incompatibleFlags;
+        for (uint32_t m = 0; m < built.size(); m++) {
+            if (built[m].handle != VK_NULL_HANDLE) continue;
+            incompatible.push_back(m);
+            incompatibleMeshes.push_back(meshes[m]);
+            incompatibleFlags.push_back(meshFlags[m]);
+        }
+        if (!incompatible.empty()) {
+            std::vector<AccelerationStructure> deviceBlases;
+            BuildStats deviceStats = buildBottomLevelAccelerationStructures(device, commandPool, scratch, incompatibleMeshes, deviceBlases, incompatibleFlags);
+            for (size_t i = 0; i < incompatible.size(); i++) built[incompatible[i]] = deviceBlases[i];
+            printf("Built %zu host built BLAS the device can't deserialize on the device in %.2f ms\n", incompatible.size(), deviceStats.buildMs);
+        } else if (options.benchFrames > 0) {
+            // benchmark runs also time the same BLASes built on the device
+            std::vector<AccelerationStructure> deviceBlases;
+            BuildStats deviceStats = buildBottomLevelAccelerationStructures(device, commandPool, scratch, meshes, deviceBlases, meshFlags);
+            for (AccelerationStructure& blas : deviceBlases) blas.destroy(device);
+            printf("Device build of the same BLAS: %.2f ms, host build %.2fx that (%.2fx including the copy)\n", deviceStats.buildMs,
+                blasStats.buildMs / std::max(deviceStats.buildMs, 1e-3), (blasStats.buildMs + blasStats.transferMs) / std::max(deviceStats.buildMs, 1e-3));
+        }
+        hostMeshes.clear();
+        hostGeometry = CompactGeometry();
+    } else if (!missingMeshes.empty() && options.buildBudget().enabled()) {
+        BudgetedBuildStats budgeted = buildBottomLevelAccelerationStructuresWithinBudget(device, commandPool, scratch, missingMeshes, built, missingFlags, options.buildBudget());
+        blasStats = budgeted.build;
+        printBudgetedBuildStats(budgeted, options.buildBudget());
+        if (!budgeted.compaction.buildSizes.empty()) printCompactionStats(budgeted.compaction);
+        compacted = true;
+    } else if (!missingMeshes.empty()) {
+        blasStats = buildBottomLevelAccelerationStructures(device, commandPool, scratch, missingMeshes, built, missingFlags);
+        printf("Built %zu BLAS with %zu triangles in %zu build calls in %.2f ms (%llu bytes, %llu bytes scratch)\n", built.size(), blasStats.primitiveCount, blasStats.buildCalls,
+            blasStats.buildMs, (unsigned long long)blasStats.accelerationSize, (unsigned long long)blasStats.scratchSize);
+    }
+    animationStart = std::chrono::steady_clock::now(); // for animateGeometry and moveInstances
+    if (animate) {
+        for (uint32_t m = 0; m < partitions.size(); m++) {
+            DynamicBlas& dynamic = dynamicBlases.emplace_back();
+            dynamic.mesh = m;
+            memcpy(dynamic.buildLo, partitions[m].lo, sizeof(dynamic.buildLo));
+            memcpy(dynamic.buildHi, partitions[m].hi, sizeof(dynamic.buildHi));
+        }
+    } else if (options.compactBlas && !built.empty() && !compacted) {
+        CompactionStats compaction = compactAccelerationStructures(device, commandPool, built, missingFlags);
+        if (!compaction.buildSizes.empty()) printCompactionStats(compaction);
+    }
+    for (size_t i = 0; i < built.size(); i++) {
+        blases[missing[i]] = built[i];
+    }
+    if (useCache && !built.empty()) {
+        std::vector<uint64_t> builtHashes;
+        for (uint32_t m : missing) builtHashes.push_back(meshHashes[m]);
+        asCache.store(builtHashes, missingFlags, built);
+        printf("Stored %zu BLAS in '%s' in %.2f ms (%.2f MB)\n", asCache.stats.stored, options.asCacheDirectory, asCache.stats.storeMs,
+            asCache.stats.bytesWritten / (1024.0 * 1024.0));
+    }
+    VkDeviceSize blasSize = 0;
+    for (const AccelerationStructure& blas : blases) blasSize += blas.size;
+
+    if (!points.empty()) {
+        VkBuildAccelerationStructureFlagsKHR pointFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+        if (options.compactBlas) pointFlags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+        AabbGeometry aabbs = {
+            .aabbAddress = getBufferDeviceAddress(device, aabbBuffer),
+            .stride = sizeof(PointAabb),
+            .primitiveOffset = 0,
+            .primitiveCount = (uint32_t)points.size()
+        };
+        BuildStats pointStats = buildProceduralAccelerationStructure(device, commandPool, scratch, aabbs, pointBlas, pointFlags);
+        // the points are one BLAS, it isn't split to fit the build budget
+        BuildBudget budget = options.buildBudget();
+        VkDeviceSize pointFootprint = pointStats.scratchSize + (options.compactBlas ? 2 : 1) * pointStats.accelerationSize;
+        if ((budget.scratch > 0 && pointStats.scratchSize > budget.scratch) || (budget.peak > 0 && pointFootprint > budget.peak)) {
+            fprintf(stderr, "Point BLAS needed %.2f MB scratch and %.2f MB transient, over the build budget\n", pointStats.scratchSize / (1024.0 * 1024.0),
+                pointFootprint / (1024.0 * 1024.0));
+        }
+        std::vector<AccelerationStructure> built = { pointBlas };
+        CompactionStats compaction = compactAccelerationStructures(device, commandPool, built, { pointFlags });
+        pointBlas = built[0];
+        printf("Built point BLAS with %zu AABBs in %.2f ms (%.2f ms compacting), %.2f MB + %.2f MB AABBs + %.2f MB points\n", pointStats.primitiveCount, pointStats.buildMs,
+            compaction.compactMs, pointBlas.size / (1024.0 * 1024.0), points.size() * sizeof(PointAabb) / (1024.0 * 1024.0), points.size() * sizeof(PointPrimitive) / (1024.0 * 1024.0));
+    }
 
-    VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo {
-        .primitiveCount = primitiveCount,
-        .primitiveOffset = 0,
-        .firstVertex = 0,
-        .transformOffset = 0
-    };
+    BuildStats tlasStats = buildTopLevel();
+    printf("Built TLAS with %zu instances in %.2f ms (%llu bytes)\n", tlasStats.primitiveCount, tlasStats.buildMs, (unsigned long long)tlasStats.accelerationSize);
 
-    const VkAccelerationStructureBuildRangeInfoKHR* pAccelerationStructureBuildRangeInfos = &accelerationStructureBuildRangeInfo;
-    vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &accelerationStructureBuildGeometryInfo, &pAccelerationStructureBuildRangeInfos);
+    // what the instances cost against a single-level AS holding a copy of every instance's geometry
+    VkDeviceSize flattenedSize = 0;
+    for (const MeshInstance& instance : meshInstances) flattenedSize += blases[instance.mesh].size;
+    VkDeviceSize instanceSize = topLevel.instances.size() * sizeof(VkAccelerationStructureInstanceKHR);
+    printf("Acceleration structures: %.2f MB unique BLAS + %.2f MB TLAS + %.2f MB instances, %.2f MB if every instance had its own geometry\n",
+        blasSize / (1024.0 * 1024.0), tlasStats.accelerationSize / (1024.0 * 1024.0), instanceSize / (1024.0 * 1024.0), flattenedSize / (1024.0 * 1024.0));
+}
 
-    vkCheck(vkEndCommandBuffer(commandBuffer));
+// Instances meshInstances over blases, then pointBlas if there is one, and
+// builds topLevel over them
+BuildStats Context::buildTopLevel() {
+    std::vector<VkAccelerationStructureInstanceKHR> instances(meshInstances.size());
+    parallelForBlocks(meshInstances.size(), [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; i++) {
+            const MeshInstance& instance = meshInstances[i];
+            instances[i] = makeInstance(blases[instance.mesh], instance.transform, (uint32_t)i, instance.mask, instance.sbtOffset);
+        }
+    });
+    if (pointBlas.handle != VK_NULL_HANDLE) {
+        instances.push_back(makeInstance(pointBlas, IDENTITY_TRANSFORM, (uint32_t)instances.size(), 0xFF, pointSbtOffset));
+    }
+    return topLevel.build(device, commandPool, scratch, instances);
+}
 
-    VkSubmitInfo submitInfo {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffer
+// Builds the points as tessellated spheres and disks in place of pointBlas and
+// prints what that costs against the AABBs: memory, build time and the time to
+// trace from benchmarkOrigins. pointBlas and the TLAS are restored after.
+void Context::comparePointGeometry() {
+    if (pointBlas.handle == VK_NULL_HANDLE) {
+        printf("No points to compare, pass --points N\n");
+        return;
+    }
+    std::vector<float> origins = benchmarkOrigins();
+    timeTraceRays(origins); // the first pass pays for cold caches
+    double proceduralTraceMs = timeTraceRays(origins);
+
+    auto tessellateStart = std::chrono::steady_clock::now();
+    Scene tessellated;
+    tessellatePoints(points, 8, 16, tessellated);
+    double tessellateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tessellateStart).count();
+    Buffer pointVertexBuffer, pointIndexBuffer;
+    createBuffer(device, tessellated.vertices.size() * sizeof(float), pointVertexBuffer,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+    createBuffer(device, tessellated.indices.size() * sizeof(uint32_t), pointIndexBuffer,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+    uploader.upload(pointVertexBuffer, 0, tessellated.vertices.data(), tessellated.vertices.size() * sizeof(float));
+    uploader.upload(pointIndexBuffer, 0, tessellated.indices.data(), tessellated.indices.size() * sizeof(uint32_t));
+    uploader.wait();
+    TriangleGeometry mesh {
+        .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+        .vertexAddress = getBufferDeviceAddress(device, pointVertexBuffer),
+        .vertexStride = 3 * sizeof(float),
+        .maxVertex = (uint32_t)(tessellated.vertices.size() / 3 - 1),
+        .indexType = VK_INDEX_TYPE_UINT32,
+        .indexAddress = getBufferDeviceAddress(device, pointIndexBuffer),
+        .transformAddress = 0,
+        .primitiveOffset = 0,
+        .primitiveCount = (uint32_t)(tessellated.indices.size() / 3)
     };
+    VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    if (options.compactBlas) flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+    std::vector<AccelerationStructure> built;
+    std::vector<std::vector<TriangleGeometry>> pointMeshes(1, { mesh });
+    BuildStats buildStats = buildBottomLevelAccelerationStructures(device, commandPool, scratch, pointMeshes, built, flags);
+    CompactionStats compaction = compactAccelerationStructures(device, commandPool, built, { flags });
+
+    AccelerationStructure procedural = pointBlas;
+    pointBlas = built[0];
+    pointSbtOffset = 0;
+    buildTopLevel();
+    writeAccelerationStructureDescriptor();
+    timeTraceRays(origins);
+    double tessellatedTraceMs = timeTraceRays(origins);
+
+    VkDeviceSize proceduralBytes = procedural.size + points.size() * (sizeof(PointAabb) + sizeof(PointPrimitive));
+    VkDeviceSize tessellatedBytes = pointBlas.size + (tessellated.vertices.size() * sizeof(float) + tessellated.indices.size() * sizeof(uint32_t));
+    printf("Points as AABBs: %.2f MB (BLAS %.2f MB), trace %.3f ms\n", proceduralBytes / (1024.0 * 1024.0), procedural.size / (1024.0 * 1024.0), proceduralTraceMs);
+    printf("Points as %zu triangles: %.2f MB (BLAS %.2f MB), tessellated in %.2f ms, built in %.2f ms (%.2f ms compacting), trace %.3f ms\n", buildStats.primitiveCount,
+        tessellatedBytes / (1024.0 * 1024.0), pointBlas.size / (1024.0 * 1024.0), tessellateMs, buildStats.buildMs, compaction.compactMs, tessellatedTraceMs);
+    printf("AABBs take %.2fx the memory and %.2fx the trace time of triangles\n", (double)proceduralBytes / std::max<VkDeviceSize>(tessellatedBytes, 1),
+        proceduralTraceMs / std::max(tessellatedTraceMs, 1e-3));
+
+    pointBlas.destroy(device);
+    destroyBuffer(device, pointVertexBuffer);
+    destroyBuffer(device, pointIndexBuffer);
+    pointBlas = procedural;
+    pointSbtOffset = 1;
+    buildTopLevel();
+    writeAccelerationStructureDescriptor();
+}
 
-    vkCheck(vkQueueSubmit(device.queue, 1, &submitInfo, VK_NULL_HANDLE));
-    vkCheck(vkQueueWaitIdle(device.queue));
+// Builds the whole scene as one BLAS in its loaded triangle order and in the
+// order reorderScene sorts it into, and prints the build time and the trace
+// throughput from benchmarkOrigins of each. blases and the TLAS are restored after.
+void Context::compareReorder() {
+    if (unreorderedScene.indices.empty()) {
+        printf("Not comparing triangle orders, the scene was reordered before it was cached, is paged or its meshes are instanced\n");
+        return;
+    }
+    std::vector<float> origins = benchmarkOrigins();
+    double rays = (double)(origins.size() / 3) * swapchain.extent.width * swapchain.extent.height;
+    Scene reordered = unreorderedScene;
+    ReorderStats reorderStats = reorderScene(reordered);
+
+    std::vector<AccelerationStructure> sceneBlases = std::move(blases);
+    std::vector<MeshInstance> sceneInstances = std::move(meshInstances);
+    MeshInstance instance = { 0 };
+    memcpy(instance.transform, IDENTITY_TRANSFORM, sizeof(instance.transform));
+    meshInstances = { instance };
+    const Scene* orders[2] = { &unreorderedScene, &reordered };
+    double buildMs[2], traceMs[2];
+    for (int i = 0; i < 2; i++) {
+        const Scene& ordered = *orders[i];
+        Buffer orderVertexBuffer, orderIndexBuffer;
+        createBuffer(device, ordered.vertices.size() * sizeof(float), orderVertexBuffer,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+        createBuffer(device, ordered.indices.size() * sizeof(uint32_t), orderIndexBuffer,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+        uploader.upload(orderVertexBuffer, 0, ordered.vertices.data(), ordered.vertices.size() * sizeof(float));
+        uploader.upload(orderIndexBuffer, 0, ordered.indices.data(), ordered.indices.size() * sizeof(uint32_t));
+        uploader.wait();
+        TriangleGeometry mesh {
+            .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+            .vertexAddress = getBufferDeviceAddress(device, orderVertexBuffer),
+            .vertexStride = 3 * sizeof(float),
+            .maxVertex = (uint32_t)(ordered.vertices.size() / 3 - 1),
+            .indexType = VK_INDEX_TYPE_UINT32,
+            .indexAddress = getBufferDeviceAddress(device, orderIndexBuffer),
+            .transformAddress = 0,
+            .primitiveOffset = 0,
+            .primitiveCount = (uint32_t)(ordered.indices.size() / 3)
+        };
+        std::vector<std::vector<TriangleGeometry>> orderMeshes(1, { mesh });
+        buildMs[i] = buildBottomLevelAccelerationStructures(device, commandPool, scratch, orderMeshes, blases).buildMs;
+        buildTopLevel();
+        writeAccelerationStructureDescriptor();
+        timeTraceRays(origins); // the first pass pays for cold caches
+        traceMs[i] = timeTraceRays(origins);
+        blases[0].destroy(device);
+        destroyBuffer(device, orderVertexBuffer);
+        destroyBuffer(device, orderIndexBuffer);
+    }
+    unreorderedScene = Scene();
 
-    vkFreeCommandBuffers(device.device, commandPool, 1, &commandBuffer);
+    printf("Loaded triangle order: BLAS built in %.2f ms, %.1f Mrays/s\n", buildMs[0], rays / (traceMs[0] / 1000.0) / 1e6);
+    printf("%s triangle order: BLAS built in %.2f ms, %.1f Mrays/s (mean step %.4f -> %.4f of the scene diagonal)\n", reorderStats.applied ? "Reordered" : "Kept",
+        buildMs[1], rays / (traceMs[1] / 1000.0) / 1e6, reorderStats.spreadBefore, reorderStats.spreadAfter);
 
-    destroyBuffer(device, scratchBuffer);
+    blases = std::move(sceneBlases);
+    meshInstances = std::move(sceneInstances);
+    buildTopLevel();
+    writeAccelerationStructureDescriptor();
 }
 
 void Context::createRTPipeline() {
@@ -394,7 +1316,7 @@ void Context::createRTPipeline() {
             .descriptorCount = 1,
             .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR
         }, 
-        { // TODO need to create image
+        {
             .binding = 1,
             .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
             .descriptorCount = 1,
@@ -405,6 +1327,12 @@ void Context::createRTPipeline() {
             .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
             .descriptorCount = 1,
             .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR
+        },
+        { // the points, see uploadPoints
+            .binding = 3,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_INTERSECTION_BIT_KHR
         }
     };
 
@@ -418,7 +1346,8 @@ void Context::createRTPipeline() {
     std::vector<VkDescriptorPoolSize> descriptorPoolSizes = {
         { .type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, .descriptorCount = 1 },
         { .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 1 },
-        { .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 1 }
+        { .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 1 },
+        { .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 1 }
     };
 
     VkDescriptorPoolCreateInfo descriptorPoolCI {
@@ -439,17 +1368,40 @@ void Context::createRTPipeline() {
     };
     vkCheck(vkAllocateDescriptorSets(device.device, &descriptorSetAllocInfo, &rtDescriptorSet));
 
+    // the TLAS is written once the scene is built, see writeAccelerationStructureDescriptor
+    VkDescriptorImageInfo outputImageDescriptor {
+        .imageView = outputImage.view,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL
+    };
+    VkWriteDescriptorSet outputImageWrite {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = rtDescriptorSet,
+        .dstBinding = 1,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        .pImageInfo = &outputImageDescriptor
+    };
+    vkUpdateDescriptorSets(device.device, 1, &outputImageWrite, 0, nullptr);
+
+    // the camera origin, see gen.rgen
+    VkPushConstantRange pushConstantRange {
+        .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+        .offset = 0,
+        .size = 4 * sizeof(float)
+    };
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
         .setLayoutCount = 1,
         .pSetLayouts = &rtDescriptorSetLayout,
-        // TODO need to figure out push constant range here
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange
     };
     vkCheck(vkCreatePipelineLayout(device.device, &pipelineLayoutCreateInfo, nullptr, &rtPipelineLayout));
 
     VkShaderModule rgenShader = createShaderModule(device, readFile("shaders/gen.spv"));
     VkShaderModule chitShader = createShaderModule(device, readFile("shaders/chit.spv"));
     VkShaderModule missShader = createShaderModule(device, readFile("shaders/miss.spv"));
+    VkShaderModule pointShader = createShaderModule(device, readFile("shaders/point.spv"));
     std::vector<VkPipelineShaderStageCreateInfo> shaderStages = {
         {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -468,6 +1420,12 @@ void Context::createRTPipeline() {
             .stage = VK_SHADER_STAGE_MISS_BIT_KHR,
             .module = missShader,
             .pName = "main"
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_INTERSECTION_BIT_KHR,
+            .module = pointShader,
+            .pName = "main"
         }
     };
 
@@ -488,6 +1446,14 @@ void Context::createRTPipeline() {
             .anyHitShader = VK_SHADER_UNUSED_KHR,
             .intersectionShader = VK_SHADER_UNUSED_KHR
         },
+        { // points, selected by the point instance's sbtOffset of 1
+            .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+            .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR,
+            .generalShader = VK_SHADER_UNUSED_KHR,
+            .closestHitShader = 1,
+            .anyHitShader = VK_SHADER_UNUSED_KHR,
+            .intersectionShader = 3
+        },
         {
             .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
             .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
@@ -506,53 +1472,211 @@ void Context::createRTPipeline() {
         .pGroups = rtShaderGroups.data(),
         .layout = rtPipelineLayout,
     };
-    vkCheck(vkCreateRayTracingPipelinesKHR(device.device, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &rayTracingPipelineCI, nullptr, &rtPipeline));
+    // a warm cache only has to match the shaders against what it already compiled
+    if (options.pipelineCacheFile) pipelineCache.create(device, options.pipelineCacheFile);
+    auto pipelineStart = std::chrono::steady_clock::now();
+    vkCheck(vkCreateRayTracingPipelinesKHR(device.device, VK_NULL_HANDLE, pipelineCache.cache, 1, &rayTracingPipelineCI, nullptr, &rtPipeline));
+    double pipelineMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+    if (!options.pipelineCacheFile) {
+        printf("Created RT pipeline in %.2f ms without a pipeline cache\n", pipelineMs);
+    } else {
+        bool saved = pipelineCache.save();
+        printf("Created RT pipeline in %.2f ms from a %s pipeline cache (%zu bytes loaded from '%s', %zu bytes saved)\n", pipelineMs,
+            pipelineCache.loadedBytes > 0 ? "warm" : "cold", pipelineCache.loadedBytes, options.pipelineCacheFile, saved ? pipelineCache.savedBytes : (size_t)0);
+        if (!saved) fprintf(stderr, "Failed to write pipeline cache '%s'\n", options.pipelineCacheFile);
+    }
 
     vkDestroyShaderModule(device.device, rgenShader, nullptr);
     vkDestroyShaderModule(device.device, chitShader, nullptr);
     vkDestroyShaderModule(device.device, missShader, nullptr);
+    vkDestroyShaderModule(device.device, pointShader, nullptr);
 
-    rtSBT.create(device, rtPipeline, rtShaderGroups);
+    rtSBT.create(device, rtPipeline, rtShaderGroups, 2);
 }
 
-void Context::render() {
-    VkCommandBufferAllocateInfo allocInfo {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = commandPool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1
+void Context::writeAccelerationStructureDescriptor() {
+    VkWriteDescriptorSetAccelerationStructureKHR accelerationStructureDescriptor {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
+        .accelerationStructureCount = 1,
+        .pAccelerationStructures = &topLevel.tlas.handle
     };
-    VkCommandBuffer commandBuffer;
-    vkCheck(vkAllocateCommandBuffers(device.device, &allocInfo, &commandBuffer));
-    VkCommandBufferBeginInfo beginInfo {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    VkWriteDescriptorSet accelerationStructureWrite {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .pNext = &accelerationStructureDescriptor,
+        .dstSet = rtDescriptorSet,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR
     };
-    vkCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+    vkUpdateDescriptorSets(device.device, 1, &accelerationStructureWrite, 0, nullptr);
+}
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipelineLayout, 0, 1, &rtDescriptorSet, 0, nullptr);
-    vkCmdTraceRaysKHR(commandBuffer, 
-        &rtSBT.rgenSBTEntry, 
-        &rtSBT.missSBTEntry, 
-        &rtSBT.hitGroupSBTEntry, 
-        &rtSBT.callableSBTEntry, // unused
-        swapchain.extent.width, swapchain.extent.height, 1);
+// Lets the pager react to the camera, the descriptor is rewritten when the TLAS changes
+void Context::updateGeometry() {
+    if (pager.enabled && pager.update(cameraPosition, PAGER_UPLOAD_PER_UPDATE, topLevel)) {
+        writeAccelerationStructureDescriptor();
+    }
+    if (options.movingInstances > 0 && !pager.enabled) {
+        moveInstances();
+    }
+    if (!dynamicBlases.empty()) {
+        animateGeometry();
+    }
+}
 
+// Bobs options.movingInstances of meshInstances, spread through the list, up and
+// down by a tenth of the scene's extent and commits them to topLevel, which
+// rewrites only their records and updates the TLAS unless enough moved
+void Context::moveInstances() {
+    float t = std::chrono::duration<float>(std::chrono::steady_clock::now() - animationStart).count();
+    float extent = 0.0f;
+    for (int k = 0; k < 3; k++) extent = std::max(extent, sceneHi[k] - sceneLo[k]);
+    uint32_t count = std::min<uint32_t>(options.movingInstances, (uint32_t)meshInstances.size());
+    for (uint32_t j = 0; j < count; j++) {
+        uint32_t i = (uint32_t)((uint64_t)j * meshInstances.size() / count);
+        float transform[3][4];
+        memcpy(transform, meshInstances[i].transform, sizeof(transform));
+        transform[1][3] += 0.1f * extent * std::sin(3.0f * t + (float)j);
+        topLevel.setTransform(i, transform);
+    }
+    topLevel.commit(commandPool, scratch);
+}
+
+// Squashes and stretches the scene about its center, volume preserving. The
+// deformation is only the shared geometry transform in transformBuffer that
+// every BLAS reads its vertices through, no vertex data ever changes. Refits
+// the BLASes and updates the TLAS in the same submit, rebuilding it when its
+// update policy says so
+void Context::animateGeometry() {
+    float t = std::chrono::duration<float>(std::chrono::steady_clock::now() - animationStart).count();
+    float stretch = 1.0f + 0.3f * std::sin(2.0f * t);
+    float scale[3] = { 1.0f / std::sqrt(stretch), stretch, 1.0f / std::sqrt(stretch) };
+    float center[3];
+    for (int k = 0; k < 3; k++) center[k] = 0.5f * (sceneLo[k] + sceneHi[k]);
+    float transform[3][4];
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 4; col++) transform[row][col] = scale[row] * baseTransform[row][col];
+        transform[row][3] += center[row] * (1.0f - scale[row]);
+    }
+    uploader.upload(transformBuffer, 0, transform, sizeof(transform));
+    uploader.wait();
+
+    std::vector<float> lo(3 * dynamicBlases.size()), hi(3 * dynamicBlases.size());
+    for (size_t i = 0; i < dynamicBlases.size(); i++) {
+        const ScenePartition& partition = partitions[dynamicBlases[i].mesh];
+        for (int k = 0; k < 3; k++) {
+            lo[3 * i + k] = center[k] + scale[k] * (partition.lo[k] - center[k]);
+            hi[3 * i + k] = center[k] + scale[k] * (partition.hi[k] - center[k]);
+        }
+    }
+    bool rebuildTopLevel = topLevel.updatesSinceBuild >= topLevel.policy.maxUpdates;
+    VkDeviceSize topLevelScratch = rebuildTopLevel ? topLevel.buildScratchSize : topLevel.updateScratchSize;
+    RefitStats stats = updateDynamicBlases(device, commandPool, scratch, meshes, blases, dynamicBlases, lo.data(), hi.data(), refitPolicy,
+        topLevelScratch, [&](VkCommandBuffer commandBuffer) {
+            topLevel.recordBuild(commandBuffer, scratch, rebuildTopLevel ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR);
+        });
+    topLevel.updatesSinceBuild = rebuildTopLevel ? 0 : topLevel.updatesSinceBuild + 1;
+    refitTotals.refits += stats.refits;
+    refitTotals.rebuilds += stats.rebuilds;
+    refitTotals.buildMs += stats.buildMs;
+    animatedFrames++;
+}
+
+uint32_t Context::acquireImage() {
+    uint32_t imageIndex;
+    vkCheck(vkAcquireNextImageKHR(device.device, swapchain.swapchain, UINT64_MAX, imageAvailable, VK_NULL_HANDLE, &imageIndex));
+    return imageIndex;
+}
+
+// Submits commandBuffer once the image is acquired and presents it, commandBuffer
+// has left the image in PRESENT_SRC
+void Context::present(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
     vkCheck(vkEndCommandBuffer(commandBuffer));
 
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
     VkSubmitInfo submitInfo {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &imageAvailable,
+        .pWaitDstStageMask = &waitStage,
         .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffer
+        .pCommandBuffers = &commandBuffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &renderFinished
     };
-
     vkCheck(vkQueueSubmit(device.queue, 1, &submitInfo, VK_NULL_HANDLE));
+
+    VkPresentInfoKHR presentInfo {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &renderFinished,
+        .swapchainCount = 1,
+        .pSwapchains = &swapchain.swapchain,
+        .pImageIndices = &imageIndex
+    };
+    vkCheck(vkQueuePresentKHR(device.queue, &presentInfo));
     vkCheck(vkQueueWaitIdle(device.queue));
 
     vkFreeCommandBuffers(device.device, commandPool, 1, &commandBuffer);
 }
 
+// Clears the next swapchain image, shown while the scene is still loading
+void Context::renderPlaceholder() {
+    uint32_t imageIndex = acquireImage();
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    VkImage image = swapchain.images[imageIndex];
+    imageBarrier(commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    VkClearColorValue color = { .float32 = { 0.1f, 0.1f, 0.1f, 1.0f } };
+    VkImageSubresourceRange range {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = 0,
+        .levelCount = 1,
+        .baseArrayLayer = 0,
+        .layerCount = 1
+    };
+    vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+    imageBarrier(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    present(commandBuffer, imageIndex);
+}
+
+void Context::render() {
+    uint32_t imageIndex = acquireImage();
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipelineLayout, 0, 1, &rtDescriptorSet, 0, nullptr);
+    float origin[4] = { cameraPosition[0], cameraPosition[1], cameraPosition[2], 0.0f };
+    vkCmdPushConstants(commandBuffer, rtPipelineLayout, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, sizeof(origin), origin);
+    vkCmdTraceRaysKHR(commandBuffer, 
+        &rtSBT.rgenSBTEntry, 
+        &rtSBT.missSBTEntry, 
+        &rtSBT.hitGroupSBTEntry, 
+        &rtSBT.callableSBTEntry, // unused
+        swapchain.extent.width, swapchain.extent.height, 1);
+
+    // copy the traced image into the swapchain image, converting its format
+    VkImage image = swapchain.images[imageIndex];
+    imageBarrier(commandBuffer, outputImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    imageBarrier(commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    VkImageBlit blit {
+        .srcSubresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1 },
+        .srcOffsets = { { 0, 0, 0 }, { (int32_t)swapchain.extent.width, (int32_t)swapchain.extent.height, 1 } },
+        .dstSubresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1 },
+        .dstOffsets = { { 0, 0, 0 }, { (int32_t)swapchain.extent.width, (int32_t)swapchain.extent.height, 1 } }
+    };
+    vkCmdBlitImage(commandBuffer, outputImage.image, VK_IMAGE_LAYOUT_GENERAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_NEAREST);
+    imageBarrier(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    imageBarrier(commandBuffer, outputImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+
+    present(commandBuffer, imageIndex);
+}
+
 void Context::destroy() {
     rtSBT.destroy(device);
     vkDestroyPipelineLayout(device.device, rtPipelineLayout, nullptr);
@@ -560,12 +1684,25 @@ void Context::destroy() {
     vkDestroyDescriptorPool(device.device, rtDescriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(device.device, rtDescriptorSetLayout, nullptr);
     vkDestroyPipeline(device.device, rtPipeline, nullptr);
+    pipelineCache.destroy(); // saved when the pipeline was created
+    destroyImage(device, outputImage);
+    vkDestroySemaphore(device.device, imageAvailable, nullptr);
+    vkDestroySemaphore(device.device, renderFinished, nullptr);
     swapchain.destroy(device);
     vkDestroySurfaceKHR(instance, surface, nullptr);
-    vkDestroyAccelerationStructureKHR(device.device, accelerationStructure, nullptr);
-    destroyBuffer(device, accelerationBuffer);
+    topLevel.destroy();
+    for (AccelerationStructure& blas : blases) {
+        blas.destroy(device);
+    }
+    scratch.destroy(device);
+    pager.destroy();
     destroyBuffer(device, vertexBuffer);
     destroyBuffer(device, indexBuffer);
+    destroyBuffer(device, transformBuffer);
+    pointBlas.destroy(device);
+    destroyBuffer(device, pointBuffer);
+    destroyBuffer(device, aabbBuffer);
+    uploader.destroy(commandPool);
     vkDestroyCommandPool(device.device, commandPool, nullptr);
     vkDestroyDevice(device.device, nullptr);
     vkDestroyInstance(instance, nullptr);
@@ -573,24 +1710,84 @@ void Context::destroy() {
     glfwTerminate();
 }
 
-int main() {
+int main(int argc, char** argv) {
     Context ctx;
-    ctx.initialize();
+    ctx.options.parse(argc, argv);
+    StartupTimeline& timeline = ctx.timeline;
+
+    // the scene is read on a loader thread while the device and pipeline are
+    // created, only its upload and the builds have to wait for both
+    std::atomic<bool> sceneRead = false;
+    std::thread loader;
+    if (!ctx.options.serialStartup) {
+        loader = std::thread([&]() {
+            timeline.run("read scene", "loader", [&]() { ctx.prepareScene(); });
+            sceneRead = true;
+        });
+    }
+
+    timeline.run("initialize", "main", [&]() { ctx.initialize(); });
     printf("Initialized context.\n");
 
-    ctx.loadScene();
+    timeline.run("create RT pipeline", "main", [&]() { ctx.createRTPipeline(); });
+    printf("Created RT pipeline.\n");
+
+    timeline.run("first placeholder frame", "main", [&]() { ctx.renderPlaceholder(); });
+    if (ctx.options.serialStartup) {
+        timeline.run("read scene", "main", [&]() { ctx.prepareScene(); });
+    } else {
+        double waitStart = timeline.now();
+        while (!sceneRead) {
+            ctx.renderPlaceholder();
+            glfwWaitEventsTimeout(1.0 / 60.0);
+        }
+        loader.join();
+        timeline.waitMs = timeline.now() - waitStart;
+    }
+    if (!ctx.loadError.empty()) {
+        fprintf(stderr, "%s\n", ctx.loadError.c_str());
+        exit(1);
+    }
     printf("Loaded scene.\n");
 
-    ctx.createAccelerationStructure();
+    timeline.run("upload scene", "main", [&]() { ctx.uploadScene(); });
+    ctx.loadBuildPolicy();
+    if (ctx.options.autotune) {
+        timeline.run("autotune build flags", "main", [&]() { ctx.autotuneBuildFlags(); });
+    }
+    timeline.run("build acceleration structure", "main", [&]() {
+        ctx.createAccelerationStructure();
+        ctx.writeAccelerationStructureDescriptor();
+    });
     printf("Created acceleration structure.\n");
+    if (ctx.options.comparePoints) {
+        timeline.run("compare point geometry", "main", [&]() { ctx.comparePointGeometry(); });
+    }
+    if (ctx.options.reorder && ctx.options.benchFrames > 0) {
+        timeline.run("compare triangle orders", "main", [&]() { ctx.compareReorder(); });
+    }
 
-    ctx.createRTPipeline();
-    printf("Created RT pipeline.\n");
+    timeline.run("first frame", "main", [&]() { ctx.render(); });
+    timeline.print();
 
     printf("Rendering...\n");
+    uint32_t frames = 0;
+    auto renderStart = std::chrono::steady_clock::now();
     while (!glfwWindowShouldClose(ctx.window)) {
+        ctx.updateGeometry();
         ctx.render();
         glfwPollEvents();
+        if (ctx.options.benchFrames > 0 && ++frames == ctx.options.benchFrames) {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+            double rays = (double)frames * ctx.swapchain.extent.width * ctx.swapchain.extent.height;
+            printf("Rendered %u frames in %.2f ms (%.3f ms/frame, %.1f Mrays/s)\n", frames, seconds * 1000.0, seconds * 1000.0 / frames, rays / seconds / 1e6);
+            break;
+        }
+    }
+    printTopLevelTotals(ctx.topLevel.totals);
+    if (ctx.animatedFrames > 0) {
+        printf("Animated %u frames: %zu BLAS refits and %zu rebuilds, %.3f ms/frame updating acceleration structures\n", ctx.animatedFrames,
+            ctx.refitTotals.refits, ctx.refitTotals.rebuilds, ctx.refitTotals.buildMs / ctx.animatedFrames);
     }
 
     printf("Destroying context...\n");
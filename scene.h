@@ -0,0 +1,1087 @@
+// scene.h
+// Devon McKee, 2025
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <charconv>
+#include <bit>
+#include <thread>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <filesystem>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+const uint32_t NO_INDEX = UINT32_MAX;
+
+// Triangle mesh with one position index per corner in indices. As loaded from
+// OBJ, normals and texcoords have their own per-corner index streams
+// (NO_INDEX where a corner has none); after weldScene every attribute array is
+// per-vertex and indices is the only index stream. triangleIds is empty unless
+// splitTriangles ran, then it holds the input triangle of every triangle.
+// shapes holds the first triangle of each OBJ object or group as loaded (empty
+// for fewer than two). dedupShapes turns them into meshes placed by the
+// instance arrays, or clears them when no shape repeats.
+struct Scene {
+    std::vector<float> vertices;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    std::vector<float> colors;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> normalIndices;
+    std::vector<uint32_t> texcoordIndices;
+    std::vector<uint32_t> triangleIds;
+    std::vector<uint32_t> shapes;
+    std::vector<uint32_t> instanceShapes; // the shape each instance places
+    std::vector<float> instanceTransforms; // row major 3x4 object to world matrix per instance
+};
+
+// A placement of a mesh, transform is a row major 3x4 object to world matrix.
+// mask is tested against the cull mask of traced rays, sbtOffset selects the
+// instance's hit group records in the shader binding table.
+struct MeshInstance {
+    uint32_t mesh;
+    float transform[3][4];
+    uint8_t mask = 0xFF;
+    uint32_t sbtOffset = 0;
+};
+
+// World space bounds of the [lo, hi] box under transform
+void transformBounds(const float transform[3][4], const float lo[3], const float hi[3], float outLo[3], float outHi[3]) {
+    for (int row = 0; row < 3; row++) {
+        outLo[row] = outHi[row] = transform[row][3];
+        for (int k = 0; k < 3; k++) {
+            float a = transform[row][k] * lo[k], b = transform[row][k] * hi[k];
+            outLo[row] += std::min(a, b);
+            outHi[row] += std::max(a, b);
+        }
+    }
+}
+
+// Runs f(i) for i in [0, n) spread over up to numThreads threads (0 = all cores)
+template <typename F>
+void parallelFor(size_t n, F f, unsigned numThreads = 0) {
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = (unsigned)std::min<size_t>(numThreads, n);
+    if (numThreads <= 1) {
+        for (size_t i = 0; i < n; i++) f(i);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < numThreads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = t; i < n; i += numThreads) f(i);
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+}
+
+// Copies of instances laid out on a cubic grid until there are count of them,
+// spaced by the extent of the [lo, hi] bounds and each copy turned about its
+// center in y by the golden angle so neighbouring copies differ. Only instances
+// grow, every copy references the same meshes.
+std::vector<MeshInstance> replicateInstances(const std::vector<MeshInstance>& instances, size_t count, const float lo[3], const float hi[3]) {
+    if (instances.empty() || count <= instances.size()) return instances;
+    size_t copies = (count + instances.size() - 1) / instances.size();
+    size_t side = 1;
+    while (side * side * side < copies) side++;
+    float center[3], spacing = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        center[k] = 0.5f * (lo[k] + hi[k]);
+        spacing = std::max(spacing, 1.25f * (hi[k] - lo[k]));
+    }
+    if (spacing <= 0.0f) spacing = 1.0f;
+    std::vector<MeshInstance> replicated(count);
+    parallelFor(copies, [&](size_t c) {
+        size_t grid[3] = { c % side, c / side % side, c / (side * side) };
+        float angle = 2.39996323f * (float)c;
+        float cosA = std::cos(angle), sinA = std::sin(angle);
+        float rotation[3][3] = { { cosA, 0.0f, sinA }, { 0.0f, 1.0f, 0.0f }, { -sinA, 0.0f, cosA } };
+        for (size_t i = 0; i < instances.size() && c * instances.size() + i < count; i++) {
+            const MeshInstance& source = instances[i];
+            MeshInstance& instance = replicated[c * instances.size() + i];
+            instance = source;
+            // rotation about center, then the grid offset
+            for (int row = 0; row < 3; row++) {
+                for (int col = 0; col < 4; col++) {
+                    float value = 0.0f;
+                    for (int k = 0; k < 3; k++) value += rotation[row][k] * (source.transform[k][col] - (col == 3 ? center[k] : 0.0f));
+                    instance.transform[row][col] = value + (col == 3 ? center[row] + spacing * ((float)grid[row] - 0.5f * (float)(side - 1)) : 0.0f);
+                }
+            }
+        }
+    });
+    return replicated;
+}
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+    bool open(const char* filename);
+    void close();
+};
+
+bool MappedFile::open(const char* filename) {
+#ifdef _WIN32
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    size = (size_t)fileSize.QuadPart;
+    if (size == 0) return true;
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) { close(); return false; }
+    data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) { close(); return false; }
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+    size = (size_t)st.st_size;
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) { ::close(fd); size = 0; return false; }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = (const char*)mapped;
+    }
+    ::close(fd); // mapping stays valid after the descriptor is closed
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (data) munmap((void*)data, size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+// Peak resident set size of the process so far, in bytes
+size_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// Host memory held by the scene's arrays
+size_t sceneBytes(const Scene& scene) {
+    return (scene.vertices.size() + scene.normals.size() + scene.texcoords.size() + scene.colors.size() + scene.instanceTransforms.size()) * sizeof(float)
+        + (scene.indices.size() + scene.normalIndices.size() + scene.texcoordIndices.size() + scene.triangleIds.size() + scene.shapes.size()
+        + scene.instanceShapes.size()) * sizeof(uint32_t);
+}
+
+// Bytes of the scene that go into the vertex and index buffers, positions and indices
+size_t sceneUploadBytes(const Scene& scene) {
+    return scene.vertices.size() * sizeof(float) + scene.indices.size() * sizeof(uint32_t);
+}
+
+// OBJ parsing
+// The file is split into newline-aligned chunks that are processed in parallel
+// in three passes over the mapped text: counting each chunk's elements sizes the
+// Scene arrays exactly, attributes are parsed straight into their final place,
+// then faces are parsed, resolved against the complete attribute arrays and
+// triangulated into their chunk's range of the index streams ('o' and 'g' lines
+// start a new shape at the next triangle). Nothing is staged
+// in between and chunk pages are dropped once a pass is done with them, so peak
+// host memory stays close to the size of the Scene itself. Faces are
+// triangulated the same way as tinyobj's "simple" mode (quads split along the
+// shorter diagonal, larger polygons fanned). Each corner keeps its position,
+// normal and texcoord index, missing or out of range normal/texcoord indices
+// become NO_INDEX.
+
+const size_t OBJ_MIN_CHUNK_SIZE = 1 << 20;
+const size_t OBJ_MAX_CHUNK_SIZE = 8 << 20; // bounds the text resident at once per thread
+
+enum ObjLineType {
+    OBJ_LINE_OTHER,
+    OBJ_LINE_VERTEX,
+    OBJ_LINE_NORMAL,
+    OBJ_LINE_TEXCOORD,
+    OBJ_LINE_FACE,
+    OBJ_LINE_SHAPE // 'o' or 'g'
+};
+
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+    size_t vertexCount = 0;
+    size_t normalCount = 0;
+    size_t texcoordCount = 0;
+    size_t triangleCount = 0; // reserved by countObjChunk, faces with out of range positions leave a gap
+    size_t validTriangles = 0;
+    size_t invalidFaces = 0;
+    size_t vertexBase = 0;
+    size_t normalBase = 0;
+    size_t texcoordBase = 0;
+    size_t triangleBase = 0;
+    std::vector<size_t> shapeStarts; // valid triangles of the chunk before each shape line
+};
+
+// Newline and whitespace scanning uses AVX2 when compiled for it (-mavx2),
+// otherwise SSE2, which every x86-64 target has.
+#if defined(__AVX2__)
+const size_t OBJ_SCAN_WIDTH = 32;
+inline uint32_t objScanMask(const char* p, char c) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi8(c)));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+const size_t OBJ_SCAN_WIDTH = 16;
+inline uint32_t objScanMask(const char* p, char c) {
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi8(c)));
+}
+#else
+const size_t OBJ_SCAN_WIDTH = 0;
+#endif
+
+// First '\n' in [p, end), or end
+inline const char* objFindNewline(const char* p, const char* end) {
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+    for (; (size_t)(end - p) >= OBJ_SCAN_WIDTH; p += OBJ_SCAN_WIDTH) {
+        uint32_t mask = objScanMask(p, '\n');
+        if (mask) return p + std::countr_zero(mask);
+    }
+#endif
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    return newline ? newline : end;
+}
+
+inline const char* objSkipSpace(const char* p, const char* end) {
+    // tokens are nearly always separated by a single space, so only longer
+    // runs (indentation, column alignment) are worth a vector compare
+    if (p < end && *p != ' ' && *p != '\t') return p;
+    if (p < end) p++;
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+    if (p < end && (*p == ' ' || *p == '\t')) {
+        for (; (size_t)(end - p) >= OBJ_SCAN_WIDTH; p += OBJ_SCAN_WIDTH) {
+            uint32_t other = ~(objScanMask(p, ' ') | objScanMask(p, '\t'));
+            if constexpr (OBJ_SCAN_WIDTH < 32) other &= (1u << OBJ_SCAN_WIDTH) - 1;
+            if (other) return p + std::countr_zero(other);
+        }
+    }
+#endif
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+// p points at the number, without a leading '+'
+inline const char* objParseFloatFromChars(const char* p, const char* end, float& value) {
+    std::from_chars_result res = std::from_chars(p, end, value);
+    if (res.ec == std::errc::result_out_of_range) {
+        // keep strtof's behaviour of saturating/flushing out-of-range literals
+        value = strtof(std::string(p, res.ptr).c_str(), nullptr);
+    } else if (res.ec != std::errc()) {
+        return nullptr;
+    }
+    return res.ptr;
+}
+
+const double OBJ_FLOAT_POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+const uint64_t OBJ_FLOAT_EXACT_MANTISSA = 1ull << 53;
+
+// Exact fast path for the decimals exporters write ("-12.345678", "1.5e-3").
+// When the digits form an integer below 2^53 and the power of ten is at most
+// 1e22, both are exact doubles and one IEEE multiply or divide gives the
+// correctly rounded double. Rounding that to float is then also correct unless
+// the double landed exactly on a midpoint between two floats, which is checked.
+// Anything else (inf, nan, 1e-40, 20 digits) goes through from_chars, so the
+// result always has the same bits as from_chars.
+inline const char* objParseFloat(const char* p, const char* end, float& value) {
+    p = objSkipSpace(p, end);
+    if (p < end && *p == '+') p++; // from_chars does not accept a leading '+'
+    const char* q = p;
+    bool negative = q < end && *q == '-';
+    if (negative) q++;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    for (; q < end && (unsigned)(*q - '0') <= 9; q++, digits++) mantissa = mantissa * 10 + (unsigned)(*q - '0');
+    if (q < end && *q == '.') {
+        for (q++; q < end && (unsigned)(*q - '0') <= 9; q++, digits++, exponent--) mantissa = mantissa * 10 + (unsigned)(*q - '0');
+    }
+    if (digits == 0 || digits > 19) return objParseFloatFromChars(p, end, value);
+    if (q < end && (*q == 'e' || *q == 'E')) {
+        const char* e = q + 1;
+        bool negativeExponent = e < end && *e == '-';
+        if (e < end && (*e == '-' || *e == '+')) e++;
+        int explicitExponent = 0, exponentDigits = 0;
+        for (; e < end && (unsigned)(*e - '0') <= 9 && exponentDigits < 4; e++, exponentDigits++) explicitExponent = explicitExponent * 10 + (*e - '0');
+        if (exponentDigits == 0 || exponentDigits == 4) return objParseFloatFromChars(p, end, value);
+        exponent += negativeExponent ? -explicitExponent : explicitExponent;
+        q = e;
+    }
+    if (mantissa > OBJ_FLOAT_EXACT_MANTISSA || exponent < -22 || exponent > 22) return objParseFloatFromChars(p, end, value);
+    double d = (double)mantissa;
+    d = exponent < 0 ? d / OBJ_FLOAT_POW10[-exponent] : d * OBJ_FLOAT_POW10[exponent];
+    // results stay within the normal float range, where a float midpoint has
+    // exactly the 25th significand bit set below the float's 24
+    uint64_t bits = std::bit_cast<uint64_t>(d);
+    if ((bits & ((1ull << 29) - 1)) == 1ull << 28) return objParseFloatFromChars(p, end, value);
+    value = negative ? -(float)d : (float)d;
+    return q;
+}
+
+inline const char* objParseIndex(const char* p, const char* end, int64_t& value) {
+    if (p < end && *p == '+') p++;
+    const char* q = p;
+    bool negative = q < end && *q == '-';
+    if (negative) q++;
+    int64_t index = 0;
+    int digits = 0;
+    for (; q < end && (unsigned)(*q - '0') <= 9 && digits < 18; q++, digits++) index = index * 10 + (*q - '0');
+    if (digits == 18 || digits == 0) {
+        // let from_chars report overflow or a missing number
+        std::from_chars_result res = std::from_chars(p, end, value);
+        if (res.ec != std::errc()) return nullptr;
+        return res.ptr;
+    }
+    value = negative ? -index : index;
+    return q;
+}
+
+// Parses up to maxCount floats from the rest of a line, returns the number parsed
+inline int objParseFloats(const char* p, const char* end, float* values, int maxCount) {
+    int count = 0;
+    while (count < maxCount) {
+        p = objSkipSpace(p, end);
+        if (p >= end) break;
+        const char* next = objParseFloat(p, end, values[count]);
+        if (!next) break;
+        p = next;
+        count++;
+    }
+    return count;
+}
+
+// Classifies a line and moves p to its first argument
+inline ObjLineType objLineType(const char*& p, const char* lineEnd) {
+    p = objSkipSpace(p, lineEnd);
+    auto isSpace = [](char c) { return c == ' ' || c == '\t'; };
+    if (lineEnd - p >= 2 && p[0] == 'v' && isSpace(p[1])) {
+        p += 2;
+        return OBJ_LINE_VERTEX;
+    } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+        p += 3;
+        return OBJ_LINE_NORMAL;
+    } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+        p += 3;
+        return OBJ_LINE_TEXCOORD;
+    } else if (lineEnd - p >= 2 && p[0] == 'f' && isSpace(p[1])) {
+        p += 2;
+        return OBJ_LINE_FACE;
+    } else if (lineEnd - p >= 1 && (p[0] == 'o' || p[0] == 'g') && (lineEnd - p == 1 || isSpace(p[1]))) {
+        p += 1;
+        return OBJ_LINE_SHAPE;
+    }
+    return OBJ_LINE_OTHER;
+}
+
+// Calls f(type, arguments, lineEnd) for every line of [begin, end)
+template <typename F>
+void forEachObjLine(const char* begin, const char* end, F f) {
+    for (const char* p = begin; p < end;) {
+        const char* lineEnd = objFindNewline(p, end);
+        const char* next = lineEnd + 1;
+        if (lineEnd > p && lineEnd[-1] == '\r') lineEnd--;
+        ObjLineType type = objLineType(p, lineEnd);
+        f(type, p, lineEnd);
+        p = next;
+    }
+}
+
+// Parses the next face corner, "v", "v/vt", "v//vn" or "v/vt/vn", with 0 for
+// absent indices. Returns nullptr at the end of the face.
+inline const char* objParseCorner(const char* q, const char* lineEnd, int64_t& v, int64_t& vt, int64_t& vn) {
+    q = objSkipSpace(q, lineEnd);
+    if (q >= lineEnd) return nullptr;
+    v = vt = vn = 0;
+    q = objParseIndex(q, lineEnd, v);
+    if (!q || v == 0) return nullptr;
+    if (q < lineEnd && *q == '/') {
+        q++;
+        if (q < lineEnd && *q != '/') q = objParseIndex(q, lineEnd, vt);
+        if (q && q < lineEnd && *q == '/') q = objParseIndex(q + 1, lineEnd, vn);
+        if (!q) return nullptr;
+    }
+    while (q < lineEnd && *q != ' ' && *q != '\t') q++;
+    return q;
+}
+
+// Converts a 1-based (or negative, relative to the count seen so far) OBJ index
+// to a global 0-based one, NO_INDEX when missing or out of range
+inline uint32_t objResolveIndex(int64_t index, size_t countSoFar, size_t count) {
+    if (index == 0) return NO_INDEX;
+    index = index > 0 ? index - 1 : (int64_t)countSoFar + index;
+    return (index < 0 || (size_t)index >= count) ? NO_INDEX : (uint32_t)index;
+}
+
+// Gives the pages of [begin, end) back to the page cache, they are read again
+// from it if touched later
+inline void objReleaseText(const char* begin, const char* end) {
+#ifndef _WIN32
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)begin + page - 1) & ~(page - 1), last = (uintptr_t)end & ~(page - 1);
+    if (last > first) madvise((void*)first, last - first, MADV_DONTNEED);
+#endif
+}
+
+// Quads are split along their shorter diagonal
+inline bool objSplitQuadAlong02(const uint32_t* ids, const float* vertices) {
+    auto dist2 = [&](uint32_t a, uint32_t b) {
+        float dx = vertices[3 * ids[b] + 0] - vertices[3 * ids[a] + 0];
+        float dy = vertices[3 * ids[b] + 1] - vertices[3 * ids[a] + 1];
+        float dz = vertices[3 * ids[b] + 2] - vertices[3 * ids[a] + 2];
+        return dx * dx + dy * dy + dz * dz;
+    };
+    return dist2(0, 2) < dist2(1, 3);
+}
+
+// Emits the triangles of a face with valid position ids as emit(a, b, c) corner numbers
+template <typename F>
+void objTriangulate(const std::vector<uint32_t>& ids, const float* vertices, F emit) {
+    uint32_t faceSize = (uint32_t)ids.size();
+    if (faceSize == 3) {
+        emit(0, 1, 2);
+    } else if (faceSize == 4) {
+        if (objSplitQuadAlong02(ids.data(), vertices)) {
+            emit(0, 1, 2);
+            emit(0, 2, 3);
+        } else {
+            emit(0, 1, 3);
+            emit(1, 2, 3);
+        }
+    } else {
+        for (uint32_t k = 1; k + 1 < faceSize; k++) emit(0, k, k + 1);
+    }
+}
+
+// First pass: element counts, faces are parsed to know their corner counts
+void countObjChunk(ObjChunk& chunk) {
+    forEachObjLine(chunk.begin, chunk.end, [&](ObjLineType type, const char* p, const char* lineEnd) {
+        if (type == OBJ_LINE_VERTEX) {
+            chunk.vertexCount++;
+        } else if (type == OBJ_LINE_NORMAL) {
+            chunk.normalCount++;
+        } else if (type == OBJ_LINE_TEXCOORD) {
+            chunk.texcoordCount++;
+        } else if (type == OBJ_LINE_FACE) {
+            size_t corners = 0;
+            int64_t v, vt, vn;
+            while ((p = objParseCorner(p, lineEnd, v, vt, vn))) corners++;
+            if (corners < 3) {
+                chunk.invalidFaces++;
+            } else {
+                chunk.triangleCount += corners - 2;
+            }
+        }
+    });
+}
+
+// Second pass: positions, colors, normals and texcoords at the chunk's bases
+void parseObjChunkAttributes(ObjChunk& chunk, Scene& scene) {
+    float* vertices = scene.vertices.data() + 3 * chunk.vertexBase;
+    float* colors = scene.colors.data() + 3 * chunk.vertexBase;
+    float* normals = scene.normals.data() + 3 * chunk.normalBase;
+    float* texcoords = scene.texcoords.data() + 2 * chunk.texcoordBase;
+    forEachObjLine(chunk.begin, chunk.end, [&](ObjLineType type, const char* p, const char* lineEnd) {
+        if (type == OBJ_LINE_VERTEX) {
+            // like tinyobj's default config, colors fall back to white (or w) when absent
+            float values[6] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+            objParseFloats(p, lineEnd, values, 6);
+            memcpy(vertices, values, 3 * sizeof(float));
+            memcpy(colors, values + 3, 3 * sizeof(float));
+            vertices += 3;
+            colors += 3;
+        } else if (type == OBJ_LINE_NORMAL) {
+            normals[0] = normals[1] = normals[2] = 0.0f;
+            objParseFloats(p, lineEnd, normals, 3);
+            normals += 3;
+        } else if (type == OBJ_LINE_TEXCOORD) {
+            texcoords[0] = texcoords[1] = 0.0f;
+            objParseFloats(p, lineEnd, texcoords, 2);
+            texcoords += 2;
+        }
+    });
+}
+
+// Third pass: resolves and triangulates faces into the chunk's triangle range.
+// Normal/texcoord indices are only emitted when the file has any normals/texcoords.
+void parseObjChunkFaces(ObjChunk& chunk, Scene& scene) {
+    size_t numVertices = scene.vertices.size() / 3;
+    size_t numNormals = scene.normals.size() / 3;
+    size_t numTexcoords = scene.texcoords.size() / 2;
+    size_t vertexCount = chunk.vertexBase, normalCount = chunk.normalBase, texcoordCount = chunk.texcoordBase;
+    uint32_t* indices = scene.indices.data() + 3 * chunk.triangleBase;
+    uint32_t* normalIndices = numNormals > 0 ? scene.normalIndices.data() + 3 * chunk.triangleBase : nullptr;
+    uint32_t* texcoordIndices = numTexcoords > 0 ? scene.texcoordIndices.data() + 3 * chunk.triangleBase : nullptr;
+    std::vector<uint32_t> ids, normalIds, texcoordIds;
+    auto emit = [&](uint32_t a, uint32_t b, uint32_t c) {
+        size_t t = 3 * chunk.validTriangles++;
+        uint32_t tri[3] = { a, b, c };
+        for (uint32_t k = 0; k < 3; k++) {
+            indices[t + k] = ids[tri[k]];
+            if (normalIndices) normalIndices[t + k] = normalIds[tri[k]];
+            if (texcoordIndices) texcoordIndices[t + k] = texcoordIds[tri[k]];
+        }
+    };
+    forEachObjLine(chunk.begin, chunk.end, [&](ObjLineType type, const char* p, const char* lineEnd) {
+        if (type == OBJ_LINE_VERTEX) {
+            vertexCount++;
+        } else if (type == OBJ_LINE_NORMAL) {
+            normalCount++;
+        } else if (type == OBJ_LINE_TEXCOORD) {
+            texcoordCount++;
+        } else if (type == OBJ_LINE_SHAPE) {
+            chunk.shapeStarts.push_back(chunk.validTriangles);
+        } else if (type == OBJ_LINE_FACE) {
+            ids.clear();
+            normalIds.clear();
+            texcoordIds.clear();
+            bool valid = true;
+            int64_t v, vt, vn;
+            while ((p = objParseCorner(p, lineEnd, v, vt, vn))) {
+                ids.push_back(objResolveIndex(v, vertexCount, numVertices));
+                normalIds.push_back(objResolveIndex(vn, normalCount, numNormals));
+                texcoordIds.push_back(objResolveIndex(vt, texcoordCount, numTexcoords));
+                if (ids.back() == NO_INDEX) valid = false;
+            }
+            uint32_t faceSize = (uint32_t)ids.size();
+            if (faceSize < 3) return; // counted by countObjChunk
+            if (!valid) {
+                chunk.invalidFaces++;
+                return;
+            }
+            objTriangulate(ids, scene.vertices.data(), emit);
+        }
+    });
+}
+
+// Moves every chunk's valid triangles down over the gaps left by invalid faces
+void compactObjTriangles(std::vector<ObjChunk>& chunks, Scene& scene) {
+    size_t dst = 0;
+    for (ObjChunk& chunk : chunks) {
+        if (dst != chunk.triangleBase) {
+            for (std::vector<uint32_t>* stream : { &scene.indices, &scene.normalIndices, &scene.texcoordIndices }) {
+                if (stream->empty()) continue;
+                memmove(stream->data() + 3 * dst, stream->data() + 3 * chunk.triangleBase, 3 * chunk.validTriangles * sizeof(uint32_t));
+            }
+        }
+        dst += chunk.validTriangles;
+    }
+    for (std::vector<uint32_t>* stream : { &scene.indices, &scene.normalIndices, &scene.texcoordIndices }) {
+        if (!stream->empty()) stream->resize(3 * dst);
+    }
+}
+
+// Sorts shape starts, drops empty shapes and starts a shape at triangle 0, a
+// single shape is the whole scene and none are kept
+void normalizeShapes(std::vector<uint32_t>& shapes, size_t numTriangles) {
+    shapes.push_back(0);
+    std::sort(shapes.begin(), shapes.end());
+    shapes.erase(std::unique(shapes.begin(), shapes.end()), shapes.end());
+    while (!shapes.empty() && shapes.back() >= numTriangles) shapes.pop_back();
+    if (shapes.size() < 2) shapes.clear();
+}
+
+// Splits the file into numChunks pieces ending on line boundaries
+std::vector<ObjChunk> splitObjChunks(const MappedFile& file, size_t numChunks) {
+    std::vector<ObjChunk> chunks(numChunks);
+    const char* fileEnd = file.data + file.size;
+    const char* chunkBegin = file.data;
+    for (size_t i = 0; i < numChunks; i++) {
+        const char* chunkEnd = (i + 1 == numChunks) ? fileEnd : file.data + file.size * (i + 1) / numChunks;
+        if (chunkEnd < chunkBegin) chunkEnd = chunkBegin;
+        if (chunkEnd < fileEnd) {
+            const char* newline = (const char*)memchr(chunkEnd, '\n', fileEnd - chunkEnd);
+            chunkEnd = newline ? newline + 1 : fileEnd;
+        }
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+    return chunks;
+}
+
+// Loads a Wavefront OBJ into scene using every core (numThreads = 0)
+bool loadObjParallel(const char* filename, Scene& scene, unsigned numThreads = 0) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        fprintf(stderr, "Failed to open '%s'!\n", filename);
+        return false;
+    }
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    size_t numChunks = std::max<size_t>(numThreads * 4, file.size / OBJ_MAX_CHUNK_SIZE);
+    std::vector<ObjChunk> chunks = splitObjChunks(file, std::max<size_t>(1, std::min(numChunks, file.size / OBJ_MIN_CHUNK_SIZE)));
+    numChunks = chunks.size();
+
+    parallelFor(numChunks, [&](size_t i) {
+        countObjChunk(chunks[i]);
+        objReleaseText(chunks[i].begin, chunks[i].end);
+    }, numThreads);
+
+    size_t vertexBase = 0, normalBase = 0, texcoordBase = 0, triangleBase = 0;
+    for (ObjChunk& chunk : chunks) {
+        chunk.vertexBase = vertexBase;
+        chunk.normalBase = normalBase;
+        chunk.texcoordBase = texcoordBase;
+        chunk.triangleBase = triangleBase;
+        vertexBase += chunk.vertexCount;
+        normalBase += chunk.normalCount;
+        texcoordBase += chunk.texcoordCount;
+        triangleBase += chunk.triangleCount;
+    }
+    scene.vertices.resize(3 * vertexBase);
+    scene.colors.resize(3 * vertexBase);
+    scene.normals.resize(3 * normalBase);
+    scene.texcoords.resize(2 * texcoordBase);
+    scene.indices.resize(3 * triangleBase);
+    scene.normalIndices.resize(normalBase > 0 ? 3 * triangleBase : 0);
+    scene.texcoordIndices.resize(texcoordBase > 0 ? 3 * triangleBase : 0);
+
+    parallelFor(numChunks, [&](size_t i) {
+        parseObjChunkAttributes(chunks[i], scene);
+        objReleaseText(chunks[i].begin, chunks[i].end);
+    }, numThreads);
+    parallelFor(numChunks, [&](size_t i) {
+        parseObjChunkFaces(chunks[i], scene);
+        objReleaseText(chunks[i].begin, chunks[i].end);
+    }, numThreads);
+
+    size_t invalidFaces = 0;
+    for (ObjChunk& chunk : chunks) invalidFaces += chunk.invalidFaces;
+    if (invalidFaces > 0) {
+        compactObjTriangles(chunks, scene);
+        fprintf(stderr, "loadObjParallel: skipped %zu invalid faces in '%s'\n", invalidFaces, filename);
+    }
+    size_t shapeBase = 0;
+    for (ObjChunk& chunk : chunks) {
+        for (size_t start : chunk.shapeStarts) scene.shapes.push_back((uint32_t)(shapeBase + start));
+        shapeBase += chunk.validTriangles;
+    }
+    normalizeShapes(scene.shapes, scene.indices.size() / 3);
+
+    file.close();
+    return true;
+}
+
+#ifdef TINY_OBJ_LOADER_H_
+// State of a tinyobj LoadObjWithCallback load, appending straight into the
+// Scene arrays reserved from a counting pass
+struct TinyObjStream {
+    Scene* scene;
+    size_t numVertices, numNormals, numTexcoords; // totals, indices are validated against these
+    std::vector<uint32_t> ids, normalIds, texcoordIds;
+    std::vector<size_t> forwardQuads; // first triangle of quads referencing positions not read yet
+    size_t invalidFaces = 0;
+};
+
+void tinyObjIndexCallback(void* userData, tinyobj::index_t* corners, int numCorners) {
+    TinyObjStream& stream = *(TinyObjStream*)userData;
+    Scene& scene = *stream.scene;
+    stream.ids.clear();
+    stream.normalIds.clear();
+    stream.texcoordIds.clear();
+    bool valid = numCorners >= 3, forward = false;
+    for (int k = 0; k < numCorners; k++) {
+        stream.ids.push_back(objResolveIndex(corners[k].vertex_index, scene.vertices.size() / 3, stream.numVertices));
+        stream.normalIds.push_back(objResolveIndex(corners[k].normal_index, scene.normals.size() / 3, stream.numNormals));
+        stream.texcoordIds.push_back(objResolveIndex(corners[k].texcoord_index, scene.texcoords.size() / 2, stream.numTexcoords));
+        valid &= stream.ids.back() != NO_INDEX;
+        forward |= stream.ids.back() >= scene.vertices.size() / 3;
+    }
+    if (!valid) {
+        stream.invalidFaces++;
+        return;
+    }
+    auto emit = [&](uint32_t a, uint32_t b, uint32_t c) {
+        for (uint32_t k : { a, b, c }) {
+            scene.indices.push_back(stream.ids[k]);
+            if (stream.numNormals > 0) scene.normalIndices.push_back(stream.normalIds[k]);
+            if (stream.numTexcoords > 0) scene.texcoordIndices.push_back(stream.texcoordIds[k]);
+        }
+    };
+    if (numCorners == 4 && forward) {
+        // split along 0-2 for now, fixed up once every position is read
+        stream.forwardQuads.push_back(scene.indices.size() / 3);
+        emit(0, 1, 2);
+        emit(0, 2, 3);
+    } else {
+        objTriangulate(stream.ids, scene.vertices.data(), emit);
+    }
+}
+
+// Corners of a quad emitted as (0, 1, 2), (0, 2, 3)
+inline void forwardQuadCorners(const std::vector<uint32_t>& stream, size_t t, uint32_t quad[4]) {
+    const uint32_t* tri = stream.data() + 3 * t;
+    quad[0] = tri[0];
+    quad[1] = tri[1];
+    quad[2] = tri[2];
+    quad[3] = tri[5];
+}
+
+// Re-emits such a quad split along 1-3
+void resplitForwardQuad(std::vector<uint32_t>& stream, size_t t) {
+    uint32_t quad[4];
+    forwardQuadCorners(stream, t, quad);
+    uint32_t split[6] = { quad[0], quad[1], quad[3], quad[1], quad[2], quad[3] };
+    memcpy(stream.data() + 3 * t, split, sizeof(split));
+}
+
+// Reference path through tinyobj's single-threaded istream reader (only
+// available when tiny_obj_loader.h is included before this header). Elements
+// are streamed through LoadObjWithCallback into exactly reserved Scene arrays
+// instead of being copied out of attrib_t/shape_t.
+bool loadObjTinyObj(const char* filename, Scene& scene) {
+    ObjChunk counts;
+    MappedFile file;
+    if (!file.open(filename)) {
+        fprintf(stderr, "Failed to open '%s'!\n", filename);
+        return false;
+    }
+    for (ObjChunk& chunk : splitObjChunks(file, std::max<size_t>(1, file.size / OBJ_MAX_CHUNK_SIZE))) {
+        countObjChunk(chunk);
+        objReleaseText(chunk.begin, chunk.end);
+        counts.vertexCount += chunk.vertexCount;
+        counts.normalCount += chunk.normalCount;
+        counts.texcoordCount += chunk.texcoordCount;
+        counts.triangleCount += chunk.triangleCount;
+    }
+    file.close();
+    scene.vertices.reserve(3 * counts.vertexCount);
+    scene.colors.reserve(3 * counts.vertexCount);
+    scene.normals.reserve(3 * counts.normalCount);
+    scene.texcoords.reserve(2 * counts.texcoordCount);
+    scene.indices.reserve(3 * counts.triangleCount);
+    if (counts.normalCount > 0) scene.normalIndices.reserve(3 * counts.triangleCount);
+    if (counts.texcoordCount > 0) scene.texcoordIndices.reserve(3 * counts.triangleCount);
+
+    TinyObjStream stream {
+        .scene = &scene,
+        .numVertices = counts.vertexCount,
+        .numNormals = counts.normalCount,
+        .numTexcoords = counts.texcoordCount
+    };
+    tinyobj::callback_t callback;
+    callback.vertex_color_cb = [](void* userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t r, tinyobj::real_t g, tinyobj::real_t b, bool) {
+        Scene& scene = *((TinyObjStream*)userData)->scene;
+        scene.vertices.insert(scene.vertices.end(), { x, y, z });
+        scene.colors.insert(scene.colors.end(), { r, g, b });
+    };
+    callback.normal_cb = [](void* userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z) {
+        Scene& scene = *((TinyObjStream*)userData)->scene;
+        scene.normals.insert(scene.normals.end(), { x, y, z });
+    };
+    callback.texcoord_cb = [](void* userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t) {
+        Scene& scene = *((TinyObjStream*)userData)->scene;
+        scene.texcoords.insert(scene.texcoords.end(), { x, y });
+    };
+    callback.index_cb = tinyObjIndexCallback;
+    callback.group_cb = [](void* userData, const char**, int) {
+        Scene& scene = *((TinyObjStream*)userData)->scene;
+        scene.shapes.push_back((uint32_t)(scene.indices.size() / 3));
+    };
+    callback.object_cb = [](void* userData, const char*) {
+        Scene& scene = *((TinyObjStream*)userData)->scene;
+        scene.shapes.push_back((uint32_t)(scene.indices.size() / 3));
+    };
+
+    std::ifstream input(filename, std::ios::binary);
+    std::string warning, error;
+    tinyobj::MaterialFileReader materialReader("./");
+    if (!input.is_open() || !tinyobj::LoadObjWithCallback(input, callback, &stream, &materialReader, &warning, &error)) {
+        if (!error.empty()) {
+            fprintf(stderr, "TinyObjReader: %s\n", error.c_str());
+        }
+        return false;
+    }
+    if (!warning.empty()) {
+        fprintf(stderr, "TinyObjReader: %s\n", warning.c_str());
+    }
+    for (size_t t : stream.forwardQuads) {
+        uint32_t quad[4];
+        forwardQuadCorners(scene.indices, t, quad);
+        if (objSplitQuadAlong02(quad, scene.vertices.data())) continue;
+        resplitForwardQuad(scene.indices, t);
+        if (!scene.normalIndices.empty()) resplitForwardQuad(scene.normalIndices, t);
+        if (!scene.texcoordIndices.empty()) resplitForwardQuad(scene.texcoordIndices, t);
+    }
+    if (stream.invalidFaces > 0) {
+        fprintf(stderr, "loadObjTinyObj: skipped %zu invalid faces in '%s'\n", stream.invalidFaces, filename);
+    }
+    normalizeShapes(scene.shapes, scene.indices.size() / 3);
+    return true;
+}
+#endif
+
+// Hashing
+// 64-bit multiply/xorshift hash over 8-byte words. Large inputs are hashed in
+// fixed-size blocks on all cores and the block hashes are hashed again, so the
+// result does not depend on the thread count.
+
+const size_t HASH_BLOCK_SIZE = 4 << 20;
+
+inline uint64_t hashMix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ULL);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        h = (h ^ hashMix(word)) * 0x9e3779b97f4a7c15ULL;
+    }
+    uint64_t tail = 0;
+    if (i < size) memcpy(&tail, bytes + i, size - i);
+    h = (h ^ hashMix(tail)) * 0x9e3779b97f4a7c15ULL;
+    return hashMix(h);
+}
+
+uint64_t hashBytesParallel(const void* data, size_t size, unsigned numThreads = 0) {
+    size_t numBlocks = (size + HASH_BLOCK_SIZE - 1) / HASH_BLOCK_SIZE;
+    if (numBlocks <= 1) return hashBytes(data, size);
+    std::vector<uint64_t> blockHashes(numBlocks);
+    parallelFor(numBlocks, [&](size_t i) {
+        size_t offset = i * HASH_BLOCK_SIZE;
+        blockHashes[i] = hashBytes((const uint8_t*)data + offset, std::min(HASH_BLOCK_SIZE, size - offset), i);
+    }, numThreads);
+    return hashBytes(blockHashes.data(), blockHashes.size() * sizeof(uint64_t), size);
+}
+
+// Binary scene cache (.rtscene)
+// A header followed by the Scene arrays, each starting at a SCENE_CACHE_ALIGNMENT
+// boundary so they can be copied (or mapped) straight into upload buffers. The
+// header records the size, modification time and hash of the source file and
+// which mesh passes were applied to the stored arrays; the
+// cheap size/mtime check is tried first and the hash only when the mtime moved.
+// Bump SCENE_CACHE_VERSION whenever the layout or the loader's output changes.
+// Files are written in host byte order.
+
+const char SCENE_CACHE_MAGIC[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', 0 };
+const uint32_t SCENE_CACHE_VERSION = 3;
+const size_t SCENE_CACHE_ALIGNMENT = 256;
+
+enum SceneCacheArrayId {
+    SCENE_CACHE_VERTICES,
+    SCENE_CACHE_NORMALS,
+    SCENE_CACHE_TEXCOORDS,
+    SCENE_CACHE_COLORS,
+    SCENE_CACHE_INDICES,
+    SCENE_CACHE_NORMAL_INDICES,
+    SCENE_CACHE_TEXCOORD_INDICES,
+    SCENE_CACHE_SHAPES,
+    SCENE_CACHE_INSTANCE_SHAPES,
+    SCENE_CACHE_INSTANCE_TRANSFORMS,
+    SCENE_CACHE_ARRAY_COUNT
+};
+
+struct SceneCacheArray {
+    uint64_t offset; // bytes from the start of the file
+    uint64_t count; // number of 4-byte elements
+};
+
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    uint64_t fileSize;
+    uint64_t processFlags; // mesh passes applied before caching, see mesh.h
+    SceneCacheArray arrays[SCENE_CACHE_ARRAY_COUNT];
+};
+
+struct SceneSourceInfo {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+bool getSceneSourceInfo(const char* filename, SceneSourceInfo& info) {
+    std::error_code ec;
+    info.size = std::filesystem::file_size(filename, ec);
+    if (ec) return false;
+    info.mtime = std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+    return !ec;
+}
+
+uint64_t hashFile(const char* filename) {
+    MappedFile file;
+    if (!file.open(filename)) return 0;
+    uint64_t hash = hashBytesParallel(file.data, file.size);
+    file.close();
+    return hash;
+}
+
+// foo/bar.obj -> foo/bar.rtscene
+std::string sceneCachePath(const char* filename) {
+    return std::filesystem::path(filename).replace_extension(".rtscene").string();
+}
+
+bool isSceneCacheFile(const char* filename) {
+    return std::filesystem::path(filename).extension() == ".rtscene";
+}
+
+// Writes scene to cacheFile, recording sourceFile's identity (if given) for validation
+bool writeSceneCache(const char* cacheFile, const Scene& scene, const char* sourceFile = nullptr, uint64_t processFlags = 0) {
+    SceneCacheHeader header {};
+    memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_CACHE_VERSION;
+    header.headerSize = sizeof(SceneCacheHeader);
+    header.processFlags = processFlags;
+    if (sourceFile) {
+        SceneSourceInfo info;
+        if (!getSceneSourceInfo(sourceFile, info)) return false;
+        header.sourceSize = info.size;
+        header.sourceMtime = info.mtime;
+        header.sourceHash = hashFile(sourceFile);
+    }
+
+    const void* arrays[SCENE_CACHE_ARRAY_COUNT] = {
+        scene.vertices.data(), scene.normals.data(), scene.texcoords.data(), scene.colors.data(),
+        scene.indices.data(), scene.normalIndices.data(), scene.texcoordIndices.data(),
+        scene.shapes.data(), scene.instanceShapes.data(), scene.instanceTransforms.data()
+    };
+    size_t counts[SCENE_CACHE_ARRAY_COUNT] = {
+        scene.vertices.size(), scene.normals.size(), scene.texcoords.size(), scene.colors.size(),
+        scene.indices.size(), scene.normalIndices.size(), scene.texcoordIndices.size(),
+        scene.shapes.size(), scene.instanceShapes.size(), scene.instanceTransforms.size()
+    };
+    uint64_t offset = sizeof(SceneCacheHeader);
+    for (int i = 0; i < SCENE_CACHE_ARRAY_COUNT; i++) {
+        offset = (offset + SCENE_CACHE_ALIGNMENT - 1) & ~(uint64_t)(SCENE_CACHE_ALIGNMENT - 1);
+        header.arrays[i] = { offset, counts[i] };
+        offset += counts[i] * 4;
+    }
+    header.fileSize = offset;
+
+    // write to a temporary file and rename so a partially written cache is never picked up
+    std::string tmpFile = std::string(cacheFile) + ".tmp";
+    FILE* f = fopen(tmpFile.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    const char padding[SCENE_CACHE_ALIGNMENT] = {};
+    uint64_t written = sizeof(header);
+    for (int i = 0; ok && i < SCENE_CACHE_ARRAY_COUNT; i++) {
+        ok &= fwrite(padding, 1, header.arrays[i].offset - written, f) == header.arrays[i].offset - written;
+        if (counts[i] > 0) ok &= fwrite(arrays[i], 4, counts[i], f) == counts[i];
+        written = header.arrays[i].offset + counts[i] * 4;
+    }
+    ok &= fclose(f) == 0;
+    std::error_code ec;
+    if (ok) std::filesystem::rename(tmpFile, cacheFile, ec);
+    if (!ok || ec) {
+        std::filesystem::remove(tmpFile, ec);
+        return false;
+    }
+    return true;
+}
+
+// Mapped, validated .rtscene file; array() points straight into the mapping
+struct SceneCache {
+    MappedFile file;
+    const SceneCacheHeader* header = nullptr;
+    bool open(const char* cacheFile, const char* sourceFile = nullptr, uint64_t processFlags = 0);
+    void close();
+    template <typename T>
+    const T* array(SceneCacheArrayId id) const { return (const T*)(file.data + header->arrays[id].offset); }
+    size_t count(SceneCacheArrayId id) const { return header->arrays[id].count; }
+    void copyTo(Scene& scene, bool geometry = true) const;
+};
+
+// Without a sourceFile (a baked scene passed directly) neither the source nor the processFlags are checked
+bool SceneCache::open(const char* cacheFile, const char* sourceFile, uint64_t processFlags) {
+    if (!file.open(cacheFile)) return false;
+    header = (const SceneCacheHeader*)file.data;
+    bool valid = file.size >= sizeof(SceneCacheHeader)
+        && memcmp(header->magic, SCENE_CACHE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == SCENE_CACHE_VERSION
+        && header->headerSize == sizeof(SceneCacheHeader)
+        && header->fileSize == file.size;
+    for (int i = 0; valid && i < SCENE_CACHE_ARRAY_COUNT; i++) {
+        valid = header->arrays[i].offset % SCENE_CACHE_ALIGNMENT == 0
+            && header->arrays[i].offset + header->arrays[i].count * 4 <= file.size;
+    }
+    if (valid && sourceFile) {
+        SceneSourceInfo info;
+        valid = header->processFlags == processFlags && getSceneSourceInfo(sourceFile, info) && info.size == header->sourceSize;
+        if (valid && info.mtime != header->sourceMtime) {
+            valid = hashFile(sourceFile) == header->sourceHash;
+        }
+    }
+    if (!valid) close();
+    return valid;
+}
+
+void SceneCache::close() {
+    file.close();
+    header = nullptr;
+}
+
+// Without geometry only the shape and instance arrays are copied, the rest is
+// left to be read from the mapping
+void SceneCache::copyTo(Scene& scene, bool geometry) const {
+    std::vector<float>* floatArrays[] = { &scene.vertices, &scene.normals, &scene.texcoords, &scene.colors };
+    for (int i = SCENE_CACHE_VERTICES; geometry && i <= SCENE_CACHE_COLORS; i++) {
+        const float* src = array<float>((SceneCacheArrayId)i);
+        floatArrays[i]->assign(src, src + count((SceneCacheArrayId)i));
+    }
+    std::vector<uint32_t>* indexArrays[] = { &scene.indices, &scene.normalIndices, &scene.texcoordIndices, &scene.shapes, &scene.instanceShapes };
+    for (int i = SCENE_CACHE_INDICES; i <= SCENE_CACHE_INSTANCE_SHAPES; i++) {
+        if (!geometry && i < SCENE_CACHE_SHAPES) continue;
+        const uint32_t* src = array<uint32_t>((SceneCacheArrayId)i);
+        indexArrays[i - SCENE_CACHE_INDICES]->assign(src, src + count((SceneCacheArrayId)i));
+    }
+    const float* transforms = array<float>(SCENE_CACHE_INSTANCE_TRANSFORMS);
+    scene.instanceTransforms.assign(transforms, transforms + count(SCENE_CACHE_INSTANCE_TRANSFORMS));
+}
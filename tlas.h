@@ -0,0 +1,201 @@
+// tlas.h
+// Devon McKee, 2025
+// Keeps the TLAS and a host copy of its instances, so that moving a few
+// instances only rewrites their records and refits the TLAS. Expects utils.h
+// and accel.h to be included first.
+
+#pragma once
+
+const VkBuildAccelerationStructureFlagsKHR TOP_LEVEL_FLAGS = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+
+// When a commit rebuilds the TLAS instead of updating it: an update keeps the
+// tree built for the old transforms and only grows its boxes, so it is cheap
+// for a few moved instances but traces slower the more moved and the longer it
+// goes without a rebuild
+struct TopLevelUpdatePolicy {
+    float maxDirtyFraction = 0.1f; // of the instances changed since the last commit
+    uint32_t maxUpdates = 32; // since the last rebuild
+};
+
+struct TopLevelFrameStats {
+    size_t instancesUpdated = 0; // records written to the instance buffer
+    bool rebuilt = false;
+    double buildMs = 0.0;
+};
+
+struct TopLevelTotals {
+    size_t commits = 0; // with at least one dirty instance
+    size_t updates = 0;
+    size_t rebuilds = 0;
+    size_t instancesUpdated = 0;
+    double buildMs = 0.0;
+};
+
+// The instance buffer is host visible and stays mapped, changed records are
+// written in place and nothing else is uploaded. Records must not change while
+// a build reading them is in flight, commit waits for its own build.
+struct TopLevelManager {
+    Device device;
+    AccelerationStructure tlas;
+    Buffer instanceBuffer;
+    VkAccelerationStructureInstanceKHR* mapped = nullptr;
+    std::vector<VkAccelerationStructureInstanceKHR> instances; // what commit brings the TLAS up to
+    std::vector<uint32_t> dirty; // indices changed since the last commit
+    std::vector<uint8_t> isDirty;
+    bool structureChanged = false; // an instance now references another BLAS, which updates can't follow
+    VkDeviceSize buildScratchSize = 0;
+    VkDeviceSize updateScratchSize = 0;
+    uint32_t updatesSinceBuild = 0;
+    TopLevelUpdatePolicy policy;
+    TopLevelFrameStats frame; // of the last commit
+    TopLevelTotals totals;
+    BuildStats build(Device device, VkCommandPool commandPool, ScratchArena& scratch, const std::vector<VkAccelerationStructureInstanceKHR>& instances);
+    void setTransform(uint32_t index, const float transform[3][4]);
+    void setInstance(uint32_t index, const VkAccelerationStructureInstanceKHR& instance);
+    const TopLevelFrameStats& commit(VkCommandPool commandPool, ScratchArena& scratch);
+    void recordBuild(VkCommandBuffer commandBuffer, const ScratchArena& scratch, VkBuildAccelerationStructureModeKHR mode) const;
+    void destroy();
+};
+
+// Creates the mapped instance buffer and the TLAS over instances and builds it,
+// replacing whatever was built before
+BuildStats TopLevelManager::build(Device device, VkCommandPool commandPool, ScratchArena& scratch, const std::vector<VkAccelerationStructureInstanceKHR>& instances) {
+    destroy();
+    this->device = device;
+    this->instances = instances;
+    dirty.clear();
+    isDirty.assign(instances.size(), 0);
+    structureChanged = false;
+    updatesSinceBuild = 0;
+
+    BuildStats stats;
+    stats.primitiveCount = instances.size();
+    VkDeviceSize instanceBufferSize = std::max<VkDeviceSize>(1, instances.size()) * sizeof(VkAccelerationStructureInstanceKHR);
+    createBuffer(device, instanceBufferSize, instanceBuffer, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, false);
+    vkCheck(vkMapMemory(device.device, instanceBuffer.memory, 0, VK_WHOLE_SIZE, 0, (void**)&mapped));
+    memcpy(mapped, instances.data(), instances.size() * sizeof(VkAccelerationStructureInstanceKHR));
+
+    VkAccelerationStructureGeometryKHR accelerationStructureGeometry {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+        .geometry = { .instances = { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR } },
+        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
+    };
+    VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+        .flags = TOP_LEVEL_FLAGS,
+        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+        .geometryCount = 1,
+        .pGeometries = &accelerationStructureGeometry
+    };
+    uint32_t instanceCount = (uint32_t)instances.size();
+    VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+    vkGetAccelerationStructureBuildSizesKHR(device.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &accelerationStructureBuildGeometryInfo, &instanceCount, &accelerationStructureBuildSizesInfo);
+    tlas.create(device, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, accelerationStructureBuildSizesInfo.accelerationStructureSize);
+    buildScratchSize = accelerationStructureBuildSizesInfo.buildScratchSize;
+    updateScratchSize = accelerationStructureBuildSizesInfo.updateScratchSize;
+    stats.accelerationSize = accelerationStructureBuildSizesInfo.accelerationStructureSize;
+    stats.scratchSize = buildScratchSize;
+
+    scratch.reserve(device, buildScratchSize, buildScratchSize);
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    recordBuild(commandBuffer, scratch, VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+    stats.buildCalls = 1;
+    auto buildStart = std::chrono::steady_clock::now();
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+    return stats;
+}
+
+void TopLevelManager::setTransform(uint32_t index, const float transform[3][4]) {
+    if (memcmp(instances[index].transform.matrix, transform, sizeof(instances[index].transform.matrix)) == 0) return;
+    memcpy(instances[index].transform.matrix, transform, sizeof(instances[index].transform.matrix));
+    if (!isDirty[index]) dirty.push_back(index);
+    isDirty[index] = 1;
+}
+
+void TopLevelManager::setInstance(uint32_t index, const VkAccelerationStructureInstanceKHR& instance) {
+    if (memcmp(&instances[index], &instance, sizeof(instance)) == 0) return;
+    if (instances[index].accelerationStructureReference != instance.accelerationStructureReference) structureChanged = true;
+    instances[index] = instance;
+    if (!isDirty[index]) dirty.push_back(index);
+    isDirty[index] = 1;
+}
+
+// Writes the dirty records into the mapped buffer and updates the TLAS over
+// them, or rebuilds it as policy says, and waits for that
+const TopLevelFrameStats& TopLevelManager::commit(VkCommandPool commandPool, ScratchArena& scratch) {
+    frame = TopLevelFrameStats();
+    if (dirty.empty()) return frame;
+    for (uint32_t index : dirty) {
+        mapped[index] = instances[index];
+        isDirty[index] = 0;
+    }
+    frame.instancesUpdated = dirty.size();
+    frame.rebuilt = structureChanged || updatesSinceBuild >= policy.maxUpdates || dirty.size() > policy.maxDirtyFraction * instances.size();
+    dirty.clear();
+    structureChanged = false;
+
+    VkDeviceSize scratchSize = frame.rebuilt ? buildScratchSize : updateScratchSize;
+    scratch.reserve(device, scratchSize, scratchSize);
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+    recordBuild(commandBuffer, scratch, frame.rebuilt ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR);
+    auto buildStart = std::chrono::steady_clock::now();
+    endSingleTimeCommands(device, commandPool, commandBuffer);
+    frame.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+    updatesSinceBuild = frame.rebuilt ? 0 : updatesSinceBuild + 1;
+
+    totals.commits++;
+    (frame.rebuilt ? totals.rebuilds : totals.updates)++;
+    totals.instancesUpdated += frame.instancesUpdated;
+    totals.buildMs += frame.buildMs;
+    return frame;
+}
+
+// Records a build (or an in place update) of tlas over the instance buffer,
+// after a barrier so BLAS builds recorded before it are visible. The arena must
+// hold the mode's scratch.
+void TopLevelManager::recordBuild(VkCommandBuffer commandBuffer, const ScratchArena& scratch, VkBuildAccelerationStructureModeKHR mode) const {
+    VkAccelerationStructureGeometryKHR accelerationStructureGeometry {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+        .geometry = {
+            .instances = {
+                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+                .arrayOfPointers = VK_FALSE,
+                .data = { .deviceAddress = getBufferDeviceAddress(device, instanceBuffer) }
+            }
+        },
+        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
+    };
+    VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+        .flags = TOP_LEVEL_FLAGS,
+        .mode = mode,
+        .srcAccelerationStructure = mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR ? tlas.handle : VK_NULL_HANDLE,
+        .dstAccelerationStructure = tlas.handle,
+        .geometryCount = 1,
+        .pGeometries = &accelerationStructureGeometry,
+        .scratchData = { .deviceAddress = scratch.address }
+    };
+    VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo { .primitiveCount = (uint32_t)instances.size() };
+    const VkAccelerationStructureBuildRangeInfoKHR* pAccelerationStructureBuildRangeInfos = &accelerationStructureBuildRangeInfo;
+    accelerationStructureBuildBarrier(commandBuffer);
+    vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &accelerationStructureBuildGeometryInfo, &pAccelerationStructureBuildRangeInfos);
+}
+
+// Freeing the instance buffer's memory unmaps it
+void TopLevelManager::destroy() {
+    tlas.destroy(device);
+    if (instanceBuffer.buffer != VK_NULL_HANDLE) destroyBuffer(device, instanceBuffer);
+    instanceBuffer = Buffer();
+    mapped = nullptr;
+}
+
+void printTopLevelTotals(const TopLevelTotals& totals) {
+    if (totals.commits == 0) return;
+    printf("Committed TLAS changes %zu times: %zu updates and %zu rebuilds, %.1f instances written and %.3f ms building per commit\n", totals.commits,
+        totals.updates, totals.rebuilds, (double)totals.instancesUpdated / totals.commits, totals.buildMs / totals.commits);
+}
@@ -147,9 +147,26 @@ struct Device {
     uint32_t queueFamilyId;
 };
 
+bool supportsAccelerationStructureVertexFormat(Device device, VkFormat format) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(device.physicalDevice, format, &properties);
+    return (properties.bufferFeatures & VK_FORMAT_FEATURE_ACCELERATION_STRUCTURE_VERTEX_BUFFER_BIT_KHR) != 0;
+}
+
+// Size of the largest device local memory heap
+VkDeviceSize deviceLocalHeapSize(Device device) {
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(device.physicalDevice, &memProperties);
+    VkDeviceSize size = 0;
+    for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++) {
+        if (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) size = std::max(size, memProperties.memoryHeaps[i].size);
+    }
+    return size;
+}
+
 struct Buffer {
-    VkBuffer buffer;
-    VkDeviceMemory memory;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
 };
 
 void createBuffer(Device device, VkDeviceSize size, Buffer& buffer, VkBufferUsageFlags usage, bool deviceLocal = true, bool deviceAddress = true) {
@@ -232,6 +249,273 @@ void copyBuffer(Device device, VkCommandPool commandPool, Buffer srcBuffer, Buff
     vkFreeCommandBuffers(device.device, commandPool, 1, &commandBuffer);
 }
 
+VkCommandBuffer beginSingleTimeCommands(Device device, VkCommandPool commandPool) {
+    VkCommandBufferAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = commandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1
+    };
+    VkCommandBuffer commandBuffer;
+    vkCheck(vkAllocateCommandBuffers(device.device, &allocInfo, &commandBuffer));
+    VkCommandBufferBeginInfo beginInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+    vkCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+    return commandBuffer;
+}
+
+// Submits commandBuffer, waits for the queue to drain and frees it
+void endSingleTimeCommands(Device device, VkCommandPool commandPool, VkCommandBuffer commandBuffer) {
+    vkCheck(vkEndCommandBuffer(commandBuffer));
+    VkSubmitInfo submitInfo {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer
+    };
+    vkCheck(vkQueueSubmit(device.queue, 1, &submitInfo, VK_NULL_HANDLE));
+    vkCheck(vkQueueWaitIdle(device.queue));
+    vkFreeCommandBuffers(device.device, commandPool, 1, &commandBuffer);
+}
+
+struct Image {
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+};
+
+// Device local 2D color image with a view
+void createImage(Device device, VkExtent2D extent, VkFormat format, VkImageUsageFlags usage, Image& image) {
+    VkImageCreateInfo imageCI {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = { extent.width, extent.height, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    vkCheck(vkCreateImage(device.device, &imageCI, nullptr, &image.image));
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device.device, image.image, &memRequirements);
+    VkMemoryAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memRequirements.size,
+        .memoryTypeIndex = findMemoryType(device.physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+    };
+    vkCheck(vkAllocateMemory(device.device, &allocInfo, nullptr, &image.memory));
+    vkCheck(vkBindImageMemory(device.device, image.image, image.memory, 0));
+
+    VkImageViewCreateInfo imageViewCI {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = image.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+    vkCheck(vkCreateImageView(device.device, &imageViewCI, nullptr, &image.view));
+}
+
+void destroyImage(Device device, Image image) {
+    vkDestroyImageView(device.device, image.view, nullptr);
+    vkDestroyImage(device.device, image.image, nullptr);
+    vkFreeMemory(device.device, image.memory, nullptr);
+}
+
+void imageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+    VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage) {
+    VkImageMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = srcAccess,
+        .dstAccessMask = dstAccess,
+        .oldLayout = oldLayout,
+        .newLayout = newLayout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// Batched host to device uploads through a persistently mapped staging ring.
+// The ring is split into UPLOADER_SEGMENTS segments, each with its own command
+// buffer and fence. Copies are recorded into the current segment until it is
+// full, then it is submitted and the CPU keeps filling the next segment while
+// the GPU drains the previous ones; a segment's fence is only waited on when
+// the ring wraps back around to it. Data is uploaded once it is complete, so
+// what overlaps the transfers is the copy into the ring, not producing the data.
+const uint32_t UPLOADER_SEGMENTS = 4;
+const VkDeviceSize UPLOADER_COPY_ALIGNMENT = 16;
+
+struct Uploader {
+    struct Segment {
+        VkCommandBuffer commandBuffer;
+        VkFence fence;
+        VkDeviceSize used;
+        bool recording;
+        bool submitted;
+    };
+    Device device;
+    Buffer staging;
+    uint8_t* mapped;
+    VkDeviceSize segmentSize;
+    Segment segments[UPLOADER_SEGMENTS];
+    uint32_t current;
+    VkDeviceSize bytesUploaded;
+    void create(Device device, VkCommandPool commandPool, VkDeviceSize ringSize = 64 << 20);
+    void upload(Buffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+    void flush();
+    void wait();
+    void destroy(VkCommandPool commandPool);
+    void beginSegment();
+};
+
+void Uploader::create(Device device, VkCommandPool commandPool, VkDeviceSize ringSize) {
+    this->device = device;
+    segmentSize = ringSize / UPLOADER_SEGMENTS;
+    current = 0;
+    bytesUploaded = 0;
+    createBuffer(device, segmentSize * UPLOADER_SEGMENTS, staging, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, false, false);
+    vkCheck(vkMapMemory(device.device, staging.memory, 0, VK_WHOLE_SIZE, 0, (void**)&mapped));
+
+    VkCommandBufferAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = commandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1
+    };
+    VkFenceCreateInfo fenceCI { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    for (Segment& segment : segments) {
+        vkCheck(vkAllocateCommandBuffers(device.device, &allocInfo, &segment.commandBuffer));
+        vkCheck(vkCreateFence(device.device, &fenceCI, nullptr, &segment.fence));
+        segment.used = 0;
+        segment.recording = false;
+        segment.submitted = false;
+    }
+}
+
+// Waits until the current segment's previous submission is done and starts recording into it
+void Uploader::beginSegment() {
+    Segment& segment = segments[current];
+    if (segment.submitted) {
+        vkCheck(vkWaitForFences(device.device, 1, &segment.fence, VK_TRUE, UINT64_MAX));
+        vkCheck(vkResetFences(device.device, 1, &segment.fence));
+        segment.submitted = false;
+    }
+    VkCommandBufferBeginInfo beginInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+    vkCheck(vkBeginCommandBuffer(segment.commandBuffer, &beginInfo));
+    segment.used = 0;
+    segment.recording = true;
+}
+
+// Copies data into the ring and records the transfer, splitting it across segments if needed.
+// The copy is only guaranteed to have happened after wait().
+void Uploader::upload(Buffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    const uint8_t* src = (const uint8_t*)data;
+    while (size > 0) {
+        if (!segments[current].recording) beginSegment();
+        Segment& segment = segments[current];
+        VkDeviceSize chunk = std::min(size, segmentSize - segment.used);
+        if (chunk == 0) {
+            flush();
+            continue;
+        }
+        VkDeviceSize srcOffset = current * segmentSize + segment.used;
+        memcpy(mapped + srcOffset, src, chunk);
+        VkBufferCopy copyRegion {
+            .srcOffset = srcOffset,
+            .dstOffset = dstOffset,
+            .size = chunk
+        };
+        vkCmdCopyBuffer(segment.commandBuffer, staging.buffer, dst.buffer, 1, &copyRegion);
+        segment.used = std::min(segmentSize, (segment.used + chunk + UPLOADER_COPY_ALIGNMENT - 1) & ~(UPLOADER_COPY_ALIGNMENT - 1));
+        src += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+        bytesUploaded += chunk;
+    }
+}
+
+// Submits the segment being recorded, if any, without waiting for it
+void Uploader::flush() {
+    Segment& segment = segments[current];
+    if (!segment.recording) return;
+    // make the transfers visible to whatever reads the destination buffers next (AS builds, shaders)
+    VkMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT
+    };
+    vkCmdPipelineBarrier(segment.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    vkCheck(vkEndCommandBuffer(segment.commandBuffer));
+    VkSubmitInfo submitInfo {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &segment.commandBuffer
+    };
+    vkCheck(vkQueueSubmit(device.queue, 1, &submitInfo, segment.fence));
+    segment.recording = false;
+    segment.submitted = true;
+    current = (current + 1) % UPLOADER_SEGMENTS;
+}
+
+// Submits pending copies and waits for all of them to complete
+void Uploader::wait() {
+    flush();
+    for (Segment& segment : segments) {
+        if (!segment.submitted) continue;
+        vkCheck(vkWaitForFences(device.device, 1, &segment.fence, VK_TRUE, UINT64_MAX));
+        vkCheck(vkResetFences(device.device, 1, &segment.fence));
+        segment.submitted = false;
+    }
+}
+
+void Uploader::destroy(VkCommandPool commandPool) {
+    wait();
+    for (Segment& segment : segments) {
+        vkDestroyFence(device.device, segment.fence, nullptr);
+        vkFreeCommandBuffers(device.device, commandPool, 1, &segment.commandBuffer);
+    }
+    vkUnmapMemory(device.device, staging.memory);
+    destroyBuffer(device, staging);
+}
+
+// Copies size bytes of data into dst through a staging buffer of its own and
+// waits for the copy, the unbatched path Uploader replaced
+void uploadThroughStagingBuffer(Device device, VkCommandPool commandPool, Buffer dst, const void* data, VkDeviceSize size) {
+    if (size == 0) return;
+    Buffer staging;
+    createBuffer(device, size, staging, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, false, false);
+    void* mapped;
+    vkCheck(vkMapMemory(device.device, staging.memory, 0, size, 0, &mapped));
+    memcpy(mapped, data, size);
+    vkUnmapMemory(device.device, staging.memory);
+    copyBuffer(device, commandPool, staging, dst, size);
+    destroyBuffer(device, staging);
+}
+
 std::vector<char> readFile(const std::string &filename) {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
     if (!file.is_open()) {
@@ -336,7 +620,7 @@ void Swapchain::create(Device device, GLFWwindow* window, VkSurfaceKHR surface)
         .imageColorSpace = surfaceFormat.colorSpace,
         .imageExtent = extent,
         .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, // cleared or blitted to when presenting
         .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
         .queueFamilyIndexCount = 1,
         .pQueueFamilyIndices = &device.queueFamilyId,
@@ -413,44 +697,53 @@ VkDeviceSize alignedSize(VkDeviceSize value, VkDeviceSize alignment) {
     return (value + alignment - 1) & ~(alignment - 1);
 }
 
+// Records are laid out in the order of the pipeline's groups: the raygen group,
+// then hitGroupCount hit groups (an instance's sbtOffset picks one), then the
+// miss groups
 struct ShaderBindingTable {
     Buffer buffer;
     VkStridedDeviceAddressRegionKHR rgenSBTEntry;
     VkStridedDeviceAddressRegionKHR hitGroupSBTEntry;
     VkStridedDeviceAddressRegionKHR missSBTEntry;
     VkStridedDeviceAddressRegionKHR callableSBTEntry;
-    void create(Device device, VkPipeline rtPipeline, std::vector<VkRayTracingShaderGroupCreateInfoKHR> rtShaderGroups);
+    void create(Device device, VkPipeline rtPipeline, std::vector<VkRayTracingShaderGroupCreateInfoKHR> rtShaderGroups, uint32_t hitGroupCount = 1);
     void destroy(Device device);
 };
 
-void ShaderBindingTable::create(Device device, VkPipeline rtPipeline, std::vector<VkRayTracingShaderGroupCreateInfoKHR> rtShaderGroups) {
+void ShaderBindingTable::create(Device device, VkPipeline rtPipeline, std::vector<VkRayTracingShaderGroupCreateInfoKHR> rtShaderGroups, uint32_t hitGroupCount) {
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtProperties { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR };
     VkPhysicalDeviceProperties2 devProp2 { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &rtProperties };
     vkGetPhysicalDeviceProperties2(device.physicalDevice, &devProp2);
 
     VkDeviceSize handleSize = rtProperties.shaderGroupHandleSize;
+    VkDeviceSize recordStride = alignedSize(handleSize, rtProperties.shaderGroupHandleAlignment);
     VkDeviceSize handleAlignment = rtProperties.shaderGroupBaseAlignment;
+    uint32_t missCount = (uint32_t)rtShaderGroups.size() - 1 - hitGroupCount;
     std::vector<uint8_t> shaderHandleStorage(rtShaderGroups.size() * handleSize);
     vkCheck(vkGetRayTracingShaderGroupHandlesKHR(device.device, rtPipeline, 0, rtShaderGroups.size(), shaderHandleStorage.size(), shaderHandleStorage.data()));
 
-    VkDeviceSize sbtSize = handleSize * rtShaderGroups.size();
     VkDeviceSize rgenOffset = 0;
-    VkDeviceSize hitGroupOffset = alignedSize(handleSize, handleAlignment);
-    VkDeviceSize missOffset = alignedSize(hitGroupOffset + handleSize, handleAlignment);
+    VkDeviceSize hitGroupOffset = alignedSize(recordStride, handleAlignment);
+    VkDeviceSize missOffset = alignedSize(hitGroupOffset + hitGroupCount * recordStride, handleAlignment);
+    VkDeviceSize sbtSize = missOffset + missCount * recordStride;
     createBuffer(device, sbtSize, buffer, VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
 
     void* data;
     vkMapMemory(device.device, buffer.memory, 0, sbtSize, 0, &data);
     memcpy((uint8_t*)data + rgenOffset, shaderHandleStorage.data(), handleSize);
-    memcpy((uint8_t*)data + hitGroupOffset, shaderHandleStorage.data() + handleSize, handleSize);
-    memcpy((uint8_t*)data + missOffset, shaderHandleStorage.data() + handleSize * 2, handleSize);
+    for (uint32_t i = 0; i < hitGroupCount; i++) {
+        memcpy((uint8_t*)data + hitGroupOffset + i * recordStride, shaderHandleStorage.data() + handleSize * (1 + i), handleSize);
+    }
+    for (uint32_t i = 0; i < missCount; i++) {
+        memcpy((uint8_t*)data + missOffset + i * recordStride, shaderHandleStorage.data() + handleSize * (1 + hitGroupCount + i), handleSize);
+    }
     vkUnmapMemory(device.device, buffer.memory);
 
     VkDeviceAddress devAddress = getBufferDeviceAddress(device, buffer);
 
-    rgenSBTEntry = { .deviceAddress = devAddress + rgenOffset, .stride = handleSize, .size = handleSize };
-    hitGroupSBTEntry = { .deviceAddress = devAddress + hitGroupOffset, .stride = handleSize, .size = handleSize };
-    missSBTEntry = { .deviceAddress = devAddress + missOffset, .stride = handleSize, .size = handleSize };
+    rgenSBTEntry = { .deviceAddress = devAddress + rgenOffset, .stride = recordStride, .size = recordStride };
+    hitGroupSBTEntry = { .deviceAddress = devAddress + hitGroupOffset, .stride = recordStride, .size = hitGroupCount * recordStride };
+    missSBTEntry = { .deviceAddress = devAddress + missOffset, .stride = recordStride, .size = missCount * recordStride };
     callableSBTEntry = {};
 }
 